@@ -0,0 +1,186 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+struct arena {
+	struct arena_block *blocks;
+};
+
+// Placed right before every buffer, it keeps the data aligned
+struct arena_buffer_header {
+	size_t size;
+	int mapped;
+	unsigned char padding[ARENA_ALIGNMENT - sizeof(size_t) - sizeof(int)];
+};
+
+static size_t current_usage = 0;
+static size_t peak_usage = 0;
+
+#define ARENA_BLOCK_HEADER_SIZE ((sizeof(struct arena_block) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+void arena_account(size_t size, int release);
+
+struct arena *arena_create()
+{
+	struct arena *arena = malloc(sizeof(struct arena));
+	if (arena == NULL)
+	{
+		return NULL;
+	}
+
+	arena->blocks = NULL;
+	return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+	struct arena_block *block = arena->blocks;
+	if (block == NULL || block->size - block->used < size)
+	{
+		size_t block_size = ARENA_BLOCK_HEADER_SIZE + (size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+
+		block = arena_alloc_buffer(block_size);
+		if (block == NULL)
+		{
+			return NULL;
+		}
+
+		block->next = arena->blocks;
+		block->size = block_size;
+		block->used = ARENA_BLOCK_HEADER_SIZE;
+		arena->blocks = block;
+	}
+
+	void *data = (unsigned char*)block + block->used;
+	block->used += size;
+	return data;
+}
+
+bmp_op_t **arena_alloc_matrix(struct arena *arena, size_t rows, size_t cols)
+{
+	bmp_op_t **matrix = arena_alloc(arena, rows * sizeof(bmp_op_t*));
+	bmp_op_t *data = arena_alloc(arena, rows * cols * sizeof(bmp_op_t));
+	if (matrix == NULL || data == NULL)
+	{
+		return NULL;
+	}
+
+	size_t i;
+	for (i = 0; i < rows; i++)
+	{
+		matrix[i] = &data[i * cols];
+	}
+
+	return matrix;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	if (arena == NULL)
+	{
+		return;
+	}
+
+	while (arena->blocks != NULL)
+	{
+		struct arena_block *next = arena->blocks->next;
+		arena_free_buffer(arena->blocks);
+		arena->blocks = next;
+	}
+
+	free(arena);
+}
+
+void *arena_alloc_buffer(size_t size)
+{
+	if (size > SIZE_MAX - sizeof(struct arena_buffer_header))
+	{
+		return NULL;
+	}
+
+	size_t total = size + sizeof(struct arena_buffer_header);
+	struct arena_buffer_header *header;
+	int mapped = total >= ARENA_HUGE_PAGE_THRESHOLD;
+
+	if (mapped)
+	{
+		// Anonymous mappings are already zero-filled
+		void *base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+#ifdef MADV_HUGEPAGE
+		madvise(base, total, MADV_HUGEPAGE);
+#endif
+		header = base;
+	}
+	else
+	{
+		void *base;
+		if (posix_memalign(&base, ARENA_ALIGNMENT, total) != 0)
+		{
+			return NULL;
+		}
+
+		memset(base, 0, total);
+		header = base;
+	}
+
+	header->size = total;
+	header->mapped = mapped;
+	arena_account(total, 0);
+
+	return header + 1;
+}
+
+void arena_free_buffer(void *buffer)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+
+	struct arena_buffer_header *header = (struct arena_buffer_header*)buffer - 1;
+	arena_account(header->size, 1);
+
+	if (header->mapped)
+	{
+		munmap(header, header->size);
+	}
+	else
+	{
+		free(header);
+	}
+}
+
+size_t arena_peak_usage()
+{
+	return __atomic_load_n(&peak_usage, __ATOMIC_RELAXED);
+}
+
+void arena_account(size_t size, int release)
+{
+	if (release)
+	{
+		__atomic_sub_fetch(&current_usage, size, __ATOMIC_RELAXED);
+		return;
+	}
+
+	size_t usage = __atomic_add_fetch(&current_usage, size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&peak_usage, __ATOMIC_RELAXED);
+	while (usage > peak && !__atomic_compare_exchange_n(&peak_usage, &peak, usage, 0, __ATOMIC_RELAXED,
+		__ATOMIC_RELAXED))
+	{
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "bmp.h"
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_HUGE_PAGE_THRESHOLD (2 * 1024 * 1024) // buffers this large are mapped, with huge pages if possible
+
+/*
+ * Scratch memory of a job (solver matrices, chunk buffers, tables). Allocations are never freed
+ * one by one, everything is released with arena_destroy().
+ */
+struct arena;
+struct arena *arena_create();
+void *arena_alloc(struct arena *arena, size_t size); // aligned to ARENA_ALIGNMENT, zero-filled
+bmp_op_t **arena_alloc_matrix(struct arena *arena, size_t rows, size_t cols);
+void arena_destroy(struct arena *arena);
+
+// Large buffers (pixels, payloads) with their own lifetime, aligned and zero-filled as well
+void *arena_alloc_buffer(size_t size);
+void arena_free_buffer(void *buffer);
+
+// High-water mark of the memory taken by arenas and buffers
+size_t arena_peak_usage();
+
+#endif
+/* ARENA_H */
@@ -1,22 +1,63 @@
 #include "bmp.h"
 #include "utils.h"
+#include "image.h"
+#include "arena.h"
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define BMP_SEED_OFFSET 6
 #define BMP_SHADOW_INDEX_OFFSET 8
 #define BMP_OFFSET_OFFSET 0xA
 #define BMP_SIZE_OFFSET 0x22
 #define BMP_TYPE 0x4D42
+#define BMP_INFO_HEADER_SIZE 40
+#define BMP_PALETTE_SIZE (256 * 4)
+#define BMP_BI_RGB 0
+#define BMP_MAX_OFFSET ((size_t)INT64_MAX < SIZE_MAX ? (size_t)INT64_MAX : SIZE_MAX)
+#define BMP_TEMP_SUFFIX ".tmpXXXXXX" // mkstemp() template
+#define BMP_WRITE_CHUNK_SIZE (64 * 1024 * 1024)
+#define BMP_READ_CHUNK_SIZE (1024 * 1024)
+#define BMP_SHADOW_INFO_SEARCH 256 // bytes at the end of the file where the shadow information is looked for
 
 struct bmp_handle {
 	FILE *file;
+	char *filename;
+	char *temp_filename; // written by bmp_write_temp(), not yet renamed
+	bmp_byte_t *buffer; // contents of an image read from a stream, file reads from it
+	char *output; // image created on stdout, file writes to it until bmp_flush_output()
+	size_t output_size;
+	off_t base; // where the image starts in the file, not 0 for members of a bundle
+	size_t member_size; // size of the image in the file, 0 if it takes the rest of the file
 	bmp_byte_t *pixels;
 	bmp_byte_t *extra_header;
 	struct bmp_header header;
+	struct bmp_shadow_info shadow_info;
+	int has_shadow_info;
+	size_t info_offset; // of the shadow information, from the end of the pixel data (see bmp_tail_size())
+	int format; // IMAGE_FORMAT_*, only BMP images have a header in the file
+	struct bmp_handle **parts; // images whose pixel data this one joins, NULL for a single file
+	size_t part_count;
+	size_t span_size; // pixel data of all the parts, which the header of a span does not describe
 };
 
 int bmp_valid_header(struct bmp_header *header);
+bmp_dword_t bmp_image_size_field(size_t real_byte_count);
+void bmp_image_header(struct bmp_header *header, bmp_dword_t width, bmp_dword_t height, size_t offset);
+void bmp_read_shadow_info(struct bmp_handle *bmp);
+int bmp_parse_shadow_info(struct bmp_handle *bmp, const bmp_byte_t *bytes, size_t len, int whole);
+int bmp_pwrite(int fd, const bmp_byte_t *buffer, size_t len, off_t offset);
+struct bmp_handle *bmp_open_file(FILE *file, const char *filename, bmp_byte_t *buffer, off_t base,
+	size_t member_size);
+size_t bmp_tail_size(struct bmp_handle *bmp, size_t *kept);
+bmp_byte_t *bmp_output_tail(struct bmp_handle *bmp, size_t *size);
+int bmp_write_contents(struct bmp_handle *bmp, int fd, const bmp_byte_t *tail, size_t tail_size, off_t base);
+int bmp_span_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len, int write);
+int bmp_span_write_temp(struct bmp_handle *bmp, int sync);
 
 struct bmp_handle *bmp_struct_init()
 {
@@ -26,116 +67,859 @@ struct bmp_handle *bmp_struct_init()
 		return NULL;
 	}
 
+	bmp->file = NULL;
 	bmp->extra_header = NULL;
 	bmp->pixels = NULL;
+	bmp->filename = NULL;
+	bmp->temp_filename = NULL;
+	bmp->buffer = NULL;
+	bmp->output = NULL;
+	bmp->output_size = 0;
+	bmp->base = 0;
+	bmp->member_size = 0;
+	bmp->has_shadow_info = 0;
+	bmp->info_offset = 0;
+	bmp->format = IMAGE_FORMAT_BMP;
+	bmp->parts = NULL;
+	bmp->part_count = 0;
+	bmp->span_size = 0;
 
 	return bmp;
 }
 
 struct bmp_handle *bmp_open(const char *filename)
+{
+	struct bmp_handle *bmp = bmp_open_header(filename);
+	if (bmp == NULL)
+	{
+		return NULL;
+	}
+
+	if (bmp_load_pixels(bmp) != 0)
+	{
+		bmp_free(bmp);
+		return NULL;
+	}
+
+	return bmp;
+}
+
+struct bmp_handle *bmp_open_header(const char *filename)
+{
+	if (filename == NULL)
+	{
+		return NULL;
+	}
+
+	if (strcmp(filename, BMP_STDIO_NAME) == 0)
+	{
+		size_t size;
+		bmp_byte_t *buffer = bmp_read_all(STDIN_FILENO, &size);
+		return buffer != NULL ? bmp_open_buffer(buffer, size, filename) : NULL;
+	}
+
+	FILE *file = fopen(filename, "r+b");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	return bmp_open_file(file, filename, NULL, 0, 0);
+}
+
+struct bmp_handle *bmp_open_member(const char *filename, const char *name, size_t offset, size_t size)
+{
+	if (filename == NULL || offset > BMP_MAX_OFFSET || size == 0)
+	{
+		return NULL;
+	}
+
+	// Members are only read, a bundle is always written as a whole
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	if (fseeko(file, (off_t)offset, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	return bmp_open_file(file, name, NULL, (off_t)offset, size);
+}
+
+struct bmp_handle *bmp_open_buffer(bmp_byte_t *buffer, size_t size, const char *name)
+{
+	FILE *file = size > 0 ? fmemopen(buffer, size, "r+b") : NULL;
+	if (file == NULL)
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	return bmp_open_file(file, name, buffer, 0, 0);
+}
+
+struct bmp_handle *bmp_open_span(struct bmp_handle **parts, size_t count, const char *name)
+{
+	size_t total = 0, i;
+	for (i = 0; i < count; i++)
+	{
+		if (parts[i]->format != IMAGE_FORMAT_BMP || parts[i]->parts != NULL)
+		{
+			goto free_parts;
+		}
+
+		size_t size = bmp_real_byte_count(&parts[i]->header);
+		if (size > SIZE_MAX - total)
+		{
+			goto free_parts;
+		}
+
+		total += size;
+	}
+
+	if (count == 0)
+	{
+		goto free_parts;
+	}
+
+	struct bmp_handle *bmp = bmp_struct_init();
+	if (bmp == NULL)
+	{
+		goto free_parts;
+	}
+
+	bmp->filename = strdup(name);
+	if (bmp->filename == NULL)
+	{
+		bmp_free(bmp);
+		goto free_parts;
+	}
+
+	// Secrets recovered from it take the palette of the first part, other images need none
+	size_t extra_header_size = (parts[0]->header).offset - sizeof(struct bmp_header);
+	bmp->extra_header = malloc(extra_header_size + 1);
+	if (bmp->extra_header == NULL)
+	{
+		bmp_free(bmp);
+		goto free_parts;
+	}
+
+	memcpy(bmp->extra_header, parts[0]->extra_header, extra_header_size);
+	bmp->header = parts[0]->header;
+	bmp->span_size = total;
+	bmp->shadow_info = parts[0]->shadow_info;
+	bmp->has_shadow_info = parts[0]->has_shadow_info;
+	bmp->parts = parts;
+	bmp->part_count = count;
+
+	return bmp;
+
+	// Error handling
+free_parts:
+	bmp_free_list(parts, count);
+	free(parts);
+
+	return NULL;
+}
+
+bmp_byte_t *bmp_read_all(int fd, size_t *size)
+{
+	size_t capacity = BMP_READ_CHUNK_SIZE;
+	bmp_byte_t *buffer = malloc(capacity);
+	*size = 0;
+
+	while (buffer != NULL)
+	{
+		if (*size == capacity)
+		{
+			bmp_byte_t *larger = realloc(buffer, capacity * 2);
+			if (larger == NULL)
+			{
+				break;
+			}
+
+			buffer = larger;
+			capacity *= 2;
+		}
+
+		ssize_t len = read(fd, buffer + *size, capacity - *size);
+		if (len < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (len == 0)
+		{
+			return buffer;
+		}
+
+		if (len < 0)
+		{
+			break;
+		}
+
+		*size += len;
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+// Takes ownership of file and buffer, even if it fails. file must be positioned at base.
+struct bmp_handle *bmp_open_file(FILE *file, const char *filename, bmp_byte_t *buffer, off_t base,
+	size_t member_size)
+{
+	struct bmp_handle *bmp = bmp_struct_init();
+
+	if (bmp == NULL)
+	{
+		fclose(file);
+		free(buffer);
+		return NULL;
+	}
+
+	bmp->file = file;
+	bmp->buffer = buffer;
+	bmp->base = base;
+	bmp->member_size = member_size;
+	bmp->filename = strdup(filename);
+	if (bmp->filename == NULL)
+	{
+		goto close_file;
+	}
+
+	// Read entire header
+	if (fread(&bmp->header, sizeof(struct bmp_header), 1, file) != 1)
+	{
+		goto close_file;
+	}
+
+	// Validate bmp header
+	if (bmp_valid_header(&bmp->header) != 0)
+	{
+		goto close_file;
+	}
+
+	struct bmp_header *header = &bmp->header;
+	header->image_size = bmp_image_size_field(bmp_real_byte_count(header));
+
+	// Larger info headers (V4, V5) and the palette are kept as they are
+	size_t extra_header_size = (bmp->header).offset - sizeof(struct bmp_header);
+
+	bmp->extra_header = malloc(extra_header_size + 1);
+	if (bmp->extra_header == NULL)
+	{
+		goto close_file;
+	}
+
+	// Load the extra information
+	if (fseeko(bmp->file, bmp->base + (off_t)sizeof(struct bmp_header), SEEK_SET) != 0)
+	{
+		goto free_extra_header;
+	}
+
+	if (fread(bmp->extra_header, sizeof(bmp_byte_t), extra_header_size, file) != extra_header_size)
+	{
+		goto free_extra_header;
+	}
+
+	bmp_read_shadow_info(bmp);
+
+	return bmp;
+
+	// Error handling
+free_extra_header:
+	free(bmp->extra_header);
+close_file:
+	free(bmp->filename);
+	fclose(file);
+	free(buffer);
+	free(bmp);
+
+	return NULL;
+}
+
+struct bmp_handle *bmp_open_image(const char *filename, bmp_dword_t width, bmp_dword_t height)
 {
 	if (filename == NULL)
 	{
 		return NULL;
 	}
 
-	struct bmp_handle *bmp = bmp_struct_init();
+	int format = image_format_for(filename);
+	if (format == IMAGE_FORMAT_BMP)
+	{
+		return bmp_open(filename);
+	}
+
+	struct bmp_handle *bmp = bmp_struct_init();
+	if (bmp == NULL)
+	{
+		return NULL;
+	}
+
+	bmp->format = format;
+	bmp->file = fopen(filename, "rb");
+	if (bmp->file == NULL)
+	{
+		goto free_bmp_handle;
+	}
+
+	size_t offset = 0;
+	if (format == IMAGE_FORMAT_PGM)
+	{
+		if (image_read_pgm_header(bmp->file, &width, &height, &offset) != 0)
+		{
+			printe("Error: \"%s\" is not a binary 8-bit PGM image.\n", filename);
+			goto close_file;
+		}
+	}
+	else if ((width == 0 || height == 0) && image_read_sidecar(filename, &width, &height) != 0)
+	{
+		printe("Error: the dimensions of raw image \"%s\" must be given with -w and -h, or in %s%s.\n",
+			filename, filename, IMAGE_SIDECAR_SUFFIX);
+		goto close_file;
+	}
+
+	bmp_image_header(&bmp->header, width, height, offset);
+	if (image_size_for_format(format, width, height, 8) == 0 || bmp_load_pixels(bmp) != 0)
+	{
+		goto close_file;
+	}
+
+	return bmp;
+
+	// Error handling
+close_file:
+	fclose(bmp->file);
+free_bmp_handle:
+	free(bmp);
+
+	return NULL;
+}
+
+int bmp_load_pixels(struct bmp_handle *bmp)
+{
+	if (bmp == NULL)
+	{
+		return -1;
+	}
+
+	if (bmp->pixels != NULL)
+	{
+		return 0;
+	}
+
+	size_t real_byte_count = bmp_data_size(bmp);
+
+	// Allocate space for image bytes
+	bmp->pixels = arena_alloc_buffer(real_byte_count * sizeof(bmp_byte_t));
+	if (bmp->pixels == NULL)
+	{
+		return -1;
+	}
+
+	// Load image bytes to memmory
+	if (bmp_read_range(bmp, 0, bmp->pixels, real_byte_count) != 0)
+	{
+		arena_free_buffer(bmp->pixels);
+		bmp->pixels = NULL;
+		return -1;
+	}
+
+	// The parts of a span work on their slice of its pixels
+	size_t i, offset = 0;
+	for (i = 0; i < bmp->part_count; i++)
+	{
+		bmp->parts[i]->pixels = &bmp->pixels[offset];
+		offset += bmp_real_byte_count(&bmp->parts[i]->header);
+	}
+
+	return 0;
+}
+
+void bmp_read_shadow_info(struct bmp_handle *bmp)
+{
+	bmp->has_shadow_info = 0;
+	bmp->info_offset = 0;
+
+	if (fseeko(bmp->file, 0, SEEK_END) != 0)
+	{
+		return;
+	}
+
+	off_t file_size = bmp->member_size != 0 ? (off_t)bmp->member_size : ftello(bmp->file);
+	size_t data_size = bmp_real_byte_count(&bmp->header);
+	size_t data_end = (bmp->header).offset + data_size;
+	if (file_size < 0 || (size_t)file_size <= data_end)
+	{
+		return;
+	}
+
+	// Whatever follows the pixel data is kept if there is no shadow information in it
+	size_t tail = (size_t)file_size - data_end;
+	bmp->info_offset = tail;
+
+	bmp_byte_t buffer[BMP_SHADOW_INFO_SEARCH];
+	size_t len = tail < sizeof(buffer) ? tail : sizeof(buffer);
+
+	// Right after the pixel data, where older versions always wrote it
+	if (bmp_read_range(bmp, data_size, buffer, len) == 0 && bmp_parse_shadow_info(bmp, buffer, len, 0) == 0)
+	{
+		bmp->info_offset = 0;
+		return;
+	}
+
+	// Or ending the file, after what the cover had there
+	if (bmp_read_range(bmp, data_size + tail - len, buffer, len) != 0)
+	{
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		if (bmp_parse_shadow_info(bmp, &buffer[i], len - i, 1) == 0)
+		{
+			bmp->info_offset = tail - (len - i);
+			return;
+		}
+	}
+}
+
+// The structure may be smaller (older versions) or larger (newer ones). If whole is set it must take all of len.
+int bmp_parse_shadow_info(struct bmp_handle *bmp, const bmp_byte_t *bytes, size_t len, int whole)
+{
+	struct bmp_shadow_info info;
+	size_t min_size = offsetof(struct bmp_shadow_info, flags) + sizeof(info.flags);
+	if (len < min_size)
+	{
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+	memcpy(&info, bytes, min_size);
+	if (info.magic != BMP_SHADOW_INFO_MAGIC || info.size < min_size || info.size > len || (whole && info.size != len))
+	{
+		return -1;
+	}
+
+	memcpy(&info, bytes, info.size < sizeof(info) ? info.size : sizeof(info));
+	bmp->shadow_info = info;
+	bmp->has_shadow_info = 1;
+
+	return 0;
+}
+
+int bmp_write_shadow_info(struct bmp_handle *bmp)
+{
+	if (!bmp->has_shadow_info)
+	{
+		return 0;
+	}
+
+	(bmp->shadow_info).magic = BMP_SHADOW_INFO_MAGIC;
+	(bmp->shadow_info).size = sizeof(struct bmp_shadow_info);
+
+	return bmp_write_range(bmp, bmp_real_byte_count(&bmp->header) + bmp->info_offset, (bmp_byte_t*)&bmp->shadow_info,
+		sizeof(struct bmp_shadow_info));
+}
+
+void bmp_set_shadow_info(struct bmp_handle *bmp, struct bmp_shadow_info *info)
+{
+	bmp->shadow_info = *info;
+	bmp->has_shadow_info = 1;
+}
+
+uint64_t bmp_shadow_payload_size(const struct bmp_shadow_info *info)
+{
+	return (uint64_t)info->payload_size_high << 32 | info->payload_size;
+}
+
+void bmp_set_shadow_payload_size(struct bmp_shadow_info *info, uint64_t size)
+{
+	info->payload_size = (bmp_dword_t)size;
+	info->payload_size_high = (bmp_dword_t)(size >> 32);
+}
+
+int bmp_read_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len)
+{
+	if (bmp->parts != NULL)
+	{
+		return bmp_span_range(bmp, offset, buffer, len, 0);
+	}
+
+	if (fseeko(bmp->file, bmp->base + (off_t)((bmp->header).offset + offset), SEEK_SET) != 0)
+	{
+		return -1;
+	}
+
+	if (fread(buffer, sizeof(bmp_byte_t), len, bmp->file) != len)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+int bmp_write_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len)
+{
+	if (bmp->parts != NULL)
+	{
+		return bmp_span_range(bmp, offset, buffer, len, 1);
+	}
+
+	if (fseeko(bmp->file, bmp->base + (off_t)((bmp->header).offset + offset), SEEK_SET) != 0)
+	{
+		return -1;
+	}
+
+	if (fwrite(buffer, sizeof(bmp_byte_t), len, bmp->file) != len)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+// Splits a range of the pixel data of a span over the parts it falls in
+int bmp_span_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len, int write)
+{
+	size_t i;
+	for (i = 0; i < bmp->part_count && len > 0; i++)
+	{
+		struct bmp_handle *part = bmp->parts[i];
+		size_t size = bmp_real_byte_count(&part->header);
+		if (offset >= size)
+		{
+			offset -= size;
+			continue;
+		}
+
+		size_t chunk = len < size - offset ? len : size - offset;
+		int status = write ? bmp_write_range(part, offset, buffer, chunk) :
+			bmp_read_range(part, offset, buffer, chunk);
+		if (status != 0)
+		{
+			return -1;
+		}
+
+		buffer += chunk;
+		len -= chunk;
+		offset = 0;
+	}
+
+	return len == 0 ? 0 : -1;
+}
+
+
+int bmp_valid_header(struct bmp_header *header)
+{
+	// First 2 bytes must be 'BM'
+	if (header->type != BMP_TYPE)
+	{
+		return -1;
+	}
+
+	// Must be 8 (grayscale palette) or 24 (BGR) bits per pixel
+	if (header->bits_per_pixel != 8 && header->bits_per_pixel != 24)
+	{
+		return -1;
+	}
+
+	// BITMAPINFOHEADER or any of the larger versions, with uncompressed pixels after the headers
+	if (header->info_header_size < BMP_INFO_HEADER_SIZE || header->compression_method != BMP_BI_RGB ||
+		header->offset < sizeof(struct bmp_header))
+	{
+		return -1;
+	}
+
+	// The pixel data must fit in memory and in a file offset
+	size_t real_byte_count = bmp_real_byte_count(header);
+	if ((int32_t)header->width <= 0 || real_byte_count == 0 || real_byte_count > BMP_MAX_OFFSET - header->offset)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+struct bmp_handle* bmp_create(const char *filename, struct bmp_handle *bmp, bmp_dword_t width, bmp_dword_t height,
+	bmp_word_t bits_per_pixel)
+{
+	if (filename == NULL || bmp == NULL)
+	{
+		return NULL;
+	}
+
+	struct bmp_handle *new_bmp = bmp_struct_init();
+	if (new_bmp == NULL)
+	{
+		return NULL;
+	}
+
+	// If file exists, clear it. If it doesn't, create it. stdout gets the image once it is complete.
+	FILE *file = strcmp(filename, BMP_STDIO_NAME) == 0 ? open_memstream(&new_bmp->output, &new_bmp->output_size) :
+		fopen(filename, "w+b");
+	if (file == NULL)
+	{
+		goto free_bmp_handle;
+	}
+
+	new_bmp->file = file;
+	new_bmp->filename = strdup(filename);
+	if (new_bmp->filename == NULL)
+	{
+		goto close_file;
+	}
+
+	// Copy header from another image
+	memcpy(&new_bmp->header, &bmp->header, sizeof(struct bmp_header));
+
+	size_t extra_header_size = (bmp->header).offset - sizeof(struct bmp_header);
+	if (bits_per_pixel == (bmp->header).bits_per_pixel)
+	{
+		new_bmp->extra_header = malloc(extra_header_size);
+		if (new_bmp->extra_header == NULL)
+		{
+			goto close_file;
+		}
+		memcpy(new_bmp->extra_header, bmp->extra_header, extra_header_size);
+	}
+	else
+	{
+		// The palette of the other image cannot be used, 8 bit images get a grayscale one
+		extra_header_size = bits_per_pixel == 8 ? BMP_PALETTE_SIZE : 0;
+		new_bmp->extra_header = malloc(extra_header_size + 1);
+		if (new_bmp->extra_header == NULL)
+		{
+			goto close_file;
+		}
+
+		int i;
+		for (i = 0; i < extra_header_size; i++)
+		{
+			new_bmp->extra_header[i] = (i % 4 == 3) ? 0 : i / 4;
+		}
+
+		(new_bmp->header).info_header_size = BMP_INFO_HEADER_SIZE;
+		(new_bmp->header).offset = sizeof(struct bmp_header) + extra_header_size;
+		(new_bmp->header).bits_per_pixel = bits_per_pixel;
+		(new_bmp->header).compression_method = 0;
+		(new_bmp->header).number_of_colors = bits_per_pixel == 8 ? 256 : 0;
+		(new_bmp->header).number_of_i_colors = 0;
+	}
+
+	size_t real_byte_count = image_size_for(width, height, bits_per_pixel);
+	if (real_byte_count == 0)
+	{
+		goto free_extra_header;
+	}
+
+	(new_bmp->header).seed = 0;
+	(new_bmp->header).shadow_index = 0;
+	(new_bmp->header).image_size = bmp_image_size_field(real_byte_count);
+	(new_bmp->header).width = width;
+	(new_bmp->header).height = height;
+	(new_bmp->header).size = 0;
+
+	if (bmp_write_header(new_bmp) != 0)
+	{
+		goto free_extra_header;
+	}
+
+	if (fseeko(new_bmp->file, (off_t)sizeof(struct bmp_header), SEEK_SET) != 0)
+	{
+		goto free_extra_header;
+	}
+
+	if (fwrite(new_bmp->extra_header, sizeof(bmp_byte_t), extra_header_size, file) != extra_header_size)
+	{
+		goto free_extra_header;
+	}
+
+	// Allocate space for image bytes
+	new_bmp->pixels = arena_alloc_buffer(real_byte_count * sizeof(bmp_byte_t));
+	if (new_bmp->pixels == NULL)
+	{
+		goto free_extra_header;
+	}
+
+	return new_bmp;
+
+	// Error handling
+
+free_extra_header:
+	free(new_bmp->extra_header);
+close_file:
+	free(new_bmp->filename);
+	fclose(file);
+free_bmp_handle:
+	free(new_bmp);
+
+	return NULL;
+
+}
+
+struct bmp_handle *bmp_create_image(const char *filename, struct bmp_handle *bmp, bmp_dword_t width,
+	bmp_dword_t height, bmp_word_t bits_per_pixel)
+{
+	if (filename == NULL || bmp == NULL)
+	{
+		return NULL;
+	}
+
+	int format = image_format_for(filename);
+	if (format == IMAGE_FORMAT_BMP)
+	{
+		return bmp_create(filename, bmp, width, height, bits_per_pixel);
+	}
 
-	if (bmp == NULL)
+	size_t size = image_size_for_format(format, width, height, bits_per_pixel);
+	if (size == 0)
 	{
+		printe("Error: %s images must be 8-bit grayscale.\n", image_format_name(format));
 		return NULL;
 	}
 
-	FILE *file = fopen(filename, "r+b");
-	if (file == NULL)
+	struct bmp_handle *new_bmp = bmp_struct_init();
+	if (new_bmp == NULL)
 	{
-		goto free_bmp_handle;
+		return NULL;
 	}
 
-	bmp->file = file;
+	new_bmp->format = format;
+	new_bmp->file = fopen(filename, "w+b");
+	if (new_bmp->file == NULL)
+	{
+		goto free_bmp_handle;
+	}
 
-	// Read entire header
-	if (fread(&bmp->header, sizeof(struct bmp_header), 1, file) != 1)
+	size_t offset = 0;
+	if (format == IMAGE_FORMAT_PGM)
+	{
+		if (image_write_pgm_header(new_bmp->file, width, height, &offset) != 0)
+		{
+			goto close_file;
+		}
+	}
+	else if (image_write_sidecar(filename, width, height) != 0)
 	{
 		goto close_file;
 	}
 
-	struct bmp_header *header = &bmp->header;
-	header->image_size = header->width * header->height;
+	bmp_image_header(&new_bmp->header, width, height, offset);
 
-	// Validate bmp header
-	if (bmp_valid_header(&bmp->header) != 0)
+	new_bmp->pixels = arena_alloc_buffer(size * sizeof(bmp_byte_t));
+	if (new_bmp->pixels == NULL)
 	{
 		goto close_file;
 	}
 
-	int padding = padding_for_width(header->width);
-	size_t real_byte_count = (header->width + padding) * header->height;
+	return new_bmp;
 
-	// Allocate space for image bytes
-	bmp->pixels = malloc(real_byte_count * sizeof(bmp_byte_t));
-	if (bmp->pixels == NULL)
+	// Error handling
+close_file:
+	fclose(new_bmp->file);
+free_bmp_handle:
+	free(new_bmp);
+
+	return NULL;
+}
+
+void bmp_image_header(struct bmp_header *header, bmp_dword_t width, bmp_dword_t height, size_t offset)
+{
+	// Only the fields the rest of the program looks at, nothing of it is written to the file
+	memset(header, 0, sizeof(struct bmp_header));
+	header->type = BMP_TYPE;
+	header->offset = offset;
+	header->info_header_size = BMP_INFO_HEADER_SIZE;
+	header->width = width;
+	header->height = height;
+	header->color_planes = 1;
+	header->bits_per_pixel = 8;
+}
+
+void bmp_free(struct bmp_handle *bmp)
+{
+	if (bmp == NULL)
 	{
-		goto close_file;
+		return;
 	}
 
-	// Load image bytes to memmory
-	if (fseek(bmp->file, (bmp->header).offset, 0) != 0)
+	bmp_discard_temp(bmp);
+
+	// The pixels of the parts belong to the span
+	size_t i;
+	for (i = 0; i < bmp->part_count; i++)
 	{
-		goto free_pixels;
+		bmp->parts[i]->pixels = NULL;
+		bmp_free(bmp->parts[i]);
 	}
 
-	size_t read = fread(bmp->pixels, sizeof(bmp_byte_t), real_byte_count, file);
-	if (read != real_byte_count)
+	if (bmp->file != NULL)
 	{
-		goto free_pixels;
+		fclose(bmp->file);
 	}
 
-	size_t extra_header_size = (bmp->header).offset - sizeof(struct bmp_header);
+	free(bmp->parts);
+	arena_free_buffer(bmp->pixels);
+	free(bmp->extra_header);
+	free(bmp->filename);
+	free(bmp->buffer);
+	free(bmp->output);
+	free(bmp);
+}
 
-	bmp->extra_header = malloc((bmp->header).offset - sizeof(extra_header_size));
-	if (bmp->extra_header == NULL)
+void bmp_free_list(struct bmp_handle **bmp_list, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
 	{
-		goto free_pixels;
+		bmp_free(bmp_list[i]);
 	}
+}
 
-	// Load the extra information
-	if (fseek(bmp->file, sizeof(struct bmp_header), 0) != 0)
+int bmp_write_pixels(struct bmp_handle *bmp)
+{
+	if (bmp == NULL || bmp->pixels == NULL)
 	{
-		goto free_extra_header;
+		return -1;
 	}
 
-	if (fread(bmp->extra_header, sizeof(bmp_byte_t), extra_header_size, file) != extra_header_size)
+	if (fseeko(bmp->file, bmp->base + (off_t)(bmp->header).offset, SEEK_SET) != 0)
 	{
-		goto free_extra_header;
+		return -1;
 	}
 
-	return bmp;
+	size_t real_byte_count = bmp_data_size(bmp);
 
-	// Error handling
-free_extra_header:
-	free(bmp->extra_header);
-free_pixels:
-	free(bmp->pixels);
-close_file:
-	fclose(file);
-free_bmp_handle:
-	free(bmp);
+	if (fwrite(bmp->pixels, sizeof(bmp_byte_t), real_byte_count, bmp->file) != real_byte_count)
+	{
+		return -1;
+	}
 
-	return NULL;
+	return bmp_write_shadow_info(bmp);
 }
 
-
-int bmp_valid_header(struct bmp_header *header)
+int bmp_write_header(struct bmp_handle *bmp)
 {
-	// First 2 bytes must be 'BM'
-	if (header->type != BMP_TYPE)
+	// The header of other formats is written when they are created
+	if (bmp->format != IMAGE_FORMAT_BMP)
+	{
+		return 0;
+	}
+
+	if (fseeko(bmp->file, bmp->base, SEEK_SET) != 0)
 	{
 		return -1;
 	}
 
-	// Must be 8 bits per pixel
-	if (header->bits_per_pixel != 8)
+	if (fwrite(&bmp->header, sizeof(struct bmp_header), 1, bmp->file) != 1)
 	{
 		return -1;
 	}
@@ -143,120 +927,225 @@ int bmp_valid_header(struct bmp_header *header)
 	return 0;
 }
 
-struct bmp_handle* bmp_create(const char *filename, struct bmp_handle *bmp, bmp_dword_t width, bmp_dword_t height)
+int bmp_write_temp(struct bmp_handle *bmp, int sync)
 {
-	if (filename == NULL || bmp == NULL)
+	if (bmp != NULL && bmp->parts != NULL)
 	{
-		return NULL;
+		return bmp_span_write_temp(bmp, sync);
 	}
 
-	struct bmp_handle *new_bmp = bmp_struct_init();
-	if (new_bmp == NULL)
+	if (bmp == NULL || bmp->pixels == NULL || bmp->filename == NULL || bmp->format != IMAGE_FORMAT_BMP ||
+		bmp->temp_filename != NULL)
 	{
-		return NULL;
+		return -1;
 	}
 
-	// If file exists, clear it. If it doesn't, create it.
-	FILE *file = fopen(filename, "w+b");
-	if (file == NULL)
+	size_t len = strlen(bmp->filename) + sizeof(BMP_TEMP_SUFFIX);
+	bmp->temp_filename = malloc(len);
+	if (bmp->temp_filename == NULL)
 	{
-		goto free_bmp_handle;
+		return -1;
 	}
 
-	new_bmp->file = file;
-	// Copy header from another image
-	if (memcpy(&new_bmp->header, &bmp->header, sizeof(struct bmp_header)) == NULL)
+	snprintf(bmp->temp_filename, len, "%s%s", bmp->filename, BMP_TEMP_SUFFIX);
+
+	int fd = mkstemp(bmp->temp_filename);
+	if (fd < 0)
 	{
-		goto close_file;
+		free(bmp->temp_filename);
+		bmp->temp_filename = NULL;
+		return -1;
 	}
 
+	bmp_byte_t *tail = NULL;
+	size_t tail_size;
+	struct stat st;
 
-	int padding = padding_for_width(width);
-	size_t real_byte_count = (width + padding) * height;
+	if (fflush(bmp->file) != 0 || fstat(fileno(bmp->file), &st) != 0 || fchmod(fd, st.st_mode & 07777) != 0)
+	{
+		goto discard_temp;
+	}
 
-	(new_bmp->header).seed = 0;
-	(new_bmp->header).shadow_index = 0;
-	(new_bmp->header).image_size = width * height;
-	(new_bmp->header).width = width;
-	(new_bmp->header).height = height;
-	(new_bmp->header).size = 0;
+	tail = bmp_output_tail(bmp, &tail_size);
+	if (tail == NULL)
+	{
+		goto discard_temp;
+	}
 
-	if (bmp_write_header(new_bmp) != 0)
+	// Running out of space is found out here, before anything is written
+	size_t data_end = (bmp->header).offset + bmp_real_byte_count(&bmp->header);
+	int error = posix_fallocate(fd, 0, (off_t)(data_end + tail_size));
+	if (error != 0 && error != EINVAL && error != EOPNOTSUPP)
 	{
-		goto close_file;
+		goto discard_temp;
 	}
 
-	if (fseek(new_bmp->file, sizeof(struct bmp_header), 0) != 0)
+	if (bmp_write_contents(bmp, fd, tail, tail_size, 0) != 0)
 	{
-		goto close_file;
+		goto discard_temp;
 	}
 
-	size_t extra_header_size = (new_bmp->header).offset - sizeof(struct bmp_header);
-	new_bmp->extra_header = malloc((bmp->header).offset - sizeof(extra_header_size));
-	memcpy(new_bmp->extra_header, bmp->extra_header, extra_header_size);
-	if (fwrite(new_bmp->extra_header, sizeof(bmp_byte_t), extra_header_size, file) != extra_header_size)
+	if (sync && fsync(fd) != 0)
 	{
-		goto close_file;
+		goto discard_temp;
 	}
 
-	// Allocate space for image bytes
-	new_bmp->pixels = calloc(real_byte_count, sizeof(bmp_byte_t));
-	if (new_bmp->pixels == NULL)
+	free(tail);
+
+	if (close(fd) != 0)
 	{
-		goto close_file;
+		bmp_discard_temp(bmp);
+		return -1;
 	}
 
-	return new_bmp;
+	return 0;
 
 	// Error handling
+discard_temp:
+	free(tail);
+	close(fd);
+	bmp_discard_temp(bmp);
 
-close_file:
-	fclose(file);
-free_bmp_handle:
-	free(bmp);
+	return -1;
+}
 
-	return NULL;
+int bmp_span_write_temp(struct bmp_handle *bmp, int sync)
+{
+	if (bmp->pixels == NULL)
+	{
+		return -1;
+	}
 
+	size_t i;
+	for (i = 0; i < bmp->part_count; i++)
+	{
+		struct bmp_handle *part = bmp->parts[i];
+		(part->header).seed = (bmp->header).seed;
+		(part->header).shadow_index = (bmp->header).shadow_index;
+		part->shadow_info = bmp->shadow_info;
+		part->has_shadow_info = bmp->has_shadow_info;
+		(part->shadow_info).part = i;
+		(part->shadow_info).parts = bmp->part_count;
+
+		if (bmp_write_temp(part, sync) != 0)
+		{
+			bmp_discard_temp(bmp);
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
-void bmp_free(struct bmp_handle *bmp)
+int bmp_write_stream(struct bmp_handle *bmp, int fd)
 {
-	if (bmp == NULL)
+	return bmp_write_at(bmp, fd, -1);
+}
+
+int bmp_write_at(struct bmp_handle *bmp, int fd, off_t offset)
+{
+	if (bmp == NULL || bmp->pixels == NULL || bmp->format != IMAGE_FORMAT_BMP || bmp->parts != NULL)
 	{
-		return;
+		return -1;
 	}
 
-	fclose(bmp->file);
-	free(bmp->pixels);
-	free(bmp->extra_header);
-	free(bmp);
+	size_t tail_size;
+	bmp_byte_t *tail = bmp_output_tail(bmp, &tail_size);
+	if (tail == NULL)
+	{
+		return -1;
+	}
+
+	int status = bmp_write_contents(bmp, fd, tail, tail_size, offset);
+	free(tail);
+
+	return status;
 }
 
-void bmp_free_list(struct bmp_handle **bmp_list, size_t len)
+size_t bmp_output_size(struct bmp_handle *bmp)
 {
-	size_t i;
-	for (i = 0; i < len; i++)
+	if (bmp->parts != NULL)
 	{
-		bmp_free(bmp_list[i]);
+		return 0;
 	}
+
+	size_t kept;
+	size_t tail_size = bmp_tail_size(bmp, &kept);
+
+	return (bmp->header).offset + bmp_real_byte_count(&bmp->header) + tail_size;
 }
 
-int bmp_write_pixels(struct bmp_handle *bmp)
+int bmp_flush_output(struct bmp_handle *bmp)
 {
-	if (bmp == NULL || bmp->pixels == NULL)
+	if (bmp == NULL)
 	{
 		return -1;
 	}
 
-	if (fseek(bmp->file, (bmp->header).offset, 0) != 0)
+	// The size of a memory stream is its position, which must be at the end of what was written
+	if (fseeko(bmp->file, 0, SEEK_END) != 0 || fflush(bmp->file) != 0)
 	{
 		return -1;
 	}
 
-	int padding = padding_for_width((bmp->header).width);
-	size_t real_byte_count = ((bmp->header).width + padding) * (bmp->header).height;
+	if (bmp->output == NULL)
+	{
+		return 0;
+	}
+
+	return bmp_pwrite(STDOUT_FILENO, (bmp_byte_t*)bmp->output, bmp->output_size, -1);
+}
 
-	if (fwrite(bmp->pixels, sizeof(bmp_byte_t), real_byte_count, bmp->file) != real_byte_count)
+/*
+ * Whatever followed the pixel data in the original file (such as an ICC profile, which the header
+ * points to) is kept where it was, and the shadow information is written after it, replacing
+ * the one the file already had. Returns the size of the tail to write, and in kept the size of
+ * the original one.
+ */
+size_t bmp_tail_size(struct bmp_handle *bmp, size_t *kept)
+{
+	*kept = bmp->info_offset;
+	return *kept + (bmp->has_shadow_info ? sizeof(struct bmp_shadow_info) : 0);
+}
+
+bmp_byte_t *bmp_output_tail(struct bmp_handle *bmp, size_t *size)
+{
+	size_t kept;
+	*size = bmp_tail_size(bmp, &kept);
+
+	bmp_byte_t *tail = malloc(*size + 1);
+	if (tail == NULL)
+	{
+		return NULL;
+	}
+
+	if (kept > 0 && bmp_read_range(bmp, bmp_real_byte_count(&bmp->header), tail, kept) != 0)
+	{
+		free(tail);
+		return NULL;
+	}
+
+	if (bmp->has_shadow_info)
+	{
+		(bmp->shadow_info).magic = BMP_SHADOW_INFO_MAGIC;
+		(bmp->shadow_info).size = sizeof(struct bmp_shadow_info);
+		memcpy(&tail[kept], &bmp->shadow_info, sizeof(struct bmp_shadow_info));
+	}
+
+	return tail;
+}
+
+// Header, extra header, pixels and tail, at their offsets from base or (if it is negative) one after the other
+int bmp_write_contents(struct bmp_handle *bmp, int fd, const bmp_byte_t *tail, size_t tail_size, off_t base)
+{
+	size_t extra_header_size = (bmp->header).offset - sizeof(struct bmp_header);
+	size_t data_end = (bmp->header).offset + bmp_real_byte_count(&bmp->header);
+	int sequential = base < 0;
+
+	if (bmp_pwrite(fd, (bmp_byte_t*)&bmp->header, sizeof(struct bmp_header), sequential ? -1 : base) != 0 ||
+		bmp_pwrite(fd, bmp->extra_header, extra_header_size, sequential ? -1 : base + (off_t)sizeof(struct bmp_header)) != 0 ||
+		bmp_pwrite(fd, bmp->pixels, bmp_real_byte_count(&bmp->header), sequential ? -1 : base + (off_t)(bmp->header).offset) != 0 ||
+		bmp_pwrite(fd, tail, tail_size, sequential ? -1 : base + (off_t)data_end) != 0)
 	{
 		return -1;
 	}
@@ -264,18 +1153,89 @@ int bmp_write_pixels(struct bmp_handle *bmp)
 	return 0;
 }
 
-int bmp_write_header(struct bmp_handle *bmp)
+int bmp_commit_temp(struct bmp_handle *bmp)
 {
-	if (fseek(bmp->file, 0, 0) != 0)
+	size_t i;
+	for (i = 0; bmp != NULL && i < bmp->part_count; i++)
+	{
+		if (bmp_commit_temp(bmp->parts[i]) != 0)
+		{
+			return -1;
+		}
+	}
+
+	if (bmp != NULL && bmp->parts != NULL)
+	{
+		return 0;
+	}
+
+	if (bmp == NULL || bmp->temp_filename == NULL)
 	{
 		return -1;
 	}
 
-	if (fwrite(&bmp->header, sizeof(struct bmp_header), 1, bmp->file) != 1)
+	if (rename(bmp->temp_filename, bmp->filename) != 0)
+	{
+		bmp_discard_temp(bmp);
+		return -1;
+	}
+
+	free(bmp->temp_filename);
+	bmp->temp_filename = NULL;
+
+	// The handle keeps working on the new file
+	FILE *file = fopen(bmp->filename, "r+b");
+	if (file == NULL)
 	{
 		return -1;
 	}
 
+	fclose(bmp->file);
+	bmp->file = file;
+
+	return 0;
+}
+
+void bmp_discard_temp(struct bmp_handle *bmp)
+{
+	size_t i;
+	for (i = 0; bmp != NULL && i < bmp->part_count; i++)
+	{
+		bmp_discard_temp(bmp->parts[i]);
+	}
+
+	if (bmp == NULL || bmp->temp_filename == NULL)
+	{
+		return;
+	}
+
+	unlink(bmp->temp_filename);
+	free(bmp->temp_filename);
+	bmp->temp_filename = NULL;
+}
+
+// A negative offset writes at the current position, which also works on pipes
+int bmp_pwrite(int fd, const bmp_byte_t *buffer, size_t len, off_t offset)
+{
+	while (len > 0)
+	{
+		size_t chunk = len < BMP_WRITE_CHUNK_SIZE ? len : BMP_WRITE_CHUNK_SIZE;
+		ssize_t written = offset < 0 ? write(fd, buffer, chunk) : pwrite(fd, buffer, chunk, offset);
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (written <= 0)
+		{
+			return -1;
+		}
+
+		buffer += written;
+		offset = offset < 0 ? offset : offset + written;
+		len -= written;
+	}
+
 	return 0;
 }
 
@@ -290,6 +1250,38 @@ struct bmp_header *bmp_get_header(struct bmp_handle *bmp)
 	return &bmp->header;
 }
 
+size_t bmp_real_byte_count(struct bmp_header *header)
+{
+	return image_size_for(header->width, header->height, header->bits_per_pixel);
+}
+
+size_t bmp_data_size(struct bmp_handle *bmp)
+{
+	if (bmp->parts != NULL)
+	{
+		return bmp->span_size;
+	}
+
+	struct bmp_header *header = &bmp->header;
+	return image_size_for_format(bmp->format, header->width, header->height, header->bits_per_pixel);
+}
+
+int bmp_get_format(struct bmp_handle *bmp)
+{
+	return bmp->format;
+}
+
+const char *bmp_get_filename(struct bmp_handle *bmp)
+{
+	return bmp->filename;
+}
+
+bmp_dword_t bmp_image_size_field(size_t real_byte_count)
+{
+	// May be 0 for uncompressed images, which is the only option once it does not fit
+	return real_byte_count <= UINT32_MAX ? (bmp_dword_t)real_byte_count : 0;
+}
+
 bmp_byte_t *bmp_get_pixels(struct bmp_handle *bmp)
 {
 	if (bmp == NULL)
@@ -299,3 +1291,13 @@ bmp_byte_t *bmp_get_pixels(struct bmp_handle *bmp)
 
 	return bmp->pixels;
 }
+
+struct bmp_shadow_info *bmp_get_shadow_info(struct bmp_handle *bmp)
+{
+	if (bmp == NULL || !bmp->has_shadow_info)
+	{
+		return NULL;
+	}
+
+	return &bmp->shadow_info;
+}
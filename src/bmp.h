@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 typedef uint32_t bmp_dword_t;
 typedef uint16_t bmp_word_t;
@@ -32,19 +33,107 @@ struct bmp_header {
 	bmp_dword_t number_of_i_colors; // number of important colors
 };
 
+/*
+ * Optional information stored by this program right after the pixel data of a shadow. BMP
+ * readers ignore it. size allows newer versions to add fields at the end.
+ */
+struct bmp_shadow_info {
+	bmp_dword_t magic; // BMP_SHADOW_INFO_MAGIC
+	bmp_word_t size; // size of this structure
+	bmp_word_t flags; // BMP_SHADOW_* flags
+	bmp_dword_t checksum; // CRC32C of the truncated secret pixel data
+	bmp_dword_t secret_width;
+	bmp_dword_t secret_height;
+	bmp_word_t secret_bits_per_pixel;
+	bmp_word_t lsb_depth; // LSBs used in each cover byte
+	bmp_word_t codec; // CODEC_* used on the secret before sharing it
+	bmp_dword_t payload_size; // low 32 bits of the size of the shared payload, if codec is not CODEC_NONE
+	bmp_word_t secret_format; // IMAGE_FORMAT_* of the secret
+	bmp_word_t part; // position of this cover in a shadow that spans several of them (see span.h)
+	bmp_word_t parts; // number of covers of that shadow, 0 if it is a single one
+	bmp_word_t k; // K the payload was shared with, 0 if the shadow does not record it
+	bmp_dword_t payload_size_high; // high 32 bits of the size of the shared payload
+};
+
 #pragma pack(pop)
 
+#define BMP_SHADOW_INFO_MAGIC 0x48535243 // "CRSH"
+#define BMP_SHADOW_CHECKSUM 0x0001
+
+#define BMP_STDIO_NAME "-" // reads the image from stdin, or writes it to stdout
+
 struct bmp_handle;
 struct bmp_handle *bmp_open(const char *filename);
+struct bmp_handle *bmp_open_header(const char *filename); // pixels are not loaded
+
+// Opens an image already in memory (such as a member of an archive), taking ownership of buffer
+struct bmp_handle *bmp_open_buffer(bmp_byte_t *buffer, size_t size, const char *name);
+bmp_byte_t *bmp_read_all(int fd, size_t *size); // until end of file, malloc()'d
+
+// Opens, read only, an image stored at offset in a larger file (see bundle.h), named name
+struct bmp_handle *bmp_open_member(const char *filename, const char *name, size_t offset, size_t size);
+int bmp_load_pixels(struct bmp_handle *bmp);
+
+/*
+ * Joins the pixel data of count open BMP images, in order, into a single shadow named name, which
+ * takes ownership of parts (freeing them on error too). It has the header of the first part, so
+ * only bmp_data_size() gives the size of the joined data. Writing it gives every part the seed,
+ * index and shadow information of the shadow, plus its position in it. It can not be written as
+ * a stream.
+ */
+struct bmp_handle *bmp_open_span(struct bmp_handle **parts, size_t count, const char *name);
+
+/*
+ * Secret images may also be PGM or raw (see image.h), chosen by the file extension. Raw images
+ * take width and height from the arguments or from their sidecar file. BMP images ignore them.
+ */
+struct bmp_handle *bmp_open_image(const char *filename, bmp_dword_t width, bmp_dword_t height);
+struct bmp_handle *bmp_create_image(const char *filename, struct bmp_handle *bmp, bmp_dword_t width,
+	bmp_dword_t height, bmp_word_t bits_per_pixel);
 void bmp_free(struct bmp_handle *bmp);
 void bmp_free_list(struct bmp_handle **bmp_list, size_t len);
 int bmp_write_pixels(struct bmp_handle *bmp);
 int bmp_write_header(struct bmp_handle *bmp);
-struct bmp_handle* bmp_create(const char *filename, struct bmp_handle *bmp, bmp_dword_t width, bmp_dword_t height);
+int bmp_write_shadow_info(struct bmp_handle *bmp);
+void bmp_set_shadow_info(struct bmp_handle *bmp, struct bmp_shadow_info *info);
+
+// The payload size is split in two fields, shadows written before the high one was added only have the low one
+uint64_t bmp_shadow_payload_size(const struct bmp_shadow_info *info);
+void bmp_set_shadow_payload_size(struct bmp_shadow_info *info, uint64_t size);
+
+/*
+ * Crash-safe output of a BMP image with its pixels loaded: bmp_write_temp() writes the whole file
+ * (with fsync if sync is set) next to the original, which is only replaced, atomically, by
+ * bmp_commit_temp(). bmp_discard_temp() removes it instead, leaving the original untouched.
+ */
+int bmp_write_temp(struct bmp_handle *bmp, int sync);
+int bmp_commit_temp(struct bmp_handle *bmp);
+void bmp_discard_temp(struct bmp_handle *bmp);
+
+// Writes the whole file that bmp_write_temp() would, sequentially (fd may be a pipe)
+int bmp_write_stream(struct bmp_handle *bmp, int fd);
+int bmp_write_at(struct bmp_handle *bmp, int fd, off_t offset); // with pwrite(), starting at offset
+size_t bmp_output_size(struct bmp_handle *bmp); // of that file, 0 on error
+
+// Images created on stdout are kept in memory until this is called, so failures write nothing
+int bmp_flush_output(struct bmp_handle *bmp);
+
+// Direct access to a byte range of the pixel data, offset is relative to the data offset
+int bmp_read_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len);
+int bmp_write_range(struct bmp_handle *bmp, size_t offset, bmp_byte_t *buffer, size_t len);
+struct bmp_handle* bmp_create(const char *filename, struct bmp_handle *bmp, bmp_dword_t width, bmp_dword_t height,
+	bmp_word_t bits_per_pixel);
+
+// Size of the pixel data, including row padding
+size_t bmp_real_byte_count(struct bmp_header *header);
+size_t bmp_data_size(struct bmp_handle *bmp); // same, for images in any format and shadows spanning several
 
 // Getters
 struct bmp_header *bmp_get_header(struct bmp_handle *bmp);
 bmp_byte_t *bmp_get_pixels(struct bmp_handle *bmp);
+struct bmp_shadow_info *bmp_get_shadow_info(struct bmp_handle *bmp); // NULL if not present
+int bmp_get_format(struct bmp_handle *bmp);
+const char *bmp_get_filename(struct bmp_handle *bmp);
 
 #endif
 /* BMP_H */
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include "bundle.h"
+#include "writer.h"
+#include "utils.h"
+#include "pool.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BUNDLE_MAGIC 0x42535243 // "CRSB"
+#define BUNDLE_VERSION 1
+#define BUNDLE_TEMP_SUFFIX ".tmpXXXXXX"
+
+#pragma pack(push, 1)
+
+struct bundle_header {
+	bmp_dword_t magic; // BUNDLE_MAGIC
+	bmp_word_t version;
+	bmp_word_t count; // entries in the index, which follows
+};
+
+struct bundle_entry {
+	uint64_t offset; // from the start of the bundle
+	uint64_t size;
+	bmp_word_t shadow_index;
+	bmp_word_t seed;
+};
+
+#pragma pack(pop)
+
+struct bundle_job {
+	const char *filename;
+	int fd;
+	struct bmp_handle **images;
+	struct bundle_entry *entries;
+	int load_pixels;
+};
+
+int bundle_write_member(void *arg, size_t index);
+int bundle_open_member(void *arg, size_t index);
+int bundle_read_index(int fd, struct bundle_header *header, struct bundle_entry **entries);
+
+int bundle_write(const char *filename, struct bmp_handle **images, size_t count)
+{
+	if (count == 0 || count > BUNDLE_MAX_MEMBERS)
+	{
+		return -1;
+	}
+
+	struct bundle_entry *entries = calloc(count, sizeof(struct bundle_entry));
+	size_t len = strlen(filename) + sizeof(BUNDLE_TEMP_SUFFIX);
+	char *temp_filename = malloc(len);
+	int fd = -1;
+
+	if (entries == NULL || temp_filename == NULL)
+	{
+		goto free_entries;
+	}
+
+	// The layout is known before anything is written, so every member can be written at once
+	struct bundle_header header = { BUNDLE_MAGIC, BUNDLE_VERSION, count };
+	uint64_t offset = sizeof(header) + count * sizeof(struct bundle_entry);
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		struct bmp_header *image_header = bmp_get_header(images[i]);
+
+		entries[i].offset = (offset + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+		entries[i].size = bmp_output_size(images[i]);
+		entries[i].shadow_index = image_header->shadow_index;
+		entries[i].seed = image_header->seed;
+
+		if (entries[i].size == 0)
+		{
+			goto free_entries;
+		}
+
+		offset = entries[i].offset + entries[i].size;
+	}
+
+	snprintf(temp_filename, len, "%s%s", filename, BUNDLE_TEMP_SUFFIX);
+	fd = mkstemp(temp_filename);
+	if (fd < 0)
+	{
+		goto free_entries;
+	}
+
+	// Running out of space is found out here, before anything is written
+	int error = posix_fallocate(fd, 0, (off_t)offset);
+	if ((error != 0 && error != EINVAL && error != EOPNOTSUPP) || fchmod(fd, 0644) != 0)
+	{
+		goto remove_temp;
+	}
+
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		pwrite(fd, entries, count * sizeof(struct bundle_entry), sizeof(header)) !=
+		count * sizeof(struct bundle_entry))
+	{
+		goto remove_temp;
+	}
+
+	struct bundle_job job = { filename, fd, images, entries, 0 };
+	if (pool_run(count, bundle_write_member, &job) != 0)
+	{
+		goto remove_temp;
+	}
+
+	if (fsync_mode != WRITER_SYNC_NONE && fsync(fd) != 0)
+	{
+		goto remove_temp;
+	}
+
+	if (close(fd) != 0)
+	{
+		fd = -1;
+		goto remove_temp;
+	}
+
+	if (rename(temp_filename, filename) != 0)
+	{
+		fd = -1;
+		goto remove_temp;
+	}
+
+	printv("Images written to the bundle: %lu (%lu threads)\n", (unsigned long)count,
+		(unsigned long)pool_last_threads());
+
+	free(temp_filename);
+	free(entries);
+	return 0;
+
+	// Error handling
+remove_temp:
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	unlink(temp_filename);
+free_entries:
+	printe("Error: the shadows could not be written to bundle %s.\n", filename);
+	free(temp_filename);
+	free(entries);
+
+	return -1;
+}
+
+int bundle_write_member(void *arg, size_t index)
+{
+	struct bundle_job *job = arg;
+	return bmp_write_at(job->images[index], job->fd, (off_t)job->entries[index].offset);
+}
+
+struct bmp_handle **bundle_open(const char *filename, size_t max, size_t *count, int load_pixels)
+{
+	struct bundle_header header;
+	struct bundle_entry *entries = NULL;
+	struct bmp_handle **images = NULL;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		printe("Error: unable to open bundle \"%s\".\n", filename);
+		return NULL;
+	}
+
+	if (bundle_read_index(fd, &header, &entries) != 0)
+	{
+		printe("Error: \"%s\" is not a valid shadow bundle.\n", filename);
+		goto close_fd;
+	}
+
+	*count = header.count < max ? header.count : max;
+	images = calloc(*count, sizeof(struct bmp_handle*));
+	if (images == NULL)
+	{
+		goto close_fd;
+	}
+
+	// Only the selected members are read, each one from its own offset
+	struct bundle_job job = { filename, fd, images, entries, load_pixels };
+	if (pool_run(*count, bundle_open_member, &job) != 0)
+	{
+		size_t i;
+		for (i = 0; i < *count; i++)
+		{
+			if (images[i] == NULL)
+			{
+				printe("Error: member %lu of bundle \"%s\" is not a valid BMP image.\n", (unsigned long)i, filename);
+				break;
+			}
+		}
+
+		bmp_free_list(images, *count);
+		free(images);
+		images = NULL;
+	}
+	else
+	{
+		printv("Images loaded from the bundle: %lu of %u (%lu threads)\n", (unsigned long)*count, header.count,
+			(unsigned long)pool_last_threads());
+	}
+
+close_fd:
+	free(entries);
+	close(fd);
+
+	return images;
+}
+
+int bundle_open_member(void *arg, size_t index)
+{
+	struct bundle_job *job = arg;
+	struct bundle_entry *entry = &job->entries[index];
+	char name[FILENAME_MAX];
+
+	snprintf(name, sizeof(name), "%s#%u", job->filename, entry->shadow_index);
+
+	struct bmp_handle *image = bmp_open_member(job->filename, name, entry->offset, entry->size);
+	if (image == NULL || (job->load_pixels && bmp_load_pixels(image) != 0))
+	{
+		bmp_free(image);
+		return -1;
+	}
+
+	// The index must describe the member it points to
+	struct bmp_header *header = bmp_get_header(image);
+	if (header->shadow_index != entry->shadow_index || header->seed != entry->seed)
+	{
+		bmp_free(image);
+		return -1;
+	}
+
+	job->images[index] = image;
+	return 0;
+}
+
+int bundle_read_index(int fd, struct bundle_header *header, struct bundle_entry **entries)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+		header->magic != BUNDLE_MAGIC || header->version != BUNDLE_VERSION || header->count == 0 ||
+		header->count > BUNDLE_MAX_MEMBERS)
+	{
+		return -1;
+	}
+
+	size_t len = header->count * sizeof(struct bundle_entry);
+	*entries = malloc(len);
+	if (*entries == NULL)
+	{
+		return -1;
+	}
+
+	if (pread(fd, *entries, len, sizeof(*header)) != len)
+	{
+		goto free_entries;
+	}
+
+	size_t i;
+	for (i = 0; i < header->count; i++)
+	{
+		struct bundle_entry *entry = &(*entries)[i];
+		if (entry->offset < sizeof(*header) + len || entry->offset > (uint64_t)st.st_size ||
+			entry->size > (uint64_t)st.st_size - entry->offset)
+		{
+			goto free_entries;
+		}
+	}
+
+	return 0;
+
+	// Error handling
+free_entries:
+	free(*entries);
+	*entries = NULL;
+	return -1;
+}
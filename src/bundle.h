@@ -0,0 +1,25 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "bmp.h"
+
+#define BUNDLE_ALIGN 4096 // members start on page boundaries
+#define BUNDLE_MAX_MEMBERS 255
+
+/*
+ * A bundle keeps a whole set of shadows in one file: a header, an index with the offset, size,
+ * shadow index and seed of every member, and then each shadow exactly as its own BMP file would
+ * be. Members can be read in place, without unpacking the bundle.
+ */
+
+// Writes the images as a new bundle, in parallel, replacing filename only once it is complete
+int bundle_write(const char *filename, struct bmp_handle **images, size_t count);
+
+/*
+ * Opens the first max members listed in the index of the bundle (all of them if there are
+ * fewer), loading their pixels if load_pixels is set.
+ */
+struct bmp_handle **bundle_open(const char *filename, size_t max, size_t *count, int load_pixels);
+
+#endif
+/* BUNDLE_H */
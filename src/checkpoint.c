@@ -0,0 +1,383 @@
+#include "checkpoint.h"
+#include "writer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC 0x4b435243 // "CRCK"
+#define CHECKPOINT_VERSION 1
+
+#pragma pack(push, 1)
+
+// Followed by the first length bytes of the buffer
+struct checkpoint_header {
+	bmp_dword_t magic; // CHECKPOINT_MAGIC
+	bmp_word_t version;
+	bmp_word_t mode;
+	bmp_word_t seed;
+	bmp_word_t k;
+	bmp_word_t depth;
+	bmp_word_t permute;
+	bmp_dword_t job;
+	bmp_dword_t checksum;
+	bmp_dword_t index; // of the buffer in the job
+	bmp_dword_t count;
+	uint64_t size;
+	uint64_t next_block;
+	uint64_t length;
+};
+
+#pragma pack(pop)
+
+struct checkpoint {
+	struct checkpoint_state state;
+	size_t count;
+	char **names;
+	int *fds;
+	bmp_byte_t **buffers;
+	size_t saved; // bytes of every buffer already in its file
+	time_t last;
+};
+
+int checkpoint_load(struct checkpoint *ckpt, int *found);
+int checkpoint_read_header(struct checkpoint *ckpt, size_t index, int fd, struct checkpoint_header *header);
+int checkpoint_write_headers(struct checkpoint *ckpt, size_t next_block, size_t len, bmp_dword_t checksum);
+
+int checkpoint_begin(struct checkpoint_state *state, const char **names, bmp_byte_t **buffers, size_t count,
+	struct checkpoint **ckpt)
+{
+	*ckpt = NULL;
+	if (checkpoint_interval == 0)
+	{
+		return 0;
+	}
+
+	struct checkpoint *new = calloc(1, sizeof(struct checkpoint));
+	if (new == NULL)
+	{
+		return -1;
+	}
+
+	new->state = *state;
+	new->state.next_block = 0;
+	new->count = count;
+	new->names = calloc(count, sizeof(char*));
+	new->fds = malloc(count * sizeof(int));
+	new->buffers = malloc(count * sizeof(bmp_byte_t*));
+	int found = 0, created = 0;
+	if (new->names == NULL || new->fds == NULL || new->buffers == NULL)
+	{
+		goto free_ckpt;
+	}
+
+	memcpy(new->buffers, buffers, count * sizeof(bmp_byte_t*));
+
+	size_t i;
+	for (i = 0; i < count; i++)
+	{
+		new->fds[i] = -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		new->names[i] = malloc(strlen(names[i]) + sizeof(CHECKPOINT_SUFFIX));
+		if (new->names[i] == NULL)
+		{
+			goto free_ckpt;
+		}
+
+		sprintf(new->names[i], "%s%s", names[i], CHECKPOINT_SUFFIX);
+	}
+
+	if (resume_mode && checkpoint_load(new, &found) != 0)
+	{
+		goto free_ckpt;
+	}
+
+	if (found)
+	{
+		printv("Resuming from block %lu (checkpoint in %s).\n", (unsigned long)new->state.next_block,
+			new->names[0]);
+	}
+	else
+	{
+		if (resume_mode)
+		{
+			printv("Info: there are no checkpoints to resume from, starting from the beginning.\n");
+		}
+		else
+		{
+			// Starting over would throw away the progress of an interrupted job
+			for (i = 0; i < count; i++)
+			{
+				if (access(new->names[i], F_OK) == 0)
+				{
+					printe("Error: %s holds the progress of an interrupted job, use --resume to continue it "
+						"or remove it to start over.\n", new->names[i]);
+					goto free_ckpt;
+				}
+			}
+		}
+
+		created = 1;
+		for (i = 0; i < count; i++)
+		{
+			new->fds[i] = open(new->names[i], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+			if (new->fds[i] < 0)
+			{
+				printe("Error: unable to create checkpoint %s.\n", new->names[i]);
+				goto free_ckpt;
+			}
+		}
+
+		// An empty checkpoint already fixes the seed of the job
+		if (checkpoint_write_headers(new, 0, 0, state->checksum) != 0)
+		{
+			goto free_ckpt;
+		}
+	}
+
+	state->seed = new->state.seed;
+	state->next_block = new->state.next_block;
+	state->checksum = new->state.checksum;
+	new->last = time(NULL);
+
+	*ckpt = new;
+	return 0;
+
+	// Error handling
+free_ckpt:
+	if (new->names != NULL && new->fds != NULL && new->buffers != NULL)
+	{
+		// Checkpoints that were there already are kept
+		checkpoint_end(new, !created);
+	}
+	else
+	{
+		free(new->names);
+		free(new->fds);
+		free(new->buffers);
+		free(new);
+	}
+
+	return -1;
+}
+
+/*
+ * Opens the checkpoints of a job, if there are any, and loads the bytes of the buffers up to the
+ * earliest block saved in all of them (a checkpoint may have been interrupted half way).
+ */
+int checkpoint_load(struct checkpoint *ckpt, int *found)
+{
+	struct checkpoint_header header, first;
+	size_t i, missing = 0;
+
+	for (i = 0; i < ckpt->count; i++)
+	{
+		ckpt->fds[i] = open(ckpt->names[i], O_RDWR);
+		if (ckpt->fds[i] < 0 && errno == ENOENT)
+		{
+			missing++;
+		}
+		else if (ckpt->fds[i] < 0)
+		{
+			printe("Error: unable to open checkpoint %s.\n", ckpt->names[i]);
+			return -1;
+		}
+	}
+
+	if (missing == ckpt->count)
+	{
+		*found = 0;
+		return 0;
+	}
+
+	if (missing != 0)
+	{
+		printe("Error: some of the checkpoints of this job are missing, it can not be resumed.\n");
+		return -1;
+	}
+
+	for (i = 0; i < ckpt->count; i++)
+	{
+		if (checkpoint_read_header(ckpt, i, ckpt->fds[i], &header) != 0)
+		{
+			return -1;
+		}
+
+		if (i == 0)
+		{
+			first = header;
+		}
+		else if (header.seed != first.seed)
+		{
+			printe("Error: checkpoint %s belongs to another job.\n", ckpt->names[i]);
+			return -1;
+		}
+
+		if (i == 0 || header.next_block < first.next_block)
+		{
+			first.next_block = header.next_block;
+			first.length = header.length;
+			first.checksum = header.checksum;
+		}
+	}
+
+	for (i = 0; i < ckpt->count; i++)
+	{
+		if (first.length != 0 && pread(ckpt->fds[i], ckpt->buffers[i], first.length,
+			sizeof(struct checkpoint_header)) != first.length)
+		{
+			printe("Error: checkpoint %s is truncated.\n", ckpt->names[i]);
+			return -1;
+		}
+	}
+
+	ckpt->state.seed = first.seed;
+	ckpt->state.next_block = first.next_block;
+	ckpt->state.checksum = first.checksum;
+	ckpt->saved = first.length;
+	*found = 1;
+	return 0;
+}
+
+int checkpoint_read_header(struct checkpoint *ckpt, size_t index, int fd, struct checkpoint_header *header)
+{
+	struct checkpoint_state *state = &ckpt->state;
+
+	if (pread(fd, header, sizeof(struct checkpoint_header), 0) != sizeof(struct checkpoint_header) ||
+		header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION)
+	{
+		printe("Error: %s is not a valid checkpoint.\n", ckpt->names[index]);
+		return -1;
+	}
+
+	if (header->mode != state->mode || header->k != state->k || header->depth != state->depth ||
+		header->permute != state->permute || header->job != state->job || header->size != state->size ||
+		header->index != index || header->count != ckpt->count)
+	{
+		printe("Error: checkpoint %s belongs to another job.\n", ckpt->names[index]);
+		return -1;
+	}
+
+	return 0;
+}
+
+int checkpoint_due(struct checkpoint *ckpt)
+{
+	return ckpt != NULL && time(NULL) - ckpt->last >= checkpoint_interval;
+}
+
+int checkpoint_save(struct checkpoint *ckpt, size_t next_block, size_t len, bmp_dword_t checksum)
+{
+	size_t i;
+	for (i = 0; i < ckpt->count && len > ckpt->saved; i++)
+	{
+		size_t size = len - ckpt->saved;
+		if (pwrite(ckpt->fds[i], &ckpt->buffers[i][ckpt->saved], size,
+			sizeof(struct checkpoint_header) + ckpt->saved) != size)
+		{
+			printe("Error: unable to write checkpoint %s.\n", ckpt->names[i]);
+			return -1;
+		}
+	}
+
+	// The data must be on disk before any header points past it
+	for (i = 0; i < ckpt->count && fsync_mode != WRITER_SYNC_NONE; i++)
+	{
+		if (fsync(ckpt->fds[i]) != 0)
+		{
+			return -1;
+		}
+	}
+
+	if (checkpoint_write_headers(ckpt, next_block, len, checksum) != 0)
+	{
+		return -1;
+	}
+
+	printv("Checkpoint saved at block %lu.\n", (unsigned long)next_block);
+
+	ckpt->saved = len;
+	ckpt->last = time(NULL);
+	return 0;
+}
+
+int checkpoint_write_headers(struct checkpoint *ckpt, size_t next_block, size_t len, bmp_dword_t checksum)
+{
+	struct checkpoint_state *state = &ckpt->state;
+	struct checkpoint_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CHECKPOINT_MAGIC;
+	header.version = CHECKPOINT_VERSION;
+	header.mode = state->mode;
+	header.seed = state->seed;
+	header.k = state->k;
+	header.depth = state->depth;
+	header.permute = state->permute;
+	header.job = state->job;
+	header.checksum = checksum;
+	header.count = ckpt->count;
+	header.size = state->size;
+	header.next_block = next_block;
+	header.length = len;
+
+	size_t i;
+	for (i = 0; i < ckpt->count; i++)
+	{
+		header.index = i;
+		if (pwrite(ckpt->fds[i], &header, sizeof(header), 0) != sizeof(header) ||
+			(fsync_mode != WRITER_SYNC_NONE && fsync(ckpt->fds[i]) != 0))
+		{
+			printe("Error: unable to write checkpoint %s.\n", ckpt->names[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void checkpoint_end(struct checkpoint *ckpt, int failed)
+{
+	if (ckpt == NULL)
+	{
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < ckpt->count; i++)
+	{
+		if (ckpt->fds[i] >= 0)
+		{
+			close(ckpt->fds[i]);
+		}
+
+		if (!failed && ckpt->names[i] != NULL)
+		{
+			unlink(ckpt->names[i]);
+		}
+
+		free(ckpt->names[i]);
+	}
+
+	free(ckpt->names);
+	free(ckpt->fds);
+	free(ckpt->buffers);
+	free(ckpt);
+}
+
+size_t checkpoint_chunk_blocks(size_t chunk_blocks)
+{
+	if (checkpoint_interval == 0)
+	{
+		return chunk_blocks;
+	}
+
+	size_t blocks = chunk_blocks / CHECKPOINT_ALIGN_BLOCKS * CHECKPOINT_ALIGN_BLOCKS;
+	return blocks != 0 ? blocks : CHECKPOINT_ALIGN_BLOCKS;
+}
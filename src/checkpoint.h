@@ -0,0 +1,55 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "bmp.h"
+
+#define CHECKPOINT_SUFFIX ".ckpt" // the progress of "<file>" is kept in "<file>.ckpt"
+#define CHECKPOINT_DEFAULT_INTERVAL 60 // seconds, when only --resume is given
+#define CHECKPOINT_ALIGN_BLOCKS 24 // checkpoints fall on whole cover bytes for every LSB depth
+
+#define CHECKPOINT_DISTRIBUTE 1
+#define CHECKPOINT_RECOVER 2
+
+/*
+ * Description of a job. The first fields are given by the caller and must match when resuming,
+ * the rest is loaded from the checkpoint. job identifies the input (such as its checksum).
+ */
+struct checkpoint_state {
+	int mode; // CHECKPOINT_*
+	size_t k;
+	size_t size; // of the payload
+	int depth;
+	int permute;
+	bmp_dword_t job;
+	bmp_word_t seed; // set by the caller when starting
+	size_t next_block; // blocks [0, next_block) are done
+	bmp_dword_t checksum; // of the input before next_block, if the caller keeps one
+};
+
+struct checkpoint;
+
+/*
+ * Starts the checkpoints of a job that fills count buffers, each one saved to
+ * "<names[i]>.ckpt". With resume_mode, the state and the completed bytes of every buffer are
+ * loaded back from those files, if they exist. *ckpt is NULL if checkpoints are disabled.
+ */
+int checkpoint_begin(struct checkpoint_state *state, const char **names, bmp_byte_t **buffers, size_t count,
+	struct checkpoint **ckpt);
+
+// Whether checkpoint_interval seconds went by since the last checkpoint
+int checkpoint_due(struct checkpoint *ckpt);
+
+/*
+ * Saves the first len bytes of every buffer, which must hold blocks [0, next_block). Only the
+ * bytes added since the previous checkpoint are written.
+ */
+int checkpoint_save(struct checkpoint *ckpt, size_t next_block, size_t len, bmp_dword_t checksum);
+
+// Removes the files once the job is done, or keeps them (to resume it) if it failed
+void checkpoint_end(struct checkpoint *ckpt, int failed);
+
+// Chunk size that keeps every chunk boundary on a checkpoint boundary
+size_t checkpoint_chunk_blocks(size_t chunk_blocks);
+
+#endif
+/* CHECKPOINT_H */
@@ -0,0 +1,104 @@
+#include "checksum.h"
+#include <string.h>
+
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc_table[8][256];
+static int crc_table_ready = 0;
+
+void checksum_init_table()
+{
+	int i, j;
+	for (i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (j = 0; j < 8; j++)
+		{
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		}
+		crc_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		for (j = 1; j < 8; j++)
+		{
+			crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^ crc_table[0][crc_table[j - 1][i] & 0xFF];
+		}
+	}
+
+	crc_table_ready = 1;
+}
+
+// Slicing by 8: processes 8 bytes per step with 8 lookup tables
+uint32_t checksum_crc32c_sw(uint32_t crc, const unsigned char *data, size_t len)
+{
+	if (!crc_table_ready)
+	{
+		checksum_init_table();
+	}
+
+	while (len >= 8)
+	{
+		uint32_t low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+
+		crc = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF] ^
+			crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24] ^
+			crc_table[3][high & 0xFF] ^ crc_table[2][(high >> 8) & 0xFF] ^
+			crc_table[1][(high >> 16) & 0xFF] ^ crc_table[0][high >> 24];
+
+		data += 8;
+		len -= 8;
+	}
+
+	while (len--)
+	{
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+uint32_t checksum_crc32c_hw(uint32_t crc, const unsigned char *data, size_t len)
+{
+	uint64_t crc64 = crc;
+
+	while (len >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+		data += 8;
+		len -= 8;
+	}
+
+	uint32_t crc32 = (uint32_t)crc64;
+	while (len--)
+	{
+		crc32 = __builtin_ia32_crc32qi(crc32, *data++);
+	}
+
+	return crc32;
+}
+
+#endif
+
+uint32_t checksum_crc32c(uint32_t crc, const unsigned char *data, size_t len)
+{
+	crc = ~crc;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		return ~checksum_crc32c_hw(crc, data, len);
+	}
+#endif
+
+	return ~checksum_crc32c_sw(crc, data, len);
+}
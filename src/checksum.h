@@ -0,0 +1,16 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CHECKSUM_INIT 0
+
+/*
+ * CRC32C (Castagnoli). Can be computed incrementally: pass CHECKSUM_INIT the first time
+ * and the previous result afterwards. Uses the SSE 4.2 crc32 instruction when available.
+ */
+uint32_t checksum_crc32c(uint32_t crc, const unsigned char *data, size_t len);
+
+#endif
+/* CHECKSUM_H */
@@ -0,0 +1,110 @@
+#include "compress.h"
+#include <string.h>
+
+/*
+ * Format:
+ * v (v < 250) -> the literal v
+ * 250 0 -> the literal 250
+ * 250 c v (0 < c <= 250) -> c + RLE_MIN_RUN - 1 copies of v
+ */
+#define RLE_ESCAPE 250
+#define RLE_MIN_RUN 4
+#define RLE_MAX_RUN (250 + RLE_MIN_RUN - 1)
+
+size_t compress_rle(const bmp_byte_t *in, size_t len, bmp_byte_t *out, size_t out_size)
+{
+	size_t i = 0, written = 0;
+
+	while (i < len)
+	{
+		bmp_byte_t value = in[i];
+		size_t run = 1;
+		while (i + run < len && in[i + run] == value && run < RLE_MAX_RUN)
+		{
+			run++;
+		}
+
+		if (run >= RLE_MIN_RUN)
+		{
+			if (written + 3 > out_size)
+			{
+				return 0;
+			}
+
+			out[written++] = RLE_ESCAPE;
+			out[written++] = run - RLE_MIN_RUN + 1;
+			out[written++] = value;
+			i += run;
+		}
+		else if (value >= RLE_ESCAPE)
+		{
+			if (written + 2 > out_size)
+			{
+				return 0;
+			}
+
+			out[written++] = RLE_ESCAPE;
+			out[written++] = 0;
+			i++;
+		}
+		else
+		{
+			if (written + 1 > out_size)
+			{
+				return 0;
+			}
+
+			out[written++] = value;
+			i++;
+		}
+	}
+
+	return written;
+}
+
+int decompress_rle(const bmp_byte_t *in, size_t len, bmp_byte_t *out, size_t out_len)
+{
+	size_t i = 0, written = 0;
+
+	while (i < len)
+	{
+		if (in[i] != RLE_ESCAPE)
+		{
+			if (written + 1 > out_len)
+			{
+				return -1;
+			}
+
+			out[written++] = in[i++];
+		}
+		else if (i + 1 < len && in[i + 1] == 0)
+		{
+			if (written + 1 > out_len)
+			{
+				return -1;
+			}
+
+			out[written++] = RLE_ESCAPE;
+			i += 2;
+		}
+		else
+		{
+			if (i + 2 >= len)
+			{
+				return -1;
+			}
+
+			size_t run = in[i + 1] + RLE_MIN_RUN - 1;
+			if (written + run > out_len)
+			{
+				return -1;
+			}
+
+			memset(&out[written], in[i + 2], run);
+			written += run;
+			i += 3;
+		}
+	}
+
+	return written == out_len ? 0 : -1;
+}
@@ -0,0 +1,20 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "bmp.h"
+
+#define CODEC_NONE 0
+#define CODEC_RLE 1
+#define CODEC_MULTI 2 // several secrets with a table of contents (see multi.h)
+
+/*
+ * Run length coder whose output only uses values 0 to 250, so it can be shared over GF(251)
+ * like the truncated pixels. Returns the compressed length, or 0 if it would not fit in out_size.
+ */
+size_t compress_rle(const bmp_byte_t *in, size_t len, bmp_byte_t *out, size_t out_size);
+
+// Returns -1 if the input is malformed or does not decompress to exactly out_len bytes
+int decompress_rle(const bmp_byte_t *in, size_t len, bmp_byte_t *out, size_t out_len);
+
+#endif
+/* COMPRESS_H */
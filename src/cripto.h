@@ -3,6 +3,10 @@
 
 #define MIN_K 2
 #define MIN_N 2
+#define MAX_SHADOW_INDEX 250
+#define MAX_SEED 65535 // seeds are stored in 16 bits
+
+#define PAYLOAD_CHUNK_BLOCKS 4096 // default blocks processed together by the share and recover loops
 
 #endif
 /* CRIPTO_H */
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "delta.h"
+#include "distribute.h"
+#include "recover.h"
+#include "utils.h"
+#include "lsb.h"
+#include "compress.h"
+#include "image.h"
+#include "arena.h"
+#include "cripto_rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DELTA_MAX_RUN 4096 // max amount of blocks patched with a single read/write
+
+int delta_patch_blocks(struct bmp_handle *shadow, bmp_byte_t *payload, size_t start, size_t end, size_t k,
+	int depth, bmp_byte_t *scratch);
+int delta_patch_extra(struct bmp_handle *shadow, bmp_byte_t *extra_coefs, size_t k, int depth);
+
+int delta_reshare(struct bmp_handle *secret_bmp, struct bmp_handle *old_secret_bmp, struct bmp_handle **shadows,
+	size_t n, size_t k, int permute)
+{
+	bmp_byte_t *payload = bmp_get_pixels(secret_bmp);
+	size_t real_byte_count = bmp_data_size(secret_bmp);
+
+	bmp_word_t seed = bmp_get_header(shadows[0])->seed;
+	int i;
+
+	for (i = 1; i < n; i++)
+	{
+		if (bmp_get_header(shadows[i])->seed != seed)
+		{
+			printe("Error: the shadows do not belong to the same distribution (different seeds).\n");
+			return -1;
+		}
+	}
+
+	// A compressed payload changes as a whole when a single pixel does
+	struct bmp_shadow_info *old_info = bmp_get_shadow_info(shadows[0]);
+	if (old_info != NULL && old_info->codec != CODEC_NONE)
+	{
+		printe("Error: compressed shadows can not be patched, the secret must be distributed again.\n");
+		return -1;
+	}
+
+	if (old_info != NULL && old_info->secret_format != bmp_get_format(secret_bmp))
+	{
+		printe("Error: the shadows hold a %s image, the new secret must use the same format.\n",
+			image_format_name(old_info->secret_format));
+		return -1;
+	}
+
+	struct bmp_shadow_info info;
+	distribute_init_info(&info, secret_bmp, distribute_truncate_image(payload, real_byte_count), k,
+		lsb_depth_of(shadows[0], k));
+
+	if (utils_shuffle(payload, real_byte_count, seed, permute) != 0)
+	{
+		return -1;
+	}
+
+	int status = -1;
+	bmp_byte_t *old_payload = arena_alloc_buffer(real_byte_count * sizeof(bmp_byte_t));
+	bmp_byte_t *extra_coefs = arena_alloc_buffer(k * sizeof(bmp_byte_t));
+	bmp_byte_t *scratch = NULL;
+
+	if (old_payload == NULL || extra_coefs == NULL)
+	{
+		goto free_buffers;
+	}
+
+	if (old_secret_bmp != NULL)
+	{
+		memcpy(old_payload, bmp_get_pixels(old_secret_bmp), real_byte_count);
+		distribute_truncate_image(old_payload, real_byte_count);
+		if (utils_shuffle(old_payload, real_byte_count, seed, permute) != 0)
+		{
+			goto free_buffers;
+		}
+	}
+	else
+	{
+		for (i = 0; i < k; i++)
+		{
+			if (bmp_load_pixels(shadows[i]) != 0)
+			{
+				goto free_buffers;
+			}
+		}
+
+		if (recover_payload(old_payload, real_byte_count, shadows, k, NULL) != 0)
+		{
+			goto free_buffers;
+		}
+	}
+
+	int depth = lsb_depth_of(shadows[0], k);
+
+	// Room for the shadow bytes of a run followed by their cover bytes
+	scratch = arena_alloc_buffer((DELTA_MAX_RUN + lsb_cover_bytes(DELTA_MAX_RUN, depth) + 1) * sizeof(bmp_byte_t));
+	if (scratch == NULL)
+	{
+		goto free_buffers;
+	}
+
+	size_t remainder = real_byte_count % k;
+	size_t blocks = real_byte_count / k;
+	size_t block = 0, changed = 0;
+
+	while (block < blocks)
+	{
+		if (memcmp(&payload[block * k], &old_payload[block * k], k) == 0)
+		{
+			block++;
+			continue;
+		}
+
+		// Patch a whole run of changed blocks at once
+		size_t start = block;
+		while (block < blocks && block - start < DELTA_MAX_RUN &&
+			memcmp(&payload[block * k], &old_payload[block * k], k) != 0)
+		{
+			block++;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (delta_patch_blocks(shadows[i], payload, start, block, k, depth, scratch) != 0)
+			{
+				goto free_buffers;
+			}
+		}
+
+		changed += block - start;
+	}
+
+	printv("Changed blocks: %lu of %lu\n", (unsigned long)changed, (unsigned long)blocks);
+
+	if (remainder && memcmp(&payload[blocks * k], &old_payload[blocks * k], remainder) != 0)
+	{
+		// Any padding is valid, so the last block gets a fresh one
+		memcpy(extra_coefs, &payload[blocks * k], remainder);
+		randomize(time(NULL));
+		for (i = remainder; i < k; i++)
+		{
+			extra_coefs[i] = (bmp_byte_t)randint(250);
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (delta_patch_extra(shadows[i], extra_coefs, k, depth) != 0)
+			{
+				goto free_buffers;
+			}
+		}
+
+		printv("Last (padded) block changed.\n");
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		bmp_set_shadow_info(shadows[i], &info);
+		if (bmp_write_shadow_info(shadows[i]) != 0)
+		{
+			goto free_buffers;
+		}
+	}
+
+	status = 0;
+
+	// Error handling
+free_buffers:
+	arena_free_buffer(scratch);
+	arena_free_buffer(extra_coefs);
+	arena_free_buffer(old_payload);
+
+	return status;
+}
+
+int delta_patch_blocks(struct bmp_handle *shadow, bmp_byte_t *payload, size_t start, size_t end, size_t k,
+	int depth, bmp_byte_t *scratch)
+{
+	bmp_byte_t x = bmp_get_header(shadow)->shadow_index;
+	bmp_byte_t *cover = scratch + DELTA_MAX_RUN;
+	size_t offset = lsb_cover_offset(start, depth);
+	size_t len = lsb_cover_bytes(end, depth) - offset;
+	size_t i;
+
+	if (bmp_read_range(shadow, offset, cover, len) != 0)
+	{
+		return -1;
+	}
+
+	for (i = start; i < end; i++)
+	{
+		scratch[i - start] = distribute_evaluate_pol(payload + (i * k), k, x);
+	}
+
+	lsb_embed(scratch, end - start, cover, start, depth);
+
+	return bmp_write_range(shadow, offset, cover, len);
+}
+
+int delta_patch_extra(struct bmp_handle *shadow, bmp_byte_t *extra_coefs, size_t k, int depth)
+{
+	bmp_byte_t bytes[8];
+
+	if (bmp_read_range(shadow, 0, bytes, sizeof(bytes)) != 0)
+	{
+		return -1;
+	}
+
+	bmp_byte_t byte = distribute_evaluate_pol(extra_coefs, k, bmp_get_header(shadow)->shadow_index);
+	distribute_lsb_width1(byte, bytes, depth);
+
+	return bmp_write_range(shadow, 0, bytes, sizeof(bytes));
+}
@@ -0,0 +1,16 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "bmp.h"
+
+/*
+ * Updates n existing shadows so that they share secret_bmp instead of the previous secret,
+ * rewriting only the cover bytes of the blocks that changed. The previous secret is taken
+ * from old_secret_bmp, or recovered from the first k shadows if it is NULL. The shadows
+ * only need their headers loaded.
+ */
+int delta_reshare(struct bmp_handle *secret_bmp, struct bmp_handle *old_secret_bmp, struct bmp_handle **shadows,
+	size_t n, size_t k, int permute);
+
+#endif
+/* DELTA_H */
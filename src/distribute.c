@@ -1,6 +1,16 @@
 #include "distribute.h"
+#include "cripto.h"
 #include "utils.h"
 #include "cripto_rand.h"
+#include "checksum.h"
+#include "lsb.h"
+#include "compress.h"
+#include "arena.h"
+#include "kernels.h"
+#include "memo.h"
+#include "writer.h"
+#include "checkpoint.h"
+#include "ntt.h"
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
@@ -8,145 +18,590 @@
 #include <string.h>
 #include <stdio.h>
 
-void distribute_truncate_image(bmp_byte_t *pixels, size_t size);
-bmp_word_t distribute_gen_seed();
-bmp_byte_t distribute_evaluate_pol(bmp_byte_t *pol, size_t size, bmp_byte_t x);
-void distribute_lsb_width1(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos);
-void distribute_lsb_width2(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos);
+#define TRUNCATE_CHUNK_SIZE 16384
 
-int distribute(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute)
+int distribute_fused(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute,
+	int depth);
+bmp_dword_t distribute_gather(const bmp_byte_t *pixels, size_t size, size_t first, size_t len, bmp_word_t seed,
+	bmp_byte_t *ordered, bmp_byte_t *payload, bmp_dword_t crc);
+int distribute_chunk(const bmp_byte_t *payload, size_t chunk, size_t end, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth, const bmp_byte_t *powers, kernel_evaluate_t evaluate,
+	struct memo *memo, bmp_byte_t *shadow_bytes);
+void distribute_evaluate_memo(struct memo *memo, const bmp_byte_t *payload, size_t blocks, size_t k, size_t count,
+	const bmp_byte_t *powers, kernel_evaluate_t evaluate, bmp_byte_t *shadow_bytes);
+int distribute_payload_from(bmp_byte_t *payload, size_t size, bmp_byte_t *extra_coefs, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth, size_t start, struct checkpoint *ckpt);
+int distribute_blocks(const bmp_byte_t *payload, size_t first, size_t last, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth, struct checkpoint *ckpt);
+int distribute_begin_checkpoint(struct checkpoint_state *state, struct bmp_handle **shadows, size_t count,
+	struct checkpoint **ckpt);
+
+int distribute(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute, int depth,
+	int codec)
 {
+	// A compressed secret can only be permuted once it has been compressed as a whole
+	if (codec == CODEC_NONE && permute != PERMUTE_SWAP)
+	{
+		return distribute_fused(secret_bmp, shadows, n, k, permute, depth);
+	}
+
 	bmp_byte_t *pixels = bmp_get_pixels(secret_bmp);
-	struct bmp_header *header = bmp_get_header(secret_bmp);
+	size_t real_byte_count = bmp_data_size(secret_bmp);
 
-	int padding = padding_for_width(header->width);
-	size_t real_byte_count = (header->width + padding) * header->height;
+	struct bmp_shadow_info info;
+	distribute_init_info(&info, secret_bmp, distribute_truncate_image(pixels, real_byte_count), k, depth);
 
-	distribute_truncate_image(pixels, real_byte_count);
+	bmp_byte_t *payload = pixels;
+	size_t size = real_byte_count;
+
+	if (codec != CODEC_NONE)
+	{
+		payload = distribute_compress(pixels, real_byte_count, codec, &size, &info);
+		if (payload == NULL)
+		{
+			return -1;
+		}
+	}
 
-	bmp_byte_t seed = distribute_gen_seed();
+	int status = distribute_packed(payload, size, shadows, n, k, permute, depth, &info);
 
-	if (permute)
+	if (payload != pixels)
 	{
-		utils_permute(pixels, real_byte_count, seed);
+		arena_free_buffer(payload);
 	}
 
-	int i, j, remainder;
-	bmp_byte_t byte;
-	bmp_byte_t *shadow_pixels;
+	return status;
+}
 
-	remainder = real_byte_count % k;
+int distribute_packed(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t n, size_t k, int permute,
+	int depth, struct bmp_shadow_info *info)
+{
+	int i, remainder, status;
+	bmp_byte_t *extra_pixels = NULL;
+
+	if (distribute_check_capacity(shadows, n, size, k, depth) != 0)
+	{
+		return -1;
+	}
 
-	void (*lsb_fn_ptr)(bmp_byte_t, bmp_byte_t*, size_t);
-	int jump;
+	bmp_word_t seed = distribute_gen_seed();
 
-	if (k >= 8)
+	// An interrupted job is resumed with its seed, so the payload is permuted the same way
+	struct checkpoint *ckpt;
+	struct checkpoint_state state = { CHECKPOINT_DISTRIBUTE, k, size, depth, permute, info->checksum, seed, 0, 0 };
+	if (distribute_begin_checkpoint(&state, shadows, n, &ckpt) != 0)
 	{
-		jump = 8;
-		lsb_fn_ptr = distribute_lsb_width1;
+		return -1;
 	}
-	else
+
+	seed = state.seed;
+
+	if (utils_shuffle(payload, size, seed, permute) != 0)
 	{
-		jump = 4;
-		lsb_fn_ptr = distribute_lsb_width2;
+		goto end_ckpt;
 	}
 
-	size_t bytes_written = 0;
+	remainder = size % k;
 
-	for (i = 0; i < (real_byte_count - remainder) / k; i++)
+	if (remainder) // some pixels were left over
 	{
-		for (j = 0; j < n; j++)
+		printv("Info: real_byte_count (mod K) = %d\n", remainder);
+
+		extra_pixels = arena_alloc_buffer(k * sizeof(bmp_byte_t));
+		if (extra_pixels == NULL)
 		{
-			byte = distribute_evaluate_pol(pixels + (i * k), k, j + 1);
-			shadow_pixels = bmp_get_pixels(shadows[j]);
-			(*lsb_fn_ptr)(byte, shadow_pixels + (i * jump), LSB_POS_1);
+			goto end_ckpt;
 		}
 
-		bytes_written += jump;
+		memcpy(extra_pixels, &payload[size - remainder], remainder * sizeof(bmp_byte_t));
+		randomize(time(NULL));
+		for (i = remainder; i < k; i++)
+		{
+			extra_pixels[i] = (bmp_byte_t)randint(250);
+		}
 	}
 
-	printv("Bytes written to each shadow (first layer): %u\n", bytes_written);
+	status = distribute_payload_from(payload, size, extra_pixels, shadows, n, 1, k, depth, state.next_block, ckpt);
+	arena_free_buffer(extra_pixels);
 
-	if (remainder) // some pixels were left over
+	if (status == 0)
 	{
-		size_t lsb_pos;
-		if (k >= 8)
+		status = distribute_write_shadows(shadows, n, 1, seed, info);
+	}
+
+	checkpoint_end(ckpt, status != 0);
+	return status;
+
+	// Error handling
+end_ckpt:
+	checkpoint_end(ckpt, 1);
+	return -1;
+}
+
+// Checkpoints keep the pixels of every shadow, next to its cover
+int distribute_begin_checkpoint(struct checkpoint_state *state, struct bmp_handle **shadows, size_t count,
+	struct checkpoint **ckpt)
+{
+	const char **names = malloc(count * sizeof(char*));
+	bmp_byte_t **buffers = malloc(count * sizeof(bmp_byte_t*));
+	int status = -1;
+
+	if (names != NULL && buffers != NULL)
+	{
+		size_t i;
+		for (i = 0; i < count; i++)
 		{
-			lsb_pos = LSB_POS_2;
+			names[i] = bmp_get_filename(shadows[i]);
+			buffers[i] = bmp_get_pixels(shadows[i]);
 		}
-		else
+
+		status = checkpoint_begin(state, names, buffers, count, ckpt);
+	}
+
+	free(names);
+	free(buffers);
+	return status;
+}
+
+/*
+ * Single sweep over the secret, for permutations that can be evaluated per index: each chunk of
+ * blocks is truncated and checksummed in order, gathered through the permutation and shared
+ * while it is still in cache. The pixels of the secret are not modified.
+ */
+int distribute_fused(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute,
+	int depth)
+{
+	bmp_byte_t *pixels = bmp_get_pixels(secret_bmp);
+	size_t size = bmp_data_size(secret_bmp);
+
+	if (distribute_check_capacity(shadows, n, size, k, depth) != 0)
+	{
+		return -1;
+	}
+
+	struct bmp_shadow_info info;
+	distribute_init_info(&info, secret_bmp, CHECKSUM_INIT, k, depth);
+
+	bmp_word_t seed = distribute_gen_seed();
+
+	// The checksum of the secret is kept up to the last checkpoint, to check it did not change
+	struct checkpoint *ckpt;
+	struct checkpoint_state state = { CHECKPOINT_DISTRIBUTE, k, size, depth, permute, 0, seed, 0, CHECKSUM_INIT };
+	if (distribute_begin_checkpoint(&state, shadows, n, &ckpt) != 0)
+	{
+		return -1;
+	}
+
+	seed = state.seed;
+
+	struct memo *memo = NULL;
+	if (memo_mode && (memo = memo_create(k, n, MEMO_ENTRIES)) == NULL)
+	{
+		goto end_ckpt;
+	}
+
+	// A chunk in order, the same chunk through the permutation, its shares and the powers of every x
+	size_t tile = payload_chunk_blocks * k;
+	size_t rows = memo != NULL || ntt_preferred(k, n) ? n : 1;
+	bmp_byte_t *ordered = arena_alloc_buffer((2 * tile + rows * payload_chunk_blocks + n * k) * sizeof(bmp_byte_t));
+	if (ordered == NULL)
+	{
+		goto free_memo;
+	}
+
+	bmp_byte_t *payload = permute == PERMUTE_INDEX ? &ordered[tile] : ordered;
+	bmp_byte_t *shadow_bytes = &ordered[2 * tile];
+	bmp_byte_t *powers = &shadow_bytes[rows * payload_chunk_blocks];
+
+	size_t i, j, chunk, end;
+	for (j = 0; j < n; j++)
+	{
+		kernel_powers(1 + j, k, &powers[j * k]);
+	}
+
+	kernel_evaluate_t evaluate = kernel_evaluate_for(k);
+	size_t blocks = size / k, remainder = size % k;
+	bmp_dword_t crc = CHECKSUM_INIT;
+
+	for (chunk = 0; chunk < state.next_block; chunk = end)
+	{
+		end = chunk + payload_chunk_blocks < state.next_block ? chunk + payload_chunk_blocks : state.next_block;
+		crc = distribute_gather(pixels, size, chunk * k, (end - chunk) * k, seed, ordered, ordered, crc);
+	}
+
+	if (crc != state.checksum)
+	{
+		printe("Error: the secret changed since the checkpoint, the job can not be resumed.\n");
+		goto free_ordered;
+	}
+
+	for (chunk = state.next_block; chunk < blocks; chunk = end)
+	{
+		end = chunk + payload_chunk_blocks < blocks ? chunk + payload_chunk_blocks : blocks;
+
+		crc = distribute_gather(pixels, size, chunk * k, (end - chunk) * k, seed, ordered, payload, crc);
+		if (distribute_chunk(payload, chunk, end, shadows, n, 1, k, depth, powers, evaluate, memo, shadow_bytes) != 0)
 		{
-			lsb_pos = LSB_POS_3;
+			goto free_ordered;
 		}
 
-		printv("Info: real_byte_count (mod K) = %d\n", remainder);
-
-		bmp_byte_t *extra_pixels = malloc(k * sizeof(bmp_byte_t));
-		if (extra_pixels == NULL)
+		if (end < blocks && checkpoint_due(ckpt) &&
+			checkpoint_save(ckpt, end, lsb_cover_offset(end, depth), crc) != 0)
 		{
-			return -1;
+			goto free_ordered;
 		}
+	}
+
+	memo_report(memo, "Share");
+	memo_destroy(memo);
+	printv("Bytes written to each shadow (first layer): %lu\n", (unsigned long)lsb_cover_bytes(blocks, depth));
+
+	if (remainder)
+	{
+		printv("Info: real_byte_count (mod K) = %lu\n", (unsigned long)remainder);
+
+		crc = distribute_gather(pixels, size, blocks * k, remainder, seed, ordered, payload, crc);
 
-		memcpy(extra_pixels, &pixels[real_byte_count - remainder], remainder * sizeof(bmp_byte_t));
 		randomize(time(NULL));
 		for (i = remainder; i < k; i++)
 		{
-			extra_pixels[i] = (bmp_byte_t)randint(250);
+			payload[i] = (bmp_byte_t)randint(250);
 		}
 
 		for (j = 0; j < n; j++)
 		{
-			byte = distribute_evaluate_pol(extra_pixels, k, j + 1);
-			shadow_pixels = bmp_get_pixels(shadows[j]);
-			distribute_lsb_width1(byte, shadow_pixels, lsb_pos);
+			distribute_lsb_width1(distribute_evaluate_pol(payload, k, 1 + j), bmp_get_pixels(shadows[j]), depth);
 		}
 
 		printv("Bytes written to each shadow (second layer): 8\n");
 	}
 
-	// write header and pixels
-	for (i = 0; i < n; i++)
+	arena_free_buffer(ordered);
+
+	info.checksum = crc;
+	int status = distribute_write_shadows(shadows, n, 1, seed, &info);
+
+	checkpoint_end(ckpt, status != 0);
+	return status;
+
+	// Error handling
+free_ordered:
+	arena_free_buffer(ordered);
+free_memo:
+	memo_destroy(memo);
+end_ckpt:
+	checkpoint_end(ckpt, 1);
+	return -1;
+}
+
+/*
+ * Truncates bytes [first, first + len) of the secret into ordered and adds them to the checksum.
+ * When payload is a separate buffer (PERMUTE_INDEX), it gets the (truncated) bytes the permutation
+ * moves to those positions.
+ */
+bmp_dword_t distribute_gather(const bmp_byte_t *pixels, size_t size, size_t first, size_t len, bmp_word_t seed,
+	bmp_byte_t *ordered, bmp_byte_t *payload, bmp_dword_t crc)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
 	{
-		header = bmp_get_header(shadows[i]);
-		header->seed = seed;
-		header->shadow_index = i + 1;
-		bmp_write_header(shadows[i]);
-		bmp_write_pixels(shadows[i]);
+		ordered[i] = pixels[first + i] > 250 ? 250 : pixels[first + i];
 	}
 
-	return 0;
+	if (payload != ordered)
+	{
+		for (i = 0; i < len; i++)
+		{
+			bmp_byte_t byte = pixels[utils_permute_index(first + i, size, seed)];
+			payload[i] = byte > 250 ? 250 : byte;
+		}
+	}
+
+	return checksum_crc32c(crc, ordered, len);
 }
 
-void distribute_lsb_width1(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos)
+bmp_byte_t *distribute_compress(bmp_byte_t *pixels, size_t size, int codec, size_t *payload_size,
+	struct bmp_shadow_info *info)
+{
+	if (codec != CODEC_RLE)
+	{
+		return NULL;
+	}
+
+	bmp_byte_t *payload = arena_alloc_buffer(size * sizeof(bmp_byte_t));
+	if (payload == NULL)
+	{
+		return NULL;
+	}
+
+	// Anything that does not make the payload smaller is shared as is
+	size_t compressed = compress_rle(pixels, size, payload, size - 1);
+	if (compressed == 0)
+	{
+		printv("Info: the secret does not compress, sharing it uncompressed.\n");
+		arena_free_buffer(payload);
+		*payload_size = size;
+		return pixels;
+	}
+
+	printv("Info: secret compressed from %lu to %lu bytes.\n", (unsigned long)size, (unsigned long)compressed);
+
+	info->codec = codec;
+	bmp_set_shadow_payload_size(info, compressed);
+	*payload_size = compressed;
+	return payload;
+}
+
+int distribute_check_capacity(struct bmp_handle **shadows, size_t count, size_t size, size_t k, int depth)
 {
+	size_t required = shadow_size_for(size, k, depth);
+
 	int i;
-	for (i = 0; i < 8; i++)
+	for (i = 0; i < count; i++)
 	{
-		pixels[i] = (pixels[i] & ~BIT(pos)) | (GET_BIT(byte, 8 - 1 - i) << pos);
+		if (bmp_data_size(shadows[i]) < required)
+		{
+			printe("Error: shadow images need at least %lu bytes of pixel data.\n", (unsigned long)required);
+			return -1;
+		}
 	}
+
+	return 0;
+}
+
+int distribute_payload(bmp_byte_t *payload, size_t size, bmp_byte_t *extra_coefs, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth)
+{
+	return distribute_payload_from(payload, size, extra_coefs, shadows, count, first_index, k, depth, 0, NULL);
 }
 
-void distribute_lsb_width2(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos)
+// Same as distribute_payload(), starting at block start and saving the shadows to ckpt when due
+int distribute_payload_from(bmp_byte_t *payload, size_t size, bmp_byte_t *extra_coefs, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth, size_t start, struct checkpoint *ckpt)
 {
-	int j;
-	for (j = 0; j < 8; j += 2)
+	size_t blocks = size / k;
+
+	if (distribute_blocks(&payload[start * k], start, blocks, shadows, count, first_index, k, depth, ckpt) != 0)
+	{
+		return -1;
+	}
+
+	printv("Bytes written to each shadow (first layer): %lu\n", (unsigned long)lsb_cover_bytes(blocks, depth));
+
+	if (size % k)
 	{
-		int i = j / 2;
-		bmp_byte_t to_save = (GET_BIT(byte, 8 - 1 - j) << 1) | GET_BIT(byte, 8 - 1 - (j + 1));
-		pixels[i] = (pixels[i] & ~(BIT(pos + 1) | BIT(pos))) | (to_save << pos);
+		if (extra_coefs == NULL)
+		{
+			return -1;
+		}
+
+		distribute_remainder(extra_coefs, shadows, count, first_index, k, depth);
+		printv("Bytes written to each shadow (second layer): 8\n");
 	}
+
+	return 0;
+}
+
+int distribute_payload_range(const bmp_byte_t *payload, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth)
+{
+	return distribute_blocks(payload, first, last, shadows, count, first_index, k, depth, NULL);
+}
+
+void distribute_remainder(const bmp_byte_t *extra_coefs, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth)
+{
+	size_t j;
+	for (j = 0; j < count; j++)
+	{
+		bmp_byte_t byte = distribute_evaluate_pol((bmp_byte_t*)extra_coefs, k, first_index + j);
+		distribute_lsb_width1(byte, bmp_get_pixels(shadows[j]), depth);
+	}
+}
+
+// Shares blocks [first, last), which start at payload, saving the shadows to ckpt when due
+int distribute_blocks(const bmp_byte_t *payload, size_t first, size_t last, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth, struct checkpoint *ckpt)
+{
+	size_t j, chunk, end;
+
+	// With the block cache or the large k engine, all the shares of a block are obtained at once, one row per shadow
+	struct memo *memo = NULL;
+	if (memo_mode)
+	{
+		memo = memo_create(k, count, MEMO_ENTRIES);
+		if (memo == NULL)
+		{
+			return -1;
+		}
+	}
+
+	size_t rows = memo != NULL || ntt_preferred(k, count) ? count : 1;
+	bmp_byte_t *shadow_bytes = arena_alloc_buffer((rows * payload_chunk_blocks + count * k) * sizeof(bmp_byte_t));
+	if (shadow_bytes == NULL)
+	{
+		memo_destroy(memo);
+		return -1;
+	}
+
+	// Powers of the x of every shadow, one row of k per shadow
+	bmp_byte_t *powers = &shadow_bytes[rows * payload_chunk_blocks];
+	for (j = 0; j < count; j++)
+	{
+		kernel_powers(first_index + j, k, &powers[j * k]);
+	}
+
+	kernel_evaluate_t evaluate = kernel_evaluate_for(k);
+
+	// Each shadow gets a whole run of bytes evaluated and then embedded at once
+	int status = 0;
+	for (chunk = first; chunk < last && status == 0; chunk = end)
+	{
+		end = chunk + payload_chunk_blocks < last ? chunk + payload_chunk_blocks : last;
+		status = distribute_chunk(&payload[(chunk - first) * k], chunk, end, shadows, count, first_index, k, depth,
+			powers, evaluate, memo, shadow_bytes);
+
+		if (status == 0 && end < last && checkpoint_due(ckpt))
+		{
+			status = checkpoint_save(ckpt, end, lsb_cover_offset(end, depth), 0);
+		}
+	}
+
+	memo_report(memo, "Share");
+	memo_destroy(memo);
+	arena_free_buffer(shadow_bytes);
+
+	return status;
 }
 
-void distribute_truncate_image(bmp_byte_t *pixels, size_t size)
+// Shares blocks [chunk, end), which start at payload, and embeds them in the shadows
+int distribute_chunk(const bmp_byte_t *payload, size_t chunk, size_t end, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth, const bmp_byte_t *powers, kernel_evaluate_t evaluate,
+	struct memo *memo, bmp_byte_t *shadow_bytes)
+{
+	size_t j;
+	int batch = memo == NULL && ntt_preferred(k, count);
+
+	if (memo != NULL)
+	{
+		distribute_evaluate_memo(memo, payload, end - chunk, k, count, powers, evaluate, shadow_bytes);
+	}
+	else if (batch && ntt_evaluate_blocks(payload, end - chunk, k, first_index, count, shadow_bytes,
+		payload_chunk_blocks) != 0)
+	{
+		printe("Error: shadow indexes %u to %lu can not be evaluated.\n", first_index,
+			(unsigned long)first_index + count - 1);
+		return -1;
+	}
+
+	for (j = 0; j < count; j++)
+	{
+		bmp_byte_t *row = &shadow_bytes[j * payload_chunk_blocks];
+		if (memo == NULL && !batch)
+		{
+			row = shadow_bytes;
+			evaluate(payload, end - chunk, k, &powers[j * k], row);
+		}
+
+		bmp_byte_t *shadow_pixels = bmp_get_pixels(shadows[j]);
+		lsb_embed(row, end - chunk, shadow_pixels + lsb_cover_offset(chunk, depth), chunk, depth);
+	}
+
+	return 0;
+}
+
+void distribute_evaluate_memo(struct memo *memo, const bmp_byte_t *payload, size_t blocks, size_t k, size_t count,
+	const bmp_byte_t *powers, kernel_evaluate_t evaluate, bmp_byte_t *shadow_bytes)
+{
+	size_t b, j;
+	for (b = 0; b < blocks; b++)
+	{
+		const bmp_byte_t *block = &payload[b * k];
+		const bmp_byte_t *shares = memo_lookup(memo, block);
+
+		if (shares == NULL)
+		{
+			bmp_byte_t *entry = memo_insert(memo, block);
+			for (j = 0; j < count; j++)
+			{
+				evaluate(block, 1, k, &powers[j * k], &entry[j]);
+			}
+
+			shares = entry;
+		}
+
+		for (j = 0; j < count; j++)
+		{
+			shadow_bytes[j * payload_chunk_blocks + b] = shares[j];
+		}
+	}
+}
+
+int distribute_write_shadows(struct bmp_handle **shadows, size_t count, bmp_shadow_index_t first_index, bmp_word_t seed,
+	struct bmp_shadow_info *info)
 {
 	int i;
-	for (i = 0; i < size; i++)
+	for (i = 0; i < count; i++)
 	{
-		if (pixels[i] > 250)
+		struct bmp_header *header = bmp_get_header(shadows[i]);
+		header->seed = seed;
+		header->shadow_index = first_index + i;
+
+		if (info != NULL)
 		{
-			pixels[i] = 250;
+			bmp_set_shadow_info(shadows[i], info);
 		}
 	}
+
+	return writer_write_images(shadows, count);
+}
+
+void distribute_init_info(struct bmp_shadow_info *info, struct bmp_handle *secret_bmp, bmp_dword_t checksum,
+	size_t k, int depth)
+{
+	struct bmp_header *secret_header = bmp_get_header(secret_bmp);
+
+	memset(info, 0, sizeof(struct bmp_shadow_info));
+	info->flags = BMP_SHADOW_CHECKSUM;
+	info->checksum = checksum;
+	info->secret_width = secret_header->width;
+	info->secret_height = secret_header->height;
+	info->secret_bits_per_pixel = secret_header->bits_per_pixel;
+	info->lsb_depth = depth;
+	info->k = k;
+	info->secret_format = bmp_get_format(secret_bmp);
+}
+
+void distribute_lsb_width1(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos)
+{
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		pixels[i] = (pixels[i] & ~BIT(pos)) | (GET_BIT(byte, 8 - 1 - i) << pos);
+	}
+}
+
+bmp_dword_t distribute_truncate_image(bmp_byte_t *pixels, size_t size)
+{
+	bmp_dword_t crc = CHECKSUM_INIT;
+	size_t i, chunk;
+
+	// The checksum of each chunk is computed while it is still in cache
+	for (chunk = 0; chunk < size; chunk += TRUNCATE_CHUNK_SIZE)
+	{
+		size_t end = chunk + TRUNCATE_CHUNK_SIZE < size ? chunk + TRUNCATE_CHUNK_SIZE : size;
+		for (i = chunk; i < end; i++)
+		{
+			if (pixels[i] > 250)
+			{
+				pixels[i] = 250;
+			}
+		}
+
+		crc = checksum_crc32c(crc, &pixels[chunk], end - chunk);
+	}
+
+	return crc;
 }
 
 bmp_word_t distribute_gen_seed()
@@ -157,12 +612,13 @@ bmp_word_t distribute_gen_seed()
 
 bmp_byte_t distribute_evaluate_pol(bmp_byte_t *pol, size_t size, bmp_byte_t x)
 {
-	int i, aux = 0;
-	for (i = 0; i < size; i++)
+	// Horner's rule, every step stays in GF(251)
+	int aux = 0;
+	size_t i;
+	for (i = size; i-- > 0;)
 	{
-		aux += (pol[i] * ((long)pow(x, i) % 251)) % 251;
+		aux = (aux * x + pol[i]) % 251;
 	}
 
-	aux %= 251;
 	return (bmp_byte_t)aux;
 }
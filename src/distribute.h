@@ -3,7 +3,56 @@
 
 #include "bmp.h"
 
-int distribute(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute);
+int distribute(struct bmp_handle *secret_bmp, struct bmp_handle **shadows, size_t n, size_t k, int permute, int depth,
+	int codec);
+
+/*
+ * Compresses the truncated secret with codec and records it in info. Returns pixels itself
+ * (with payload_size = size) if the result would not be smaller, and NULL on error.
+ */
+bmp_byte_t *distribute_compress(bmp_byte_t *pixels, size_t size, int codec, size_t *payload_size,
+	struct bmp_shadow_info *info);
+
+/*
+ * Shares an already truncated payload (a compressed secret, or several secrets, see multi.h):
+ * permutes it in place, evaluates every block and writes the shadows with info.
+ */
+int distribute_packed(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t n, size_t k, int permute,
+	int depth, struct bmp_shadow_info *info);
+bmp_word_t distribute_gen_seed();
+
+// Checks that every shadow can hold a payload of size bytes
+int distribute_check_capacity(struct bmp_handle **shadows, size_t count, size_t size, size_t k, int depth);
+
+/*
+ * Evaluates every k-byte block of an already truncated (and permuted) payload at
+ * x = first_index .. first_index + count - 1 and embeds the results in the shadows.
+ * extra_coefs holds the k coefficients of the padded last block, and may only be
+ * NULL if size is a multiple of k. depth is the amount of LSBs used in each cover byte.
+ */
+int distribute_payload(bmp_byte_t *payload, size_t size, bmp_byte_t *extra_coefs, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth);
+/*
+ * Same as distribute_payload(), but only for blocks [first, last), which are stored from
+ * payload[0]. distribute_remainder() embeds the padded last block, given its k coefficients.
+ */
+int distribute_payload_range(const bmp_byte_t *payload, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t count, bmp_shadow_index_t first_index, size_t k, int depth);
+void distribute_remainder(const bmp_byte_t *extra_coefs, struct bmp_handle **shadows, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int depth);
+int distribute_write_shadows(struct bmp_handle **shadows, size_t count, bmp_shadow_index_t first_index, bmp_word_t seed,
+	struct bmp_shadow_info *info);
+
+void distribute_init_info(struct bmp_shadow_info *info, struct bmp_handle *secret_bmp, bmp_dword_t checksum,
+	size_t k, int depth);
+
+// Truncates every pixel to 250 and returns the checksum of the result
+bmp_dword_t distribute_truncate_image(bmp_byte_t *pixels, size_t size);
+bmp_byte_t distribute_evaluate_pol(bmp_byte_t *pol, size_t size, bmp_byte_t x);
+
+
+// Stores a byte in bit pos of 8 cover bytes, used for the last (padded) block at pos = depth
+void distribute_lsb_width1(bmp_byte_t byte, bmp_byte_t *pixels, size_t pos);
 
 #endif
 /* DISTRIBUTE_H */
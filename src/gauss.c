@@ -1,5 +1,4 @@
 #include "gauss.h"
-#include "recover.h"
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
@@ -54,44 +53,134 @@ bmp_op_t restrain_mod(bmp_op_t num)
 	return num;
 }
 
-int recover_gauss(bmp_op_t **original, bmp_byte_t *results, size_t n)
+int gauss_invert(bmp_op_t **matrix, size_t n, bmp_op_t **augmented, bmp_byte_t *inverse)
 {
-	int i, j, k;
-	bmp_op_t c;
+	size_t row, col, i, j;
 
-	bmp_op_t **matrix = recover_alloc_matrix(n);
-	if (matrix == NULL)
+	for (i = 0; i < n; i++)
 	{
-		return -1;
+		for (j = 0; j < n; j++)
+		{
+			augmented[i][j] = restrain_mod(matrix[i][j]);
+			augmented[i][n + j] = i == j;
+		}
 	}
 
-	memcpy(matrix[0], original[0], n * (n + 1) * sizeof(bmp_op_t));
+	for (col = 0; col < n; col++)
+	{
+		size_t pivot = col;
+		while (pivot < n && augmented[pivot][col] == 0)
+		{
+			pivot++;
+		}
+
+		if (pivot == n)
+		{
+			return -1;
+		}
+
+		for (j = 0; j < 2 * n; j++)
+		{
+			bmp_op_t aux = augmented[pivot][j];
+			augmented[pivot][j] = augmented[col][j];
+			augmented[col][j] = aux;
+		}
+
+		bmp_op_t c = mul_inverse(augmented[col][col]);
+		for (j = 0; j < 2 * n; j++)
+		{
+			augmented[col][j] = restrain_mod(augmented[col][j] * c);
+		}
+
+		for (row = 0; row < n; row++)
+		{
+			c = augmented[row][col];
+			if (row == col || c == 0)
+			{
+				continue;
+			}
+
+			for (j = 0; j < 2 * n; j++)
+			{
+				augmented[row][j] = restrain_mod(augmented[row][j] - c * augmented[col][j]);
+			}
+		}
+	}
 
 	for (i = 0; i < n; i++)
 	{
 		for (j = 0; j < n; j++)
 		{
-			if (j != i)
+			inverse[i * n + j] = augmented[i][n + j];
+		}
+	}
+
+	return 0;
+}
+
+int gauss_solve(bmp_op_t **matrix, size_t rows, size_t cols, bmp_op_t *solution, size_t *pivot_col)
+{
+	size_t row = 0, col, i, j;
+
+	for (col = 0; col < cols && row < rows; col++)
+	{
+		// Find a row with a non zero coefficient for this column
+		size_t pivot = row;
+		while (pivot < rows && restrain_mod(matrix[pivot][col]) == 0)
+		{
+			pivot++;
+		}
+
+		if (pivot == rows)
+		{
+			continue;
+		}
+
+		for (j = col; j <= cols; j++)
+		{
+			bmp_op_t aux = matrix[pivot][j];
+			matrix[pivot][j] = matrix[row][j];
+			matrix[row][j] = aux;
+		}
+
+		bmp_op_t inverse = mul_inverse(restrain_mod(matrix[row][col]));
+		for (j = col; j <= cols; j++)
+		{
+			matrix[row][j] = restrain_mod(matrix[row][j] * inverse);
+		}
+
+		for (i = 0; i < rows; i++)
+		{
+			bmp_op_t c = restrain_mod(matrix[i][col]);
+			if (i == row || c == 0)
+			{
+				continue;
+			}
+
+			for (j = col; j <= cols; j++)
 			{
-				c = matrix[j][i] * mul_inverse(matrix[i][i]);
-				c = restrain_mod(c);
-
-				for (k = 0; k < n + 1; k++)
-				{
-					bmp_op_t aux = matrix[j][k] - (c * matrix[i][k]);
-					matrix[j][k] = restrain_mod(aux);
-				}
+				matrix[i][j] = restrain_mod(matrix[i][j] - c * matrix[row][j]);
 			}
 		}
+
+		pivot_col[row++] = col;
 	}
 
-	for (i = 0; i < n; i++)
+	// Rows without a pivot must read 0 = 0
+	for (i = row; i < rows; i++)
+	{
+		if (restrain_mod(matrix[i][cols]) != 0)
+		{
+			return -1;
+		}
+	}
+
+	// Free variables are set to 0
+	memset(solution, 0, cols * sizeof(bmp_op_t));
+	for (i = 0; i < row; i++)
 	{
-		bmp_op_t result = matrix[i][n] * mul_inverse(matrix[i][i]);
-		results[i] = (bmp_byte_t)restrain_mod(result);
+		solution[pivot_col[i]] = matrix[i][cols];
 	}
 
-	free(matrix[0]);
-	free(matrix);
 	return 0;
 }
\ No newline at end of file
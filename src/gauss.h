@@ -3,7 +3,20 @@
 
 #include "bmp.h"
 
-int recover_gauss(bmp_op_t **original, bmp_byte_t *results, size_t n);
+/*
+ * Inverts the n x n matrix over GF(251), using augmented (n x 2n) as scratch. inverse is stored
+ * by rows. Returns -1 if the matrix is singular.
+ */
+int gauss_invert(bmp_op_t **matrix, size_t n, bmp_op_t **augmented, bmp_byte_t *inverse);
+
+/*
+ * Solves a (possibly non square) system over GF(251) given as a rows x (cols + 1) augmented
+ * matrix, which is modified. pivot_col is scratch for rows entries. Returns -1 if the system
+ * is inconsistent.
+ */
+int gauss_solve(bmp_op_t **matrix, size_t rows, size_t cols, bmp_op_t *solution, size_t *pivot_col);
+bmp_op_t mul_inverse(bmp_op_t num);
+bmp_op_t restrain_mod(bmp_op_t num);
 
 #endif
 /* GAUSS_H */
\ No newline at end of file
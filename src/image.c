@@ -0,0 +1,202 @@
+#include "image.h"
+#include "utils.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define PGM_MAX_VALUE 255
+
+int image_pgm_read_number(FILE *file, unsigned long *value);
+int image_has_extension(const char *filename, const char *extension);
+
+int image_format_for(const char *filename)
+{
+	if (image_has_extension(filename, ".pgm"))
+	{
+		return IMAGE_FORMAT_PGM;
+	}
+
+	if (image_has_extension(filename, ".raw") || image_has_extension(filename, ".gray"))
+	{
+		return IMAGE_FORMAT_RAW;
+	}
+
+	return IMAGE_FORMAT_BMP;
+}
+
+const char *image_format_name(int format)
+{
+	switch (format)
+	{
+		case IMAGE_FORMAT_PGM:
+			return "PGM";
+		case IMAGE_FORMAT_RAW:
+			return "raw";
+		default:
+			return "BMP";
+	}
+}
+
+size_t image_size_for_format(int format, bmp_dword_t width, bmp_dword_t height, bmp_word_t bits_per_pixel)
+{
+	if (format == IMAGE_FORMAT_BMP)
+	{
+		return image_size_for(width, height, bits_per_pixel);
+	}
+
+	if (bits_per_pixel != 8 || height == 0 || width > SIZE_MAX / height)
+	{
+		return 0;
+	}
+
+	return (size_t)width * height;
+}
+
+int image_read_pgm_header(FILE *file, bmp_dword_t *width, bmp_dword_t *height, size_t *offset)
+{
+	char magic[2];
+	unsigned long w, h, max_value;
+
+	if (fread(magic, sizeof(char), 2, file) != 2 || magic[0] != 'P' || magic[1] != '5')
+	{
+		return -1;
+	}
+
+	if (image_pgm_read_number(file, &w) != 0 || image_pgm_read_number(file, &h) != 0 ||
+		image_pgm_read_number(file, &max_value) != 0)
+	{
+		return -1;
+	}
+
+	// Only 1 byte per pixel, a single whitespace character separates the header from the pixels
+	if (w == 0 || h == 0 || w > UINT32_MAX || h > UINT32_MAX || max_value == 0 || max_value > PGM_MAX_VALUE ||
+		!isspace(fgetc(file)))
+	{
+		return -1;
+	}
+
+	off_t position = ftello(file);
+	if (position < 0)
+	{
+		return -1;
+	}
+
+	*width = w;
+	*height = h;
+	*offset = position;
+	return 0;
+}
+
+int image_write_pgm_header(FILE *file, bmp_dword_t width, bmp_dword_t height, size_t *offset)
+{
+	int written = fprintf(file, "P5\n%u %u\n%d\n", width, height, PGM_MAX_VALUE);
+	if (written < 0)
+	{
+		return -1;
+	}
+
+	*offset = written;
+	return 0;
+}
+
+int image_read_sidecar(const char *filename, bmp_dword_t *width, bmp_dword_t *height)
+{
+	char sidecar[FILENAME_MAX];
+	if (snprintf(sidecar, sizeof(sidecar), "%s%s", filename, IMAGE_SIDECAR_SUFFIX) >= sizeof(sidecar))
+	{
+		return -1;
+	}
+
+	FILE *file = fopen(sidecar, "r");
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	unsigned long w, h;
+	int status = fscanf(file, "%lu %lu", &w, &h) == 2 && w != 0 && h != 0 && w <= UINT32_MAX && h <= UINT32_MAX ? 0 : -1;
+	fclose(file);
+
+	if (status == 0)
+	{
+		*width = w;
+		*height = h;
+	}
+
+	return status;
+}
+
+int image_write_sidecar(const char *filename, bmp_dword_t width, bmp_dword_t height)
+{
+	char sidecar[FILENAME_MAX];
+	if (snprintf(sidecar, sizeof(sidecar), "%s%s", filename, IMAGE_SIDECAR_SUFFIX) >= sizeof(sidecar))
+	{
+		return -1;
+	}
+
+	FILE *file = fopen(sidecar, "w");
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	int status = fprintf(file, "%u %u\n", width, height) < 0 ? -1 : 0;
+	if (fclose(file) != 0)
+	{
+		status = -1;
+	}
+
+	return status;
+}
+
+int image_pgm_read_number(FILE *file, unsigned long *value)
+{
+	int c = fgetc(file);
+
+	// Skip whitespace and comments
+	while (c != EOF && (isspace(c) || c == '#'))
+	{
+		if (c == '#')
+		{
+			while (c != EOF && c != '\n')
+			{
+				c = fgetc(file);
+			}
+		}
+
+		c = fgetc(file);
+	}
+
+	if (c == EOF || !isdigit(c))
+	{
+		return -1;
+	}
+
+	*value = 0;
+	while (c != EOF && isdigit(c))
+	{
+		if (*value > UINT32_MAX)
+		{
+			return -1;
+		}
+
+		*value = *value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+
+	// The character after the number is part of the separator
+	if (c != EOF)
+	{
+		ungetc(c, file);
+	}
+
+	return 0;
+}
+
+int image_has_extension(const char *filename, const char *extension)
+{
+	size_t len = strlen(filename);
+	size_t extension_len = strlen(extension);
+
+	return len > extension_len && strcasecmp(filename + len - extension_len, extension) == 0;
+}
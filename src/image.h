@@ -0,0 +1,32 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include "bmp.h"
+
+/*
+ * Formats accepted for the secret image. Shadows and covers are always BMP. PGM and raw
+ * images are 8-bit grayscale with no row padding, so their pixels are one contiguous buffer.
+ */
+#define IMAGE_FORMAT_BMP 0
+#define IMAGE_FORMAT_PGM 1 // binary PGM (P5), maxval up to 255
+#define IMAGE_FORMAT_RAW 2 // dimensions given with -w and -h, or in a sidecar file
+
+#define IMAGE_SIDECAR_SUFFIX ".dim" // "frame.raw" -> "frame.raw.dim", containing "WIDTH HEIGHT"
+
+// Format of a file according to its extension (.pgm, .raw or .gray), BMP otherwise
+int image_format_for(const char *filename);
+const char *image_format_name(int format);
+
+// Size of the pixel data of an image in the given format
+size_t image_size_for_format(int format, bmp_dword_t width, bmp_dword_t height, bmp_word_t bits_per_pixel);
+
+// Both leave the file right at the start of the pixel data, and store its offset in offset
+int image_read_pgm_header(FILE *file, bmp_dword_t *width, bmp_dword_t *height, size_t *offset);
+int image_write_pgm_header(FILE *file, bmp_dword_t width, bmp_dword_t height, size_t *offset);
+
+int image_read_sidecar(const char *filename, bmp_dword_t *width, bmp_dword_t *height);
+int image_write_sidecar(const char *filename, bmp_dword_t width, bmp_dword_t height);
+
+#endif
+/* IMAGE_H */
@@ -0,0 +1,225 @@
+#include "kernels.h"
+#include "cripto.h"
+#include <string.h>
+
+#define KERNEL_MAX_FIXED 8
+#define KERNEL_WIDE_MIN_K 16 // smallest k solved by tiles of blocks
+#define KERNEL_WIDE_TILE 32
+
+static int kernel_variants[KERNEL_MAX_FIXED + 1]; // KERNEL_* used for each k, KERNEL_FIXED by default
+
+// 250 * 250 * k fits easily in 32 bits for any k up to 250, so sums are reduced only once
+
+#define KERNEL_EVALUATE(K) \
+void kernel_evaluate_##K(const bmp_byte_t *payload, size_t blocks, size_t k, const bmp_byte_t *powers, \
+	bmp_byte_t *out) \
+{ \
+	size_t b; \
+	int i; \
+	for (b = 0; b < blocks; b++) \
+	{ \
+		uint32_t sum = 0; \
+		for (i = 0; i < K; i++) \
+		{ \
+			sum += (uint32_t)payload[b * K + i] * powers[i]; \
+		} \
+		out[b] = sum % 251; \
+	} \
+}
+
+#define KERNEL_SOLVE(K) \
+void kernel_solve_##K(const bmp_byte_t *shadow_bytes, size_t stride, size_t blocks, size_t k, \
+	const bmp_byte_t *inverse, bmp_byte_t *out) \
+{ \
+	size_t b; \
+	int i, j; \
+	for (b = 0; b < blocks; b++) \
+	{ \
+		uint32_t values[K]; \
+		for (j = 0; j < K; j++) \
+		{ \
+			values[j] = shadow_bytes[j * stride + b]; \
+		} \
+		for (i = 0; i < K; i++) \
+		{ \
+			uint32_t sum = 0; \
+			for (j = 0; j < K; j++) \
+			{ \
+				sum += inverse[i * K + j] * values[j]; \
+			} \
+			out[b * K + i] = sum % 251; \
+		} \
+	} \
+}
+
+KERNEL_EVALUATE(2)
+KERNEL_EVALUATE(3)
+KERNEL_EVALUATE(4)
+KERNEL_EVALUATE(5)
+KERNEL_EVALUATE(8)
+
+KERNEL_SOLVE(2)
+KERNEL_SOLVE(3)
+KERNEL_SOLVE(4)
+KERNEL_SOLVE(5)
+KERNEL_SOLVE(8)
+
+void kernel_evaluate_generic(const bmp_byte_t *payload, size_t blocks, size_t k, const bmp_byte_t *powers,
+	bmp_byte_t *out)
+{
+	size_t b, i;
+	for (b = 0; b < blocks; b++)
+	{
+		uint32_t sum = 0;
+		for (i = 0; i < k; i++)
+		{
+			sum += (uint32_t)payload[b * k + i] * powers[i];
+		}
+		out[b] = sum % 251;
+	}
+}
+
+void kernel_solve_generic(const bmp_byte_t *shadow_bytes, size_t stride, size_t blocks, size_t k,
+	const bmp_byte_t *inverse, bmp_byte_t *out)
+{
+	size_t b, i, j;
+	for (b = 0; b < blocks; b++)
+	{
+		for (i = 0; i < k; i++)
+		{
+			uint32_t sum = 0;
+			for (j = 0; j < k; j++)
+			{
+				sum += (uint32_t)inverse[i * k + j] * shadow_bytes[j * stride + b];
+			}
+			out[b * k + i] = sum % 251;
+		}
+	}
+}
+
+/*
+ * Same as kernel_solve_generic(), for large k: the sums of a tile of blocks are kept by
+ * coefficient, so every shadow row and row of the inverse is read in order instead of once per
+ * coefficient of each block.
+ */
+void kernel_solve_wide(const bmp_byte_t *shadow_bytes, size_t stride, size_t blocks, size_t k,
+	const bmp_byte_t *inverse, bmp_byte_t *out)
+{
+	uint32_t sums[KERNEL_WIDE_TILE * MAX_SHADOW_INDEX];
+	size_t b, i, j, t, lanes;
+
+	for (b = 0; b < blocks; b += lanes)
+	{
+		lanes = blocks - b < KERNEL_WIDE_TILE ? blocks - b : KERNEL_WIDE_TILE;
+		memset(sums, 0, k * KERNEL_WIDE_TILE * sizeof(uint32_t));
+
+		for (j = 0; j < k; j++)
+		{
+			const bmp_byte_t *values = &shadow_bytes[j * stride + b];
+			for (i = 0; i < k; i++)
+			{
+				uint32_t coef = inverse[i * k + j];
+				uint32_t *sum = &sums[i * KERNEL_WIDE_TILE];
+				for (t = 0; t < lanes; t++)
+				{
+					sum[t] += coef * values[t];
+				}
+			}
+		}
+
+		for (t = 0; t < lanes; t++)
+		{
+			for (i = 0; i < k; i++)
+			{
+				out[(b + t) * k + i] = sums[i * KERNEL_WIDE_TILE + t] % 251;
+			}
+		}
+	}
+}
+
+kernel_evaluate_t kernel_evaluate_for(size_t k)
+{
+	return kernel_evaluate_variant(k, k <= KERNEL_MAX_FIXED ? kernel_variants[k] : KERNEL_GENERIC);
+}
+
+kernel_solve_t kernel_solve_for(size_t k)
+{
+	if (k >= KERNEL_WIDE_MIN_K)
+	{
+		return kernel_solve_wide;
+	}
+
+	return kernel_solve_variant(k, k <= KERNEL_MAX_FIXED ? kernel_variants[k] : KERNEL_GENERIC);
+}
+
+void kernel_select(size_t k, int variant)
+{
+	if (k <= KERNEL_MAX_FIXED)
+	{
+		kernel_variants[k] = variant;
+	}
+}
+
+int kernel_has_fixed(size_t k)
+{
+	return kernel_evaluate_variant(k, KERNEL_FIXED) != kernel_evaluate_generic;
+}
+
+kernel_evaluate_t kernel_evaluate_variant(size_t k, int variant)
+{
+	if (variant == KERNEL_GENERIC)
+	{
+		return kernel_evaluate_generic;
+	}
+
+	switch (k)
+	{
+		case 2:
+			return kernel_evaluate_2;
+		case 3:
+			return kernel_evaluate_3;
+		case 4:
+			return kernel_evaluate_4;
+		case 5:
+			return kernel_evaluate_5;
+		case 8:
+			return kernel_evaluate_8;
+		default:
+			return kernel_evaluate_generic;
+	}
+}
+
+kernel_solve_t kernel_solve_variant(size_t k, int variant)
+{
+	if (variant == KERNEL_GENERIC)
+	{
+		return kernel_solve_generic;
+	}
+
+	switch (k)
+	{
+		case 2:
+			return kernel_solve_2;
+		case 3:
+			return kernel_solve_3;
+		case 4:
+			return kernel_solve_4;
+		case 5:
+			return kernel_solve_5;
+		case 8:
+			return kernel_solve_8;
+		default:
+			return kernel_solve_generic;
+	}
+}
+
+void kernel_powers(bmp_byte_t x, size_t k, bmp_byte_t *powers)
+{
+	size_t i;
+	uint32_t power = 1;
+	for (i = 0; i < k; i++)
+	{
+		powers[i] = power;
+		power = (power * x) % 251;
+	}
+}
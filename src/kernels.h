@@ -0,0 +1,39 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "bmp.h"
+
+/*
+ * Block kernels over GF(251). There are versions with a fixed k for the usual values (2, 3, 4,
+ * 5 and 8) so the compiler can unroll and vectorize them, and a generic version for any other k.
+ * Large k is solved by tiles of blocks, and evaluated for many shadows at once by ntt.h.
+ */
+
+// out[b] = sum(payload[b * k + i] * powers[i]) for every block b, powers[i] = x^i mod 251
+typedef void (*kernel_evaluate_t)(const bmp_byte_t *payload, size_t blocks, size_t k, const bmp_byte_t *powers,
+	bmp_byte_t *out);
+
+/*
+ * out[b * k + i] = sum(inverse[i * k + j] * shadow_bytes[j * stride + b]) for every block b, that is,
+ * the coefficients of each block given the inverse of the Vandermonde matrix of the shadows.
+ */
+typedef void (*kernel_solve_t)(const bmp_byte_t *shadow_bytes, size_t stride, size_t blocks, size_t k,
+	const bmp_byte_t *inverse, bmp_byte_t *out);
+
+#define KERNEL_FIXED 0 // the version for a fixed k, if there is one
+#define KERNEL_GENERIC 1
+
+// Kernels for k, in the variant selected for it (see tune.h)
+kernel_evaluate_t kernel_evaluate_for(size_t k);
+kernel_solve_t kernel_solve_for(size_t k);
+
+void kernel_select(size_t k, int variant);
+int kernel_has_fixed(size_t k);
+kernel_evaluate_t kernel_evaluate_variant(size_t k, int variant);
+kernel_solve_t kernel_solve_variant(size_t k, int variant);
+
+// powers[i] = x^i mod 251, for i < k
+void kernel_powers(bmp_byte_t x, size_t k, bmp_byte_t *powers);
+
+#endif
+/* KERNELS_H */
@@ -0,0 +1,154 @@
+#include "loader.h"
+#include "pool.h"
+#include "utils.h"
+#include "tar.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOADER_NAME_LEN 256
+
+struct loader_job {
+	char **filenames;
+	struct bmp_handle **images;
+	int load_pixels;
+};
+
+int loader_open(void *arg, size_t index);
+int loader_is_bmp(const char *name);
+
+struct bmp_handle **loader_open_images(char **filenames, size_t count, int load_pixels)
+{
+	struct bmp_handle **images = calloc(count, sizeof(struct bmp_handle*));
+	if (images == NULL)
+	{
+		return NULL;
+	}
+
+	struct loader_job job = { filenames, images, load_pixels };
+
+	// On network storage the latency of each file dominates, so all of them are requested at once
+	if (pool_run(count, loader_open, &job) == 0)
+	{
+		printv("Images loaded: %lu (%lu threads)\n", (unsigned long)count, (unsigned long)pool_last_threads());
+		return images;
+	}
+
+	size_t i;
+	for (i = 0; i < count; i++)
+	{
+		if (images[i] == NULL)
+		{
+			printe("Error: \"%s\" could not be read or is not a valid BMP image.\n", filenames[i]);
+			break;
+		}
+	}
+
+	bmp_free_list(images, count);
+	free(images);
+
+	return NULL;
+}
+
+int loader_open(void *arg, size_t index)
+{
+	struct loader_job *job = arg;
+	char *filename = job->filenames[index];
+
+	job->images[index] = job->load_pixels ? bmp_open(filename) : bmp_open_header(filename);
+	return job->images[index] != NULL ? 0 : -1;
+}
+
+struct bmp_handle **loader_open_archive(const char *filename, size_t max, size_t *count)
+{
+	int stdio = strcmp(filename, BMP_STDIO_NAME) == 0;
+	int fd = stdio ? STDIN_FILENO : open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		printe("Error: unable to open archive \"%s\".\n", filename);
+		return NULL;
+	}
+
+	size_t capacity = 8;
+	struct bmp_handle **images = malloc(capacity * sizeof(struct bmp_handle*));
+	*count = 0;
+
+	if (images == NULL)
+	{
+		goto free_images;
+	}
+
+	while (*count < max)
+	{
+		char name[LOADER_NAME_LEN];
+		bmp_byte_t *data;
+		size_t size;
+
+		int status = tar_read_file(fd, name, sizeof(name), &data, &size);
+		if (status == 1)
+		{
+			break;
+		}
+
+		if (status != 0)
+		{
+			printe("Error: \"%s\" is not a valid tar archive.\n", filename);
+			goto free_images;
+		}
+
+		if (!loader_is_bmp(name))
+		{
+			free(data);
+			continue;
+		}
+
+		if (*count == capacity)
+		{
+			capacity *= 2;
+			struct bmp_handle **larger = realloc(images, capacity * sizeof(struct bmp_handle*));
+			if (larger == NULL)
+			{
+				free(data);
+				goto free_images;
+			}
+
+			images = larger;
+		}
+
+		struct bmp_handle *image = bmp_open_buffer(data, size, name);
+		if (image == NULL || bmp_load_pixels(image) != 0)
+		{
+			printe("Error: \"%s\" in the archive is not a valid BMP image.\n", name);
+			bmp_free(image);
+			goto free_images;
+		}
+
+		images[(*count)++] = image;
+	}
+
+	if (!stdio)
+	{
+		close(fd);
+	}
+
+	printv("Images loaded from the archive: %lu\n", (unsigned long)*count);
+	return images;
+
+	// Error handling
+free_images:
+	bmp_free_list(images, *count);
+	free(images);
+	if (!stdio)
+	{
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int loader_is_bmp(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 4 && strcmp(&name[len - 4], ".bmp") == 0;
+}
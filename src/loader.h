@@ -0,0 +1,20 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "bmp.h"
+
+/*
+ * Opens count BMP images concurrently (see pool.h), loading their pixels if load_pixels is set.
+ * Each image is validated as soon as its own header has been read. Returns NULL, after naming
+ * the first file that failed, if any of them could not be opened.
+ */
+struct bmp_handle **loader_open_images(char **filenames, size_t count, int load_pixels);
+
+/*
+ * Opens the .bmp members of a tar archive ("-" reads it from stdin), in archive order, stopping
+ * after max of them. Members are read in one pass, so the archive may come from a pipe.
+ */
+struct bmp_handle **loader_open_archive(const char *filename, size_t max, size_t *count);
+
+#endif
+/* LOADER_H */
@@ -0,0 +1,257 @@
+#include "lsb.h"
+#include "utils.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LSB_SWAR 1
+#endif
+
+#define LSB_MASK_DEPTH1 0x0101010101010101ULL
+#define LSB_MASK_DEPTH2 0x03030303U
+#define LSB_GATHER_DEPTH1 0x8040201008040201ULL // moves bit 8 * i to bit 63 - i
+#define LSB_GATHER_DEPTH2 0x40100401U // moves bits 8 * i to bits 30 - 2 * i
+
+static uint64_t spread_depth1[256]; // byte i holds bit 7 - i
+static uint32_t spread_depth2[256]; // byte i holds bits 7 - 2 * i and 6 - 2 * i
+static uint16_t spread_depth4[256]; // byte 0 holds the high nibble, byte 1 the low one
+static int tables_ready = 0;
+
+void lsb_embed_bits(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, int phase, int depth);
+void lsb_extract_bits(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, int phase, int depth);
+void lsb_embed_depth3(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, int phase);
+void lsb_extract_depth3(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, int phase);
+
+int lsb_default_depth(size_t k)
+{
+	return k >= 8 ? 1 : 2;
+}
+
+int lsb_depth_of(struct bmp_handle *shadow, size_t k)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	if (info != NULL && info->lsb_depth >= LSB_MIN_DEPTH && info->lsb_depth <= LSB_MAX_DEPTH)
+	{
+		return info->lsb_depth;
+	}
+
+	return lsb_default_depth(k);
+}
+
+size_t lsb_cover_offset(size_t index, int depth)
+{
+	return (index * 8) / depth;
+}
+
+size_t lsb_cover_bytes(size_t count, int depth)
+{
+	return (count * 8 + depth - 1) / depth;
+}
+
+void lsb_init_tables()
+{
+	int value, i;
+	for (value = 0; value < 256; value++)
+	{
+		bmp_byte_t bytes1[8], bytes2[4], bytes4[2];
+		for (i = 0; i < 8; i++)
+		{
+			bytes1[i] = GET_BIT(value, 8 - 1 - i);
+		}
+		for (i = 0; i < 4; i++)
+		{
+			bytes2[i] = (value >> (8 - 2 - (i * 2))) & 0x03;
+		}
+		bytes4[0] = value >> 4;
+		bytes4[1] = value & 0x0F;
+
+		memcpy(&spread_depth1[value], bytes1, sizeof(bytes1));
+		memcpy(&spread_depth2[value], bytes2, sizeof(bytes2));
+		memcpy(&spread_depth4[value], bytes4, sizeof(bytes4));
+	}
+
+	tables_ready = 1;
+}
+
+void lsb_embed(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, size_t first, int depth)
+{
+	size_t i;
+
+	if (!tables_ready)
+	{
+		lsb_init_tables();
+	}
+
+	switch (depth)
+	{
+		case 1:
+			for (i = 0; i < count; i++)
+			{
+				uint64_t word;
+				memcpy(&word, &cover[i * 8], 8);
+				word = (word & ~LSB_MASK_DEPTH1) | spread_depth1[bytes[i]];
+				memcpy(&cover[i * 8], &word, 8);
+			}
+		break;
+
+		case 2:
+			for (i = 0; i < count; i++)
+			{
+				uint32_t word;
+				memcpy(&word, &cover[i * 4], 4);
+				word = (word & ~LSB_MASK_DEPTH2) | spread_depth2[bytes[i]];
+				memcpy(&cover[i * 4], &word, 4);
+			}
+		break;
+
+		case 3:
+			lsb_embed_depth3(bytes, count, cover, (first * 8) % 3);
+		break;
+
+		case 4:
+			for (i = 0; i < count; i++)
+			{
+				uint16_t word;
+				memcpy(&word, &cover[i * 2], 2);
+				word = (word & ~0x0F0F) | spread_depth4[bytes[i]];
+				memcpy(&cover[i * 2], &word, 2);
+			}
+		break;
+	}
+}
+
+void lsb_extract(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, size_t first, int depth)
+{
+	size_t i;
+
+	switch (depth)
+	{
+		case 1:
+			for (i = 0; i < count; i++)
+			{
+#ifdef LSB_SWAR
+				uint64_t word;
+				memcpy(&word, &cover[i * 8], 8);
+				bytes[i] = ((word & LSB_MASK_DEPTH1) * LSB_GATHER_DEPTH1) >> 56;
+#else
+				lsb_extract_bits(&cover[i * 8], 1, &bytes[i], 0, 1);
+#endif
+			}
+		break;
+
+		case 2:
+			for (i = 0; i < count; i++)
+			{
+#ifdef LSB_SWAR
+				uint32_t word;
+				memcpy(&word, &cover[i * 4], 4);
+				bytes[i] = ((word & LSB_MASK_DEPTH2) * LSB_GATHER_DEPTH2) >> 24;
+#else
+				lsb_extract_bits(&cover[i * 4], 1, &bytes[i], 0, 2);
+#endif
+			}
+		break;
+
+		case 3:
+			lsb_extract_depth3(cover, count, bytes, (first * 8) % 3);
+		break;
+
+		case 4:
+			for (i = 0; i < count; i++)
+			{
+				bytes[i] = ((cover[i * 2] & 0x0F) << 4) | (cover[i * 2 + 1] & 0x0F);
+			}
+		break;
+	}
+}
+
+/*
+ * With 3 LSBs, 3 shadow bytes (24 bits) fill exactly 8 cover bytes. Groups that start on a
+ * cover byte are handled as a whole, the rest bit by bit.
+ */
+void lsb_embed_depth3(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, int phase)
+{
+	size_t i = 0;
+
+	while (i < count && phase != 0)
+	{
+		lsb_embed_bits(&bytes[i], 1, cover, phase, 3);
+		cover += (phase + 8) / 3;
+		phase = (phase + 8) % 3;
+		i++;
+	}
+
+	for (; i + 3 <= count; i += 3)
+	{
+		uint32_t bits = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+		int t;
+		for (t = 0; t < 8; t++)
+		{
+			cover[t] = (cover[t] & ~0x07) | ((bits >> (21 - (3 * t))) & 0x07);
+		}
+		cover += 8;
+	}
+
+	if (i < count)
+	{
+		lsb_embed_bits(&bytes[i], count - i, cover, 0, 3);
+	}
+}
+
+void lsb_extract_depth3(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, int phase)
+{
+	size_t i = 0;
+
+	while (i < count && phase != 0)
+	{
+		lsb_extract_bits(cover, 1, &bytes[i], phase, 3);
+		cover += (phase + 8) / 3;
+		phase = (phase + 8) % 3;
+		i++;
+	}
+
+	for (; i + 3 <= count; i += 3)
+	{
+		uint32_t bits = 0;
+		int t;
+		for (t = 0; t < 8; t++)
+		{
+			bits = (bits << 3) | (cover[t] & 0x07);
+		}
+
+		bytes[i] = bits >> 16;
+		bytes[i + 1] = bits >> 8;
+		bytes[i + 2] = bits;
+		cover += 8;
+	}
+
+	if (i < count)
+	{
+		lsb_extract_bits(cover, count - i, &bytes[i], 0, 3);
+	}
+}
+
+// Generic version: stream bit b is stored in cover byte b / depth, at position depth - 1 - b % depth
+void lsb_embed_bits(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, int phase, int depth)
+{
+	size_t bit;
+	for (bit = 0; bit < count * 8; bit++)
+	{
+		size_t stream_bit = bit + phase;
+		int pos = depth - 1 - (stream_bit % depth);
+		bmp_byte_t value = GET_BIT(bytes[bit / 8], 8 - 1 - (bit % 8));
+		cover[stream_bit / depth] = (cover[stream_bit / depth] & ~BIT(pos)) | (value << pos);
+	}
+}
+
+void lsb_extract_bits(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, int phase, int depth)
+{
+	size_t bit;
+	memset(bytes, 0, count);
+	for (bit = 0; bit < count * 8; bit++)
+	{
+		size_t stream_bit = bit + phase;
+		int pos = depth - 1 - (stream_bit % depth);
+		bytes[bit / 8] |= GET_BIT(cover[stream_bit / depth], pos) << (8 - 1 - (bit % 8));
+	}
+}
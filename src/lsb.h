@@ -0,0 +1,28 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include "bmp.h"
+
+#define LSB_MIN_DEPTH 1
+#define LSB_MAX_DEPTH 4
+
+/*
+ * Bulk LSB kernels. Shadow bytes form a bit stream (MSB first) that is stored in the depth
+ * least significant bits of consecutive cover bytes, so each shadow byte takes 8 / depth cover
+ * bytes. cover points to the cover byte returned by lsb_cover_offset(first, depth), where first
+ * is the index of bytes[0] in the whole shadow. Runs of bytes are processed a machine word at
+ * a time, which matters for 24 bit covers where rows are three times longer.
+ */
+void lsb_embed(const bmp_byte_t *bytes, size_t count, bmp_byte_t *cover, size_t first, int depth);
+void lsb_extract(const bmp_byte_t *cover, size_t count, bmp_byte_t *bytes, size_t first, int depth);
+
+// 1 LSB for k >= 8 and 2 LSBs otherwise, as given by the assignment
+int lsb_default_depth(size_t k);
+int lsb_depth_of(struct bmp_handle *shadow, size_t k);
+
+// Cover byte that holds the first bit of shadow byte index, and amount of cover bytes for count shadow bytes
+size_t lsb_cover_offset(size_t index, int depth);
+size_t lsb_cover_bytes(size_t count, int depth);
+
+#endif
+/* LSB_H */
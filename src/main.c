@@ -11,20 +11,47 @@
 
 #include "recover.h"
 #include "distribute.h"
+#include "participant.h"
+#include "delta.h"
+#include "robust.h"
+#include "compress.h"
+#include "image.h"
+#include "arena.h"
+#include "lsb.h"
+#include "shard.h"
+#include "writer.h"
+#include "loader.h"
+#include "tune.h"
+#include "bundle.h"
+#include "multi.h"
+#include "checkpoint.h"
+#include "preflight.h"
+#include "span.h"
+#include "reshare.h"
 
 #define TRUE 1
 #define FALSE !TRUE
 
 #define RECOVER_MODE 1
 #define DISTRIBUTE_MODE 2
+#define ADD_MODE 3
+#define MERGE_MODE 4
+#define TUNE_MODE 5
+#define RESHARE_MODE 6
 #define MAX_FILENAME_LEN 255
 #define DEFAULT_DIR "."
 
 int verbose_mode = FALSE;
+int memo_mode = FALSE;
+int fsync_mode = WRITER_SYNC_FILE;
+size_t payload_chunk_blocks = PAYLOAD_CHUNK_BLOCKS;
+int checkpoint_interval = 0;
+int resume_mode = FALSE;
 
 enum cmd_status {
 	CMD_SUCCESS, ERROR_D_AND_R, ERROR_NOMODE, ERROR_NOK,
-	ERROR_NOSECRET, ERROR_GETOPT, ERROR_NON, ERROR_NODIR, ERROR_ORDER
+	ERROR_NOSECRET, ERROR_GETOPT, ERROR_NON, ERROR_NODIR, ERROR_ORDER, ERROR_NOINDEX,
+	ERROR_NODEPTH, ERROR_NOSHARD, ERROR_NOSYNC, ERROR_NOINTERVAL
 };
 
 struct cmd_options {
@@ -36,12 +63,32 @@ struct cmd_options {
 	bmp_dword_t secret_width;
 	bmp_dword_t secret_height;
 	int enable_permute;
+	char from_dir[MAX_FILENAME_LEN];
+	int seed;
+	int first_index;
+	int delta;
+	char old_secret[MAX_FILENAME_LEN];
+	int robust;
+	int lsb_depth;
+	int codec;
+	int shard;
+	int shards; // 0 if the whole payload is processed
+	char tar[MAX_FILENAME_LEN]; // archive of the shadows, instead of the covers in dir
+	char bundle[MAX_FILENAME_LEN]; // same, as a bundle
+	char extract[MULTI_NAME_LEN]; // secret to recover from shadows that hold several
+	int preflight; // only check the shadows
+	int parts; // each shadow spans the covers of a participant directory in dir
+	int old_k; // of the shadows in from_dir, when resharing them
 };
 
 int arg_invalid_pos(int c, int pos)
 {
 	return ((c == 'd' && pos != 0) ||
 			(c == 'r' && pos != 0) ||
+			(c == 'a' && pos != 0) ||
+			(c == 'm' && pos != 0) ||
+			(c == 't' && pos != 0) ||
+			(c == 'Z' && pos != 0) ||
 			(c == 's' && pos != 1) ||
 			(c == 'k' && pos != 2) ||
 			(c == 'n' && pos != 3) ||
@@ -57,7 +104,23 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
  	options->n = 0;
  	options->secret_width = 0;
  	options->secret_height = 0;
- 	options->enable_permute = TRUE;
+ 	options->enable_permute = PERMUTE_SWAP;
+ 	options->from_dir[0] = 0;
+ 	options->seed = -1;
+ 	options->first_index = 0;
+ 	options->delta = FALSE;
+ 	options->old_secret[0] = 0;
+ 	options->robust = FALSE;
+ 	options->lsb_depth = 0;
+ 	options->codec = CODEC_NONE;
+ 	options->shard = 0;
+ 	options->shards = 0;
+ 	options->tar[0] = 0;
+ 	options->bundle[0] = 0;
+ 	options->extract[0] = 0;
+ 	options->preflight = FALSE;
+ 	options->parts = FALSE;
+ 	options->old_k = 0;
 
 	static struct option long_options[] =
     {
@@ -65,6 +128,29 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
 		{"dir",  required_argument, NULL, 'i'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"no-permute", no_argument, NULL, 'p'},
+		{"from", required_argument, NULL, 'f'},
+		{"seed", required_argument, NULL, 'e'},
+		{"index", required_argument, NULL, 'x'},
+		{"index-permute", no_argument, NULL, 'P'},
+		{"delta", no_argument, NULL, 'D'},
+		{"old", required_argument, NULL, 'o'},
+		{"robust", no_argument, NULL, 'R'},
+		{"lsb", required_argument, NULL, 'L'},
+		{"compress", no_argument, NULL, 'C'},
+		{"memo", no_argument, NULL, 'M'},
+		{"shard", required_argument, NULL, 'S'},
+		{"merge", no_argument, NULL, 'm'},
+		{"tune", no_argument, NULL, 't'},
+		{"fsync", required_argument, NULL, 'F'},
+		{"tar", required_argument, NULL, 'T'},
+		{"bundle", required_argument, NULL, 'B'},
+		{"extract", required_argument, NULL, 'X'},
+		{"checkpoint", required_argument, NULL, 'K'},
+		{"resume", no_argument, NULL, 'U'},
+		{"preflight", no_argument, NULL, 'Y'},
+		{"parts", no_argument, NULL, 'Q'},
+		{"reshare", no_argument, NULL, 'Z'},
+		{"old-k", required_argument, NULL, 'O'},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -74,14 +160,34 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
 	{
 		int c;
 		size_t len;
+		char *end;
+		unsigned long value;
 
-		c = getopt_long_only(argc, argv, "drk:n:w:h:", long_options, NULL);
+		c = getopt_long_only(argc, argv, "drak:n:w:h:", long_options, NULL);
 
 		if (c == -1)
 		{
 			break;
 		}
 
+		// When adding participants from existing shadows, the secret may be omitted
+		if (options->mode == ADD_MODE && option_pos == 1 && c != 's')
+		{
+			option_pos++;
+		}
+
+		// Resharing takes the secret from the old shadows (--from)
+		if (options->mode == RESHARE_MODE && option_pos == 1)
+		{
+			option_pos++;
+		}
+
+		// Merging the segments of the shadows and tuning need neither the secret nor k
+		if ((options->mode == MERGE_MODE || options->mode == TUNE_MODE) && option_pos == 1 && c == 'i')
+		{
+			option_pos = 3;
+		}
+
 		if (arg_invalid_pos(c, option_pos))
 		{
 			return ERROR_ORDER;
@@ -105,6 +211,38 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
 				options->mode = RECOVER_MODE;
 			break;
 
+			case 'a':
+				if (options->mode)
+				{
+					return ERROR_D_AND_R;
+				}
+				options->mode = ADD_MODE;
+			break;
+
+			case 'm':
+				if (options->mode)
+				{
+					return ERROR_D_AND_R;
+				}
+				options->mode = MERGE_MODE;
+			break;
+
+			case 't':
+				if (options->mode)
+				{
+					return ERROR_D_AND_R;
+				}
+				options->mode = TUNE_MODE;
+			break;
+
+			case 'Z':
+				if (options->mode)
+				{
+					return ERROR_D_AND_R;
+				}
+				options->mode = RESHARE_MODE;
+			break;
+
 			case 's':
 				len = strlen(optarg);
 				if (len > MAX_FILENAME_LEN - 1 || len == 0)
@@ -150,7 +288,144 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
 			break;
 
 			case 'p':
-				options->enable_permute = FALSE;
+				options->enable_permute = PERMUTE_NONE;
+			break;
+
+			case 'P':
+				options->enable_permute = PERMUTE_INDEX;
+			break;
+
+			case 'D':
+				options->delta = TRUE;
+			break;
+
+			case 'R':
+				options->robust = TRUE;
+			break;
+
+			case 'L':
+				options->lsb_depth = atoi(optarg);
+				if (options->lsb_depth < LSB_MIN_DEPTH || options->lsb_depth > LSB_MAX_DEPTH)
+				{
+					return ERROR_NODEPTH;
+				}
+			break;
+
+			case 'C':
+				options->codec = CODEC_RLE;
+			break;
+
+			case 'M':
+				memo_mode = TRUE;
+			break;
+
+			case 'F':
+				fsync_mode = writer_sync_mode_for(optarg);
+				if (fsync_mode < 0)
+				{
+					return ERROR_NOSYNC;
+				}
+			break;
+
+			case 'S':
+				if (sscanf(optarg, "%d/%d", &options->shard, &options->shards) != 2 || options->shards < 1 ||
+					options->shards > SHARD_MAX || options->shard < 0 || options->shard >= options->shards)
+				{
+					return ERROR_NOSHARD;
+				}
+			break;
+
+			case 'T':
+				len = strlen(optarg);
+				if (len > MAX_FILENAME_LEN - 1 || len == 0)
+				{
+					return ERROR_NODIR;
+				}
+
+				strcpy(options->tar, optarg);
+			break;
+
+			case 'B':
+				len = strlen(optarg);
+				if (len > MAX_FILENAME_LEN - 1 || len == 0)
+				{
+					return ERROR_NODIR;
+				}
+
+				strcpy(options->bundle, optarg);
+			break;
+
+			case 'X':
+				len = strlen(optarg);
+				if (len > MULTI_NAME_LEN - 1 || len == 0)
+				{
+					return ERROR_NOSECRET;
+				}
+
+				strcpy(options->extract, optarg);
+			break;
+
+			case 'K':
+				if (sscanf(optarg, "%d", &checkpoint_interval) != 1 || checkpoint_interval < 1)
+				{
+					return ERROR_NOINTERVAL;
+				}
+			break;
+
+			case 'U':
+				resume_mode = TRUE;
+			break;
+
+			case 'Y':
+				options->preflight = TRUE;
+			break;
+
+			case 'Q':
+				options->parts = TRUE;
+			break;
+
+			case 'O':
+				options->old_k = atoi(optarg);
+				if (options->old_k == 0)
+				{
+					return ERROR_NOK;
+				}
+			break;
+
+			case 'o':
+				len = strlen(optarg);
+				if (len > MAX_FILENAME_LEN - 1 || len == 0)
+				{
+					return ERROR_NOSECRET;
+				}
+
+				options->delta = TRUE;
+				strcpy(options->old_secret, optarg);
+			break;
+
+			case 'f':
+				len = strlen(optarg);
+				if (len > MAX_FILENAME_LEN - 1 || len == 0)
+				{
+					return ERROR_NODIR;
+				}
+
+				strcpy(options->from_dir, optarg);
+			break;
+
+			case 'e':
+				// Anything but a plain number up to MAX_SEED is left for validate_args() to reject
+				value = strtoul(optarg, &end, 10);
+				options->seed = end != optarg && *end == '\0' && strchr(optarg, '-') == NULL && value <= MAX_SEED ?
+					(int)value : MAX_SEED + 1;
+			break;
+
+			case 'x':
+				options->first_index = atoi(optarg);
+				if (options->first_index <= 0)
+				{
+					return ERROR_NOINDEX;
+				}
 			break;
 
 			default:
@@ -165,11 +440,13 @@ enum cmd_status parse_args(int argc, char *argv[], struct cmd_options *options)
     {
     	return ERROR_NOMODE;
     }
-    else if (strlen(options->secret) == 0)
+    else if (strlen(options->secret) == 0 && !(options->mode == ADD_MODE && strlen(options->from_dir) != 0) &&
+    	options->mode != MERGE_MODE && options->mode != TUNE_MODE && options->mode != RESHARE_MODE)
     {
     	return ERROR_NOSECRET;
     }
-    else if (options->k == 0)
+    else if (options->k == 0 && !(options->mode == MERGE_MODE && strlen(options->secret) == 0) &&
+    	options->mode != TUNE_MODE)
     {
     	return ERROR_NOK;
     }
@@ -191,18 +468,174 @@ int validate_args(struct cmd_options *options)
 		return -1;
 	}
 
-	if (options->n != 0 && options->n < MIN_N)
+	if (options->seed > MAX_SEED)
+	{
+		printe("Error: the seed must be a number between 0 and %d.\n", MAX_SEED);
+		return -1;
+	}
+
+	if (options->delta && options->mode != DISTRIBUTE_MODE)
+	{
+		printe("Error: --delta can only be used with the -d option.\n");
+		return -1;
+	}
+
+	if (options->lsb_depth && (options->mode == RECOVER_MODE || options->delta ||
+		(options->mode == ADD_MODE && strlen(options->from_dir) != 0)))
+	{
+		printe("Error: --lsb can only be used when creating new shadows (it is stored in them).\n");
+		return -1;
+	}
+
+	if (options->codec != CODEC_NONE &&
+		(options->mode == RECOVER_MODE || options->delta || strlen(options->from_dir) != 0))
+	{
+		printe("Error: --compress can only be used when creating new shadows from the secret.\n");
+		return -1;
+	}
+
+	if (options->robust && options->mode != RECOVER_MODE)
+	{
+		printe("Error: --robust can only be used with the -r option.\n");
+		return -1;
+	}
+
+	if (options->shards)
+	{
+		if ((options->mode != DISTRIBUTE_MODE && options->mode != RECOVER_MODE) || options->delta ||
+			options->robust || options->codec != CODEC_NONE)
+		{
+			printe("Error: --shard can only be used to distribute or recover (without --delta, --robust or --compress).\n");
+			return -1;
+		}
+
+		// Each shard permutes only its own bytes
+		if (options->enable_permute == PERMUTE_SWAP)
+		{
+			printe("Error: --shard needs a permutation that can be computed per index (--index-permute or --no-permute).\n");
+			return -1;
+		}
+
+		if (options->mode == DISTRIBUTE_MODE && options->enable_permute == PERMUTE_INDEX && options->seed < 0)
+		{
+			printe("Error: every shard must use the same seed (--seed).\n");
+			return -1;
+		}
+	}
+
+	if ((strlen(options->tar) != 0 || strlen(options->bundle) != 0) &&
+		((options->mode != DISTRIBUTE_MODE && options->mode != RECOVER_MODE) || options->delta || options->shards))
+	{
+		printe("Error: --tar and --bundle can only be used to distribute or recover (without --delta or --shard).\n");
+		return -1;
+	}
+
+	if (strlen(options->tar) != 0 && strlen(options->bundle) != 0)
+	{
+		printe("Error: only one of --tar or --bundle can be used.\n");
+		return -1;
+	}
+
+	if (strchr(options->secret, MULTI_SEPARATOR) != NULL && (options->mode != DISTRIBUTE_MODE || options->delta ||
+		options->shards || options->codec != CODEC_NONE))
+	{
+		printe("Error: several secrets can only be shared with -d (without --delta, --shard or --compress).\n");
+		return -1;
+	}
+
+	if (strlen(options->extract) != 0 && options->mode != RECOVER_MODE)
+	{
+		printe("Error: --extract can only be used with the -r option.\n");
+		return -1;
+	}
+
+	int secret_stdio = strcmp(options->secret, BMP_STDIO_NAME) == 0;
+	if (secret_stdio && (options->mode == MERGE_MODE || options->shards))
+	{
+		printe("Error: the secret can not be read from stdin or written to stdout in segments.\n");
+		return -1;
+	}
+
+	// Verbose output goes to stdout too
+	if (verbose_mode && ((options->mode == RECOVER_MODE && secret_stdio) ||
+		(options->mode == DISTRIBUTE_MODE && strcmp(options->tar, BMP_STDIO_NAME) == 0)))
+	{
+		printe("Error: -verbose can not be used when writing to stdout.\n");
+		return -1;
+	}
+
+	if (options->preflight && (options->mode != RECOVER_MODE || options->shards || checkpoint_interval || resume_mode))
+	{
+		printe("Error: --preflight can only be used with the -r option (without --shard or --checkpoint).\n");
+		return -1;
+	}
+
+	if (options->parts && ((options->mode != DISTRIBUTE_MODE && options->mode != RECOVER_MODE &&
+		options->mode != RESHARE_MODE) || options->delta ||
+		options->shards || strlen(options->tar) != 0 || strlen(options->bundle) != 0))
+	{
+		printe("Error: --parts can only be used to distribute, recover or reshare (without --delta, --shard, --tar or --bundle).\n");
+		return -1;
+	}
+
+	if ((checkpoint_interval || resume_mode) && ((options->mode != DISTRIBUTE_MODE && options->mode != RECOVER_MODE) ||
+		options->delta || options->shards || options->robust || secret_stdio))
+	{
+		printe("Error: --checkpoint and --resume can only be used to distribute or recover a secret file (without --delta, --shard or --robust).\n");
+		return -1;
+	}
+
+	if ((options->mode == RESHARE_MODE) != (options->old_k != 0))
+	{
+		printe("Error: -reshare needs the K of the old shadows (--old-k), which can only be used with it.\n");
+		return -1;
+	}
+
+	if (options->mode == RESHARE_MODE && (strlen(options->from_dir) == 0 || options->old_k < MIN_K))
+	{
+		printe("Error: the old shadows must be given with --from, with K = %d or greater (--old-k).\n", MIN_K);
+		return -1;
+	}
+
+	if (options->mode == ADD_MODE)
 	{
-		printe("Error: n must be %d or greater.\n", MIN_N);
+		if (options->first_index == 0)
+		{
+			printe("Error: the index of the first new shadow must be specified (--index).\n");
+			return -1;
+		}
+
+		if (strlen(options->from_dir) == 0 && options->seed < 0)
+		{
+			printe("Error: the original seed (--seed) is required when adding shadows from the secret.\n");
+			return -1;
+		}
+
+		if (options->n != 0 && options->first_index + options->n - 1 > MAX_SHADOW_INDEX)
+		{
+			printe("Error: shadow indexes must not exceed %d.\n", MAX_SHADOW_INDEX);
+			return -1;
+		}
+	}
+	else if (options->n != 0 && (options->n < MIN_N || options->n > MAX_SHADOW_INDEX))
+	{
+		printe("Error: n must be between %d and %d.\n", MIN_N, MAX_SHADOW_INDEX);
 		return -1;
 	}
 
-	if (options->k < MIN_K)
+	if (options->k < MIN_K && !((options->mode == MERGE_MODE || options->mode == TUNE_MODE) && options->k == 0))
 	{
 		printe("Error: k must be %d or greater.\n", MIN_K);
 		return -1;
 	}
 
+	// Every share needs its own shadow index, and the kernels size their scratch for that many
+	if (options->k > MAX_SHADOW_INDEX || options->old_k > MAX_SHADOW_INDEX)
+	{
+		printe("Error: k must not exceed %d.\n", MAX_SHADOW_INDEX);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -211,10 +644,10 @@ void print_error(enum cmd_status status)
 	switch (status)
 	{
 		case ERROR_D_AND_R:
-			printe("Error: -r and -d cannot be defined simultaneously.\n");
+			printe("Error: only one of -r, -d, -a, -merge, -tune or -reshare can be defined.\n");
 		break;
 		case ERROR_NOMODE:
-			printe("Error: -r or -d must be defined.\n");
+			printe("Error: -r, -d, -a, -merge, -tune or -reshare must be defined.\n");
 		break;
 		case ERROR_NOK:
 			printe("Error: K was invalid or was not specified.\n");
@@ -234,25 +667,92 @@ void print_error(enum cmd_status status)
 		case ERROR_ORDER:
 			printe("Error: arguments must be in the correct order.\n");
 		break;
+		case ERROR_NOINDEX:
+			printe("Error: shadow index was invalid.\n");
+		break;
+		case ERROR_NODEPTH:
+			printe("Error: LSB depth must be between %d and %d.\n", LSB_MIN_DEPTH, LSB_MAX_DEPTH);
+		break;
+		case ERROR_NOSYNC:
+			printe("Error: --fsync must be none, file or all.\n");
+		break;
+		case ERROR_NOINTERVAL:
+			printe("Error: the checkpoint interval must be a positive amount of seconds.\n");
+		break;
+		case ERROR_NOSHARD:
+			printe("Error: shard must be given as i/m, with 0 <= i < m <= %d.\n", SHARD_MAX);
+		break;
 		default:
 			printe("Unknown error.\n");
 		break;
 	}
 }
 
+const char *mode_name(int mode)
+{
+	switch (mode)
+	{
+		case RECOVER_MODE:
+			return "Recover";
+		case ADD_MODE:
+			return "Add participants";
+		case MERGE_MODE:
+			return "Merge segments";
+		case TUNE_MODE:
+			return "Tune";
+		case RESHARE_MODE:
+			return "Reshare";
+		default:
+			return "Distribute";
+	}
+}
+
 void print_args_info(struct cmd_options *options)
 {
 	printv("Verbose mode enabled.\n");
 	printv("Starting with:\n");
 	printv("-> Secret file: \"%s\"\n", options->secret);
-	printv("-> Mode: %s\n", options->mode == RECOVER_MODE ? "Recover" : "Distribute");
+	printv("-> Mode: %s\n", mode_name(options->mode));
 	printv("-> Directory: \"%s\"\n", options->dir);
-	printv("-> Permutation: %s\n", options->enable_permute ? "Enabled" : "Disabled");
+	printv("-> Permutation: %s\n", options->enable_permute == PERMUTE_SWAP ? "Enabled" :
+		(options->enable_permute == PERMUTE_INDEX ? "Enabled (index)" : "Disabled"));
+	if (options->delta)
+	{
+		printv("-> Delta: previous secret %s\n", strlen(options->old_secret) ? options->old_secret : "recovered from shadows");
+	}
 	printv("-> K: %d\n", options->k);
+	if (strlen(options->tar) != 0)
+	{
+		printv("-> Shadows archive: \"%s\"\n", options->tar);
+	}
+	if (strlen(options->bundle) != 0)
+	{
+		printv("-> Shadows bundle: \"%s\"\n", options->bundle);
+	}
+	if (options->shards)
+	{
+		printv("-> Shard: %d of %d\n", options->shard, options->shards);
+	}
+	if (options->parts)
+	{
+		printv("-> Shadows: one participant directory each\n");
+	}
 	if (options->n)
 	{
 		printv("-> N: %d\n", options->n);
 	}
+	if (options->mode == ADD_MODE)
+	{
+		printv("-> First new shadow index: %d\n", options->first_index);
+		if (strlen(options->from_dir) != 0)
+		{
+			printv("-> Existing shadows directory: \"%s\"\n", options->from_dir);
+		}
+	}
+	if (options->mode == RESHARE_MODE)
+	{
+		printv("-> Old shadows directory: \"%s\" (K: %d)\n", options->from_dir, options->old_k);
+	}
 }
 
 void print_bmps_info(struct bmp_handle **bmp_list, char **file_list, size_t len, int mode)
@@ -297,9 +797,15 @@ int is_bmp_file(struct dirent *ep)
 	return 1;
 }
 
-char **bmps_in_dir(DIR *dp, int count, int *found)
+int is_participant_dir(struct dirent *ep)
+{
+	return ep->d_type == DT_DIR && strcmp(ep->d_name, ".") != 0 && strcmp(ep->d_name, "..") != 0;
+}
+
+// Names of the entries of dp that accept takes, sorted, if there are at least count of them
+char **entries_in_dir(DIR *dp, int count, int *found, int (*accept)(struct dirent*))
 {
-	size_t bmp_count = 0;
+	size_t entry_count = 0;
 	struct dirent *ep;
 
 	if (dp == NULL || found == NULL)
@@ -309,21 +815,21 @@ char **bmps_in_dir(DIR *dp, int count, int *found)
 
 	while ((ep = readdir(dp)))
 	{
-		if (is_bmp_file(ep))
+		if (accept(ep))
 		{
-			bmp_count++;
+			entry_count++;
 		}
 	}
 
-	if (bmp_count == 0 || (count != 0 && bmp_count < count))
+	if (entry_count == 0 || (count != 0 && entry_count < count))
 	{
 		return NULL;
 	}
 
 	rewinddir(dp);
 
-	char **bmps = malloc(bmp_count * sizeof(char*));
-	if (bmps == NULL)
+	char **entries = malloc(entry_count * sizeof(char*));
+	if (entries == NULL)
 	{
 		return NULL;
 	}
@@ -331,54 +837,114 @@ char **bmps_in_dir(DIR *dp, int count, int *found)
 	int i = 0;
 	while ((ep = readdir(dp)))
 	{
-		if (is_bmp_file(ep))
+		if (accept(ep))
 		{
-			bmps[i++] = ep->d_name;
+			entries[i++] = ep->d_name;
 		}
 	}
 
-	qsort(bmps, bmp_count, sizeof(char*), compare_strings);
-	*found = bmp_count;
+	qsort(entries, entry_count, sizeof(char*), compare_strings);
+	*found = entry_count;
 
-	return bmps;
+	return entries;
 }
 
-struct bmp_handle **open_files(char **file_list, int to_open, char *dir)
+char **bmps_in_dir(DIR *dp, int count, int *found)
+{
+	return entries_in_dir(dp, count, found, is_bmp_file);
+}
+
+// With --parts, the shadow of each participant is kept in a directory of its own
+char **participants_in_dir(DIR *dp, int count, int *found)
+{
+	return entries_in_dir(dp, count, found, is_participant_dir);
+}
+
+struct bmp_handle **open_files(char **file_list, int to_open, char *dir, int load_pixels)
 {
 	int i;
-	struct bmp_handle **bmp_list = malloc(to_open * sizeof(struct bmp_handle*));
-	char tmp_filename[MAX_FILENAME_LEN] = {0};
+	char (*filenames)[MAX_FILENAME_LEN] = malloc(to_open * sizeof(*filenames));
+	char **paths = malloc(to_open * sizeof(char*));
+	struct bmp_handle **bmp_list = NULL;
 
-	if (bmp_list == NULL)
+	if (filenames == NULL || paths == NULL)
 	{
-		return NULL;
+		goto free_paths;
 	}
 
 	for (i = 0; i < to_open; i++)
 	{
-		strcpy(tmp_filename, dir);
-		strcat(tmp_filename, "/");
-		strcat(tmp_filename, file_list[i]);
-
-		bmp_list[i] = bmp_open(tmp_filename);
-		if (bmp_list[i] == NULL)
+		if (snprintf(filenames[i], MAX_FILENAME_LEN, "%s/%s", dir, file_list[i]) >= MAX_FILENAME_LEN)
 		{
-			bmp_free_list(bmp_list, i);
-			return NULL;
+			goto free_paths;
 		}
+
+		paths[i] = filenames[i];
 	}
 
+	bmp_list = loader_open_images(paths, to_open, load_pixels);
+
+free_paths:
+	free(paths);
+	free(filenames);
+
 	return bmp_list;
 }
 
-int check_bmp_sizes(struct bmp_handle **bmp_list, size_t len)
+/*
+ * Shadows read from an archive or a bundle instead of a directory: the first K members, or all
+ * of them with --robust. file_list gets the names of the members.
+ */
+struct bmp_handle **open_archive(struct cmd_options *options, char ***file_list, int *count)
 {
-	if (len < 2)
+	size_t found;
+	size_t max = options->robust || options->preflight ? SIZE_MAX : options->k;
+	struct bmp_handle **shadows = strlen(options->bundle) != 0 ?
+		bundle_open(options->bundle, max, &found, !options->preflight) :
+		loader_open_archive(options->tar, max, &found);
+	if (shadows == NULL)
 	{
-		return -1;
+		return NULL;
 	}
 
-	struct bmp_header *header = bmp_get_header(bmp_list[0]);
+	if (found < options->k)
+	{
+		printe("Error: the %s must contain at least K = %d shadows.\n", strlen(options->bundle) != 0 ? "bundle" :
+			"archive", options->k);
+		goto free_shadows;
+	}
+
+	*file_list = malloc(found * sizeof(char*));
+	if (*file_list == NULL)
+	{
+		goto free_shadows;
+	}
+
+	int i;
+	for (i = 0; i < found; i++)
+	{
+		(*file_list)[i] = (char*)bmp_get_filename(shadows[i]);
+	}
+
+	*count = found;
+	return shadows;
+
+	// Error handling
+free_shadows:
+	bmp_free_list(shadows, found);
+	free(shadows);
+
+	return NULL;
+}
+
+int check_bmp_sizes(struct bmp_handle **bmp_list, size_t len)
+{
+	if (len < 1)
+	{
+		return -1;
+	}
+
+	struct bmp_header *header = bmp_get_header(bmp_list[0]);
 	bmp_dword_t first_width = header->width;
 	bmp_dword_t first_height = header->height;
 
@@ -396,28 +962,29 @@ int check_bmp_sizes(struct bmp_handle **bmp_list, size_t len)
 	return 0;
 }
 
-int check_shadow_sizes(struct bmp_handle *secret, struct bmp_handle **shadows, size_t len, int k)
+int check_shadow_sizes(struct bmp_handle *secret, struct bmp_handle **shadows, size_t len, int k, int depth)
 {
 	struct bmp_header *secret_header = bmp_get_header(secret);
 
-	int padding = padding_for_width(secret_header->width);
-	size_t real_byte_count = (secret_header->width + padding) * secret_header->height;
+	size_t real_byte_count = bmp_data_size(secret);
 
-	size_t shadow_size = shadow_size_for(real_byte_count, k);
+	size_t shadow_size = shadow_size_for(real_byte_count, k, depth);
 	int i;
 
 	for (i = 0; i < len; i++)
 	{
 		struct bmp_header *header = bmp_get_header(shadows[i]);
-		int shadow_padding = padding_for_width(header->width);
-		size_t shadow_real_byte_count = (header->width + shadow_padding) * header->height;
+		size_t shadow_real_byte_count = bmp_data_size(shadows[i]);
 
-		if (shadow_real_byte_count != shadow_size)
+		// Covers must have the exact size given by the assignment, but other depths may need a
+		// size that is not a multiple of 4 (row alignment), so any large enough cover is accepted
+		if (shadow_real_byte_count < shadow_size ||
+			(depth == lsb_default_depth(k) && shadow_real_byte_count != shadow_size))
 		{
 			return -1;
 		}
 
-		if (k == 8)
+		if (k == 8 && depth == 1 && header->bits_per_pixel == secret_header->bits_per_pixel)
 		{
 			if (header->width != secret_header->width || header->height != secret_header->height)
 			{
@@ -429,6 +996,432 @@ int check_shadow_sizes(struct bmp_handle *secret, struct bmp_handle **shadows, s
 	return 0;
 }
 
+// A shadow that spans several covers can only be recovered from all of them (--parts)
+int check_whole_shadows(struct bmp_handle **shadows, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[i]);
+		if (info != NULL && info->parts > 1)
+		{
+			printe("Error: %s is part %u of %u of a shadow, use --parts with one directory per participant.\n",
+				bmp_get_filename(shadows[i]), info->part + 1, info->parts);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int new_shadow_depth(struct cmd_options *options)
+{
+	return options->lsb_depth ? options->lsb_depth : lsb_default_depth(options->k);
+}
+
+/*
+ * The secret dimensions are taken from -w and -h, from the information stored in the shadows,
+ * or (for k = 8) from the shadows themselves, in that order.
+ */
+int secret_dimensions(struct cmd_options *options, struct bmp_handle *shadow, bmp_dword_t *width,
+	bmp_dword_t *height, bmp_word_t *bits_per_pixel)
+{
+	struct bmp_header *header = bmp_get_header(shadow);
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	int has_dimensions = info != NULL && info->secret_width != 0 && info->secret_height != 0;
+
+	*bits_per_pixel = header->bits_per_pixel;
+	if (info != NULL && (info->secret_bits_per_pixel == 8 || info->secret_bits_per_pixel == 24))
+	{
+		*bits_per_pixel = info->secret_bits_per_pixel;
+	}
+
+	if (options->secret_width != 0 && options->secret_height != 0)
+	{
+		*width = options->secret_width;
+		*height = options->secret_height;
+	}
+	else if (has_dimensions)
+	{
+		*width = info->secret_width;
+		*height = info->secret_height;
+	}
+	else if (options->k == 8)
+	{
+		*width = header->width;
+		*height = header->height;
+	}
+	else
+	{
+		printe("Error: invalid secret width/height specified (options -w and -h).\n");
+		return -1;
+	}
+
+	printv("Secret image:\n");
+	printv("-> Secret Width: %u\n", *width);
+	printv("-> Secret Height: %u\n", *height);
+	printv("-> Secret Bits per pixel: %u\n", *bits_per_pixel);
+
+	// The shadows must be large enough to hold the secret
+	int format = info != NULL ? info->secret_format : IMAGE_FORMAT_BMP;
+	size_t image_size = image_size_for_format(format, *width, *height, *bits_per_pixel);
+	if (image_size == 0)
+	{
+		printe("Error: invalid secret image dimensions.\n");
+		return -1;
+	}
+
+	size_t payload_size = recover_payload_size(image_size, shadow);
+	size_t shadow_size = shadow_size_for(payload_size, options->k, lsb_depth_of(shadow, options->k));
+	if (bmp_data_size(shadow) < shadow_size)
+	{
+		printe("Error: the shadows are too small for a %ux%u secret image.\n", *width, *height);
+		return -1;
+	}
+
+	return 0;
+}
+
+int add_participants(struct cmd_options *options, struct bmp_handle **covers, int count)
+{
+	int status = -1;
+
+	if (options->first_index + count - 1 > MAX_SHADOW_INDEX)
+	{
+		printe("Error: shadow indexes must not exceed %d.\n", MAX_SHADOW_INDEX);
+		return -1;
+	}
+
+	if (strlen(options->from_dir) == 0)
+	{
+		struct bmp_handle *secret = bmp_open_image(options->secret, options->secret_width, options->secret_height);
+		if (secret == NULL)
+		{
+			printe("Error: unable to open target image \"%s\".\n", options->secret);
+			return -1;
+		}
+
+		// The size of a compressed payload is only known once the secret has been compressed
+		int depth = new_shadow_depth(options);
+		if (options->codec == CODEC_NONE && check_shadow_sizes(secret, covers, count, options->k, depth))
+		{
+			printe("Error: one or more of the shadow images does not have the required size.\n");
+		}
+		else
+		{
+			status = participant_add_from_secret(secret, covers, count, options->first_index, options->k,
+				options->enable_permute, options->seed, depth, options->codec);
+		}
+
+		bmp_free(secret);
+		return status;
+	}
+
+	DIR *dp = opendir(options->from_dir);
+	if (dp == NULL)
+	{
+		printe("Error: unable to open the existing shadows directory.\n");
+		return -1;
+	}
+
+	int found = 0;
+	char **file_list = bmps_in_dir(dp, options->k, &found);
+	if (file_list == NULL)
+	{
+		printe("Error: unable to open the required K = %d existing shadows.\n", options->k);
+		goto free_dp;
+	}
+
+	struct bmp_handle **shadows = open_files(file_list, options->k, options->from_dir, TRUE);
+	if (shadows == NULL)
+	{
+		printe("Error: Unable to open the existing shadows.\n");
+		goto free_file_list;
+	}
+
+	struct bmp_header *first_header = bmp_get_header(shadows[0]);
+	struct bmp_header *cover_header = bmp_get_header(covers[0]);
+
+	if (check_bmp_sizes(shadows, options->k) || cover_header->width != first_header->width ||
+		cover_header->height != first_header->height)
+	{
+		printe("Error: the new covers must have the same width and height as the existing shadows.\n");
+		goto free_shadows;
+	}
+
+	int i;
+	for (i = 0; i < options->k; i++)
+	{
+		int index = bmp_get_header(shadows[i])->shadow_index;
+		if (index >= options->first_index && index < options->first_index + count)
+		{
+			printe("Error: shadow index %d is already in use.\n", index);
+			goto free_shadows;
+		}
+	}
+
+	bmp_dword_t width, height;
+	bmp_word_t bits_per_pixel;
+	if (secret_dimensions(options, shadows[0], &width, &height, &bits_per_pixel) != 0)
+	{
+		goto free_shadows;
+	}
+
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[0]);
+	int format = info != NULL ? info->secret_format : IMAGE_FORMAT_BMP;
+	size_t payload_size = recover_payload_size(image_size_for_format(format, width, height, bits_per_pixel),
+		shadows[0]);
+	status = participant_add_from_shadows(shadows, options->k, payload_size, covers, count, options->first_index);
+
+free_shadows:
+	bmp_free_list(shadows, options->k);
+	free(shadows);
+free_file_list:
+	free(file_list);
+free_dp:
+	closedir(dp);
+
+	return status;
+}
+
+int delta_distribute(struct cmd_options *options, struct bmp_handle *secret, struct bmp_handle **shadows)
+{
+	if (strlen(options->old_secret) == 0)
+	{
+		return delta_reshare(secret, NULL, shadows, options->n, options->k, options->enable_permute);
+	}
+
+	struct bmp_handle *old_secret = bmp_open_image(options->old_secret, options->secret_width,
+		options->secret_height);
+	if (old_secret == NULL)
+	{
+		printe("Error: unable to open previous secret image \"%s\".\n", options->old_secret);
+		return -1;
+	}
+
+	struct bmp_header *header = bmp_get_header(secret);
+	struct bmp_header *old_header = bmp_get_header(old_secret);
+	int status = -1;
+
+	if (header->width != old_header->width || header->height != old_header->height ||
+		bmp_data_size(secret) != bmp_data_size(old_secret))
+	{
+		printe("Error: the previous secret image must have the same width and height.\n");
+	}
+	else
+	{
+		status = delta_reshare(secret, old_secret, shadows, options->n, options->k, options->enable_permute);
+	}
+
+	bmp_free(old_secret);
+	return status;
+}
+
+int distribute_shadows(struct cmd_options *options, struct bmp_handle *secret, struct bmp_handle **covers,
+	int depth)
+{
+	if (strlen(options->tar) != 0 && writer_open_tar(options->tar) != 0)
+	{
+		printe("Error: unable to create archive \"%s\".\n", options->tar);
+		return -1;
+	}
+
+	writer_set_bundle(strlen(options->bundle) != 0 ? options->bundle : NULL);
+
+	int status;
+	if (secret != NULL)
+	{
+		status = distribute(secret, covers, options->n, options->k, options->enable_permute, depth, options->codec);
+	}
+	else
+	{
+		status = multi_distribute(options->secret, options->secret_width, options->secret_height, covers,
+			options->n, options->k, options->enable_permute, depth);
+	}
+
+	// The archive is removed if the shadows could not be written
+	if (writer_close_tar(status != 0) != 0)
+	{
+		status = -1;
+	}
+
+	writer_set_bundle(NULL);
+
+	return status;
+}
+
+int recover_multi(struct cmd_options *options, struct bmp_handle **shadows, int count)
+{
+	if (options->shards)
+	{
+		printe("Error: shadows that hold several secrets can not be recovered in shards.\n");
+		return -1;
+	}
+
+	return multi_recover(shadows, count, options->k, options->robust, options->enable_permute, options->secret,
+		strlen(options->extract) != 0 ? options->extract : NULL);
+}
+
+int secret_format_of(struct bmp_handle *shadow)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	return info != NULL ? info->secret_format : IMAGE_FORMAT_BMP;
+}
+
+// Size of the payload shared in the shadows, with the secret dimensions given by secret_dimensions()
+int shared_payload_size(struct cmd_options *options, struct bmp_handle *shadow, size_t *size)
+{
+	if (multi_has_secrets(shadow))
+	{
+		*size = recover_payload_size(0, shadow);
+		return 0;
+	}
+
+	bmp_dword_t width, height;
+	bmp_word_t bits_per_pixel;
+
+	if (secret_dimensions(options, shadow, &width, &height, &bits_per_pixel) != 0)
+	{
+		return -1;
+	}
+
+	*size = recover_payload_size(image_size_for_format(secret_format_of(shadow), width, height, bits_per_pixel),
+		shadow);
+	return 0;
+}
+
+/*
+ * Checks the shadows that the same command would recover from (all of them, even without
+ * --robust), for the payload given by the secret dimensions.
+ */
+int preflight(struct cmd_options *options, struct bmp_handle **shadows, int count)
+{
+	size_t size;
+	if (shared_payload_size(options, shadows[0], &size) != 0)
+	{
+		return -1;
+	}
+
+	return preflight_check(shadows, count, options->k, size);
+}
+
+int reshare_shadows(struct cmd_options *options, struct bmp_handle **covers, int count)
+{
+	int status = -1;
+
+	DIR *dp = opendir(options->from_dir);
+	if (dp == NULL)
+	{
+		printe("Error: unable to open the old shadows directory.\n");
+		return -1;
+	}
+
+	int found = 0;
+	char **file_list = options->parts ? participants_in_dir(dp, options->old_k, &found) :
+		bmps_in_dir(dp, options->old_k, &found);
+	if (file_list == NULL)
+	{
+		printe("Error: unable to open the required K = %d old shadows.\n", options->old_k);
+		goto free_dp;
+	}
+
+	// Only the cover bytes of the blocks being reshared are read
+	struct bmp_handle **shadows = options->parts ? span_open(options->from_dir, file_list, options->old_k, FALSE, TRUE) :
+		open_files(file_list, options->old_k, options->from_dir, FALSE);
+	if (shadows == NULL)
+	{
+		printe("Error: Unable to open the old shadows.\n");
+		goto free_file_list;
+	}
+
+	if (!options->parts && check_whole_shadows(shadows, options->old_k) != 0)
+	{
+		goto free_shadows;
+	}
+
+	// Without shadow information, the new shadows must use the default depth for the new K
+	if (bmp_get_shadow_info(shadows[0]) == NULL && options->lsb_depth)
+	{
+		printe("Error: the old shadows have no shadow information, --lsb can not be used.\n");
+		goto free_shadows;
+	}
+
+	struct cmd_options old_options = *options;
+	old_options.k = options->old_k;
+
+	size_t size;
+	if (shared_payload_size(&old_options, shadows[0], &size) == 0)
+	{
+		status = reshare(shadows, options->old_k, size, covers, count, options->k, new_shadow_depth(options));
+	}
+
+free_shadows:
+	bmp_free_list(shadows, options->old_k);
+	free(shadows);
+free_file_list:
+	free(file_list);
+free_dp:
+	closedir(dp);
+
+	return status;
+}
+
+int recover_shard(struct cmd_options *options, struct bmp_handle **shadows, bmp_dword_t width, bmp_dword_t height,
+	bmp_word_t bits_per_pixel)
+{
+	size_t image_size = image_size_for_format(secret_format_of(shadows[0]), width, height, bits_per_pixel);
+	size_t payload_size = recover_payload_size(image_size, shadows[0]);
+
+	if (shard_recover(shadows, options->k, payload_size, options->secret, options->shard, options->shards) != 0)
+	{
+		return -1;
+	}
+
+	printv("Successfully recovered shard %d of %d to %s%s%d.\n", options->shard, options->shards, options->secret,
+		SHARD_SUFFIX, options->shard);
+	return 0;
+}
+
+/*
+ * Without a secret, the segments of every cover in the directory are written into it. With a
+ * secret, its payload segments are assembled, using the first shadow for the secret information.
+ */
+int merge_segments(struct cmd_options *options, struct bmp_handle **bmp_list, char **file_list, int count)
+{
+	if (strlen(options->secret) == 0)
+	{
+		return shard_merge_shadows(bmp_list, options->dir, file_list, count);
+	}
+
+	bmp_dword_t width, height;
+	bmp_word_t bits_per_pixel;
+
+	if (secret_dimensions(options, bmp_list[0], &width, &height, &bits_per_pixel) != 0)
+	{
+		return -1;
+	}
+
+	int format = secret_format_of(bmp_list[0]);
+	if (image_format_for(options->secret) != format)
+	{
+		printe("Error: the secret was distributed as a %s image, it must be recovered to the same format.\n",
+			image_format_name(format));
+		return -1;
+	}
+
+	struct bmp_handle *secret = bmp_create_image(options->secret, bmp_list[0], width, height, bits_per_pixel);
+	if (secret == NULL)
+	{
+		printe("Error: unable to create secret image.\n");
+		return -1;
+	}
+
+	int status = shard_merge_secret(secret, bmp_list[0], options->secret, options->enable_permute);
+	bmp_free(secret);
+
+	return status;
+}
+
 int main(int argc, char *argv[])
 {
 	struct cmd_options options;
@@ -448,35 +1441,85 @@ int main(int argc, char *argv[])
 	printv("==== TP CRIPTO 2015 ====\n");
 	print_args_info(&options);
 
-	DIR *dp = opendir(options.dir);
-	if (dp == NULL)
+	if (options.mode == TUNE_MODE)
+	{
+		return tune_run(options.dir) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (tune_load_profile() != 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (resume_mode && checkpoint_interval == 0)
+	{
+		checkpoint_interval = CHECKPOINT_DEFAULT_INTERVAL;
+	}
+
+	// Checkpoints are taken between chunks, which must end on whole cover bytes
+	payload_chunk_blocks = checkpoint_chunk_blocks(payload_chunk_blocks);
+
+	// Shadows recovered from an archive or a bundle do not need the directory
+	int from_archive = options.mode == RECOVER_MODE && (strlen(options.tar) != 0 || strlen(options.bundle) != 0);
+	DIR *dp = NULL;
+
+	if (!from_archive && (dp = opendir(options.dir)) == NULL)
 	{
 		printe("Error: unable to open specified directory.\n");
 		return EXIT_FAILURE;
 	}
 
 	char **file_list = NULL;
+	struct bmp_handle **bmp_list = NULL;
 	int found = 0, to_open = 0;
 
-	if (options.mode == RECOVER_MODE)
+	if (from_archive)
 	{
-		file_list = bmps_in_dir(dp, options.k, &found);
+		bmp_list = open_archive(&options, &file_list, &to_open);
+		if (bmp_list == NULL)
+		{
+			goto free_dp;
+		}
+	}
+	else if (options.mode == RECOVER_MODE)
+	{
+		file_list = options.parts ? participants_in_dir(dp, options.k, &found) : bmps_in_dir(dp, options.k, &found);
 		if (file_list == NULL)
 		{
-			printe("Error: unable to open the required K = %d files.\n", options.k);
+			printe("Error: unable to open the required K = %d %s.\n", options.k, options.parts ?
+				"participant directories" : "files");
 			goto free_dp;
 		}
 
-		if (found > options.k)
+		if (options.robust || options.preflight)
 		{
-			printv("WARNING: more than K = %d files were found, using K first files.\n", options.k);
+			printv("Using all %d files found for %s.\n", found, options.robust ? "error correction" : "the checks");
+			to_open = found;
 		}
+		else
+		{
+			if (found > options.k)
+			{
+				printv("WARNING: more than K = %d files were found, using K first files.\n", options.k);
+			}
 
-		to_open = options.k;
+			to_open = options.k;
+		}
 	}
-	else // options.mode == DISTRIBUTE_MODE
+	else if (options.mode == MERGE_MODE)
+	{
+		file_list = bmps_in_dir(dp, 0, &found);
+		if (file_list == NULL)
+		{
+			printe("Error: no .bmp files were found in the specified directory.\n");
+			goto free_dp;
+		}
+
+		to_open = strlen(options.secret) != 0 ? 1 : found;
+	}
+	else // options.mode == DISTRIBUTE_MODE || options.mode == ADD_MODE || options.mode == RESHARE_MODE
 	{
-		file_list = bmps_in_dir(dp, options.n, &found);
+		file_list = options.parts ? participants_in_dir(dp, options.n, &found) : bmps_in_dir(dp, options.n, &found);
 		if (file_list == NULL)
 		{
 			printe("Error: unable to open the required files (bmps_in_dir).\n");
@@ -497,20 +1540,43 @@ int main(int argc, char *argv[])
 		to_open = options.n;
 	}
 
-	if (options.mode == DISTRIBUTE_MODE && options.k > options.n)
+	if ((options.mode == DISTRIBUTE_MODE || options.mode == RESHARE_MODE) && options.k > options.n)
 	{
 		printe("Error: K must be equal or less than N.\n");
 		goto free_file_list;
 	}
 
-	struct bmp_handle **bmp_list = open_files(file_list, to_open, options.dir);
-	if (bmp_list == NULL)
+	// Indexes are x values in GF(251), so N taken from the directory is bounded too (-a checks its own)
+	if ((options.mode == DISTRIBUTE_MODE || options.mode == RESHARE_MODE) && options.n > MAX_SHADOW_INDEX)
+	{
+		printe("Error: at most %d shadows can be created, %d covers were found (use -n).\n", MAX_SHADOW_INDEX,
+			options.n);
+		goto free_file_list;
+	}
+
+	// Segments and delta updates only touch part of the pixel data, which is read as needed
+	int load_pixels = !options.delta && !options.shards && options.mode != MERGE_MODE && !options.preflight;
+	if (bmp_list == NULL && options.parts)
+	{
+		bmp_list = span_open(options.dir, file_list, to_open, load_pixels, options.mode == RECOVER_MODE);
+		if (bmp_list == NULL)
+		{
+			goto free_file_list;
+		}
+	}
+	else if (bmp_list == NULL && (bmp_list = open_files(file_list, to_open, options.dir, load_pixels)) == NULL)
 	{
 		printe("Error: Unable to open the required files (open_files).\n");
 		goto free_file_list;
 	}
 
-	if (check_bmp_sizes(bmp_list, to_open))
+	if (options.mode == RECOVER_MODE && !options.parts && check_whole_shadows(bmp_list, to_open) != 0)
+	{
+		goto free_bmp_list;
+	}
+
+	// The covers of each participant may add up to any size
+	if (!options.parts && check_bmp_sizes(bmp_list, to_open))
 	{
 		printe("Error: all images must have the same width and height.\n");
 		goto free_bmp_list;
@@ -521,51 +1587,145 @@ int main(int argc, char *argv[])
 		print_bmps_info(bmp_list, file_list, to_open, options.mode);
 	}
 
-	if (options.mode == RECOVER_MODE)
+	if (options.preflight)
+	{
+		if (preflight(&options, bmp_list, to_open) != 0)
+		{
+			printe("Error: the shadows can not recover the secret, see above.\n");
+			goto free_bmp_list;
+		}
+	}
+	else if (options.mode == RECOVER_MODE && multi_has_secrets(bmp_list[0]))
 	{
-		struct bmp_header *first_header = bmp_get_header(bmp_list[0]);
-		struct bmp_handle *secret = NULL;
+		if (checkpoint_interval)
+		{
+			printv("Info: no checkpoints are kept when recovering several secrets.\n");
+		}
 
-		printv("Secret image:\n");
+		if (recover_multi(&options, bmp_list, options.robust ? to_open : options.k) != 0)
+		{
+			printe("Error: An error occurred when recuperating the secret images.\n");
+			goto free_bmp_list;
+		}
 
-		if (options.k == 8)
+		printv("Successfully recovered the secret images to: %s.\n", options.secret);
+	}
+	else if (options.mode == RECOVER_MODE)
+	{
+		bmp_dword_t width, height;
+
+		if (strlen(options.extract) != 0)
+		{
+			printe("Error: the shadows hold a single secret, --extract can not be used.\n");
+			goto free_bmp_list;
+		}
+
+		bmp_word_t bits_per_pixel;
+
+		if (secret_dimensions(&options, bmp_list[0], &width, &height, &bits_per_pixel) != 0)
+		{
+			goto free_bmp_list;
+		}
+
+		// The recovered pixels have the layout of the distributed secret, so the format can not change
+		int format = secret_format_of(bmp_list[0]);
+		if (image_format_for(options.secret) != format)
 		{
-			printv("-> Secret Width: %d\n", first_header->width);
-			printv("-> Secret Height: %d\n", first_header->height);
-			secret = bmp_create(options.secret, bmp_list[0], first_header->width, first_header->height);
+			printe("Error: the secret was distributed as a %s image, it must be recovered to the same format.\n",
+				image_format_name(format));
+			goto free_bmp_list;
+		}
+
+		if (options.shards)
+		{
+			if (recover_shard(&options, bmp_list, width, height, bits_per_pixel) != 0)
+			{
+				printe("Error: An error occurred when recuperating the secret image.\n");
+				goto free_bmp_list;
+			}
 		}
 		else
 		{
-			if (options.secret_height == 0 || options.secret_width == 0)
+			struct bmp_handle *secret = bmp_create_image(options.secret, bmp_list[0], width, height, bits_per_pixel);
+
+			if (secret == NULL)
+			{
+				printe("Error: unable to create secret image.\n");
+				goto free_bmp_list;
+			}
+
+			int status;
+			if (options.robust)
+			{
+				status = robust_recover(secret, bmp_list, to_open, options.k, options.enable_permute);
+			}
+			else
+			{
+				status = recover(secret, bmp_list, options.k, options.enable_permute);
+			}
+
+			// Only a fully recovered secret is written to stdout
+			if (status == 0 && bmp_flush_output(secret) != 0)
+			{
+				bmp_free(secret);
+				status = -1;
+			}
+
+			if (status != 0)
 			{
-				printe("Error: invalid secret width/height specified (options -w and -h).\n");
+				printe("Error: An error occurred when recuperating the secret image.\n");
 				goto free_bmp_list;
 			}
 
-			printv("-> Secret Width: %d\n", options.secret_width);
-			printv("-> Secret Height: %d\n", options.secret_height);
-			secret = bmp_create(options.secret, bmp_list[0], options.secret_width, options.secret_height);
+			printv("Successfully recovered secret image to file: %s.\n", options.secret);
+			bmp_free(secret);
+		}
+	}
+	else if (options.mode == ADD_MODE)
+	{
+		if (add_participants(&options, bmp_list, to_open) != 0)
+		{
+			printe("Error: unable to add the new shadows.\n");
+			goto free_bmp_list;
 		}
 
-		if (secret == NULL)
+		printv("Successfully added %d shadows starting at index %d.\n", to_open, options.first_index);
+	}
+	else if (options.mode == RESHARE_MODE)
+	{
+		if (reshare_shadows(&options, bmp_list, to_open) != 0)
 		{
-			printe("Error: unable to create secret image.\n");
+			printe("Error: unable to reshare the shadows.\n");
 			goto free_bmp_list;
 		}
 
-		int status = recover(secret, bmp_list, options.k, options.enable_permute);
-		if (status != 0)
+		printv("Successfully reshared the shadows in %s to (K=%d, N=%d) shadows.\n", options.from_dir, options.k,
+			options.n);
+	}
+	else if (options.mode == MERGE_MODE)
+	{
+		if (merge_segments(&options, bmp_list, file_list, to_open) != 0)
 		{
-			printe("Error: An error occurred when recuperating the secret image.\n");
+			printe("Error: unable to merge the segments.\n");
 			goto free_bmp_list;
 		}
 
-		printv("Successfully recovered secret image to file: %s.\n", options.secret);
-		bmp_free(secret);
+		printv("Successfully merged the segments in %s.\n", options.dir);
+	}
+	else if (strchr(options.secret, MULTI_SEPARATOR) != NULL) // options.mode == DISTRIBUTE_MODE
+	{
+		if (distribute_shadows(&options, NULL, bmp_list, new_shadow_depth(&options)) != 0)
+		{
+			printe("Error: unable to distribute the secret images.\n");
+			goto free_bmp_list;
+		}
+
+		printv("Successfully distributed secret images %s to (K=%d, N=%d) shadows.\n", options.secret, options.k,
+			options.n);
 	}
 	else // options.mode == DISTRIBUTE_MODE
 	{
-		struct bmp_handle *secret = bmp_open(options.secret);
+		struct bmp_handle *secret = bmp_open_image(options.secret, options.secret_width, options.secret_height);
 		if (secret == NULL)
 		{
 			printe("Error: unable to open target image \"%s\" to distribute.\n", options.secret);
@@ -574,14 +1734,33 @@ int main(int argc, char *argv[])
 
 		printv("Opened secret image %s.\n", options.secret);
 
-		if (check_shadow_sizes(secret, bmp_list, to_open, options.k))
+		int depth = options.delta ? lsb_depth_of(bmp_list[0], options.k) : new_shadow_depth(&options);
+		printv("-> LSB depth: %d\n", depth);
+
+		if (options.codec == CODEC_NONE && !options.parts &&
+			check_shadow_sizes(secret, bmp_list, to_open, options.k, depth))
 		{
 			printe("Error: one or more of the shadow images does not have the required size.\n");
 			bmp_free(secret);
 			goto free_bmp_list;
 		}
 
-		int status = distribute(secret, bmp_list, options.n, options.k, options.enable_permute);
+		int status;
+		if (options.delta)
+		{
+			status = delta_distribute(&options, secret, bmp_list);
+		}
+		else if (options.shards)
+		{
+			bmp_word_t seed = options.seed < 0 ? 0 : options.seed;
+			status = shard_distribute(secret, bmp_list, options.dir, file_list, options.n, options.k,
+				options.enable_permute, depth, seed, options.shard, options.shards);
+		}
+		else
+		{
+			status = distribute_shadows(&options, secret, bmp_list, depth);
+		}
+
 		if (status != 0)
 		{
 			printe("Error: unable to distribute target image.\n");
@@ -595,8 +1774,14 @@ int main(int argc, char *argv[])
 	}
 
 	bmp_free_list(bmp_list, to_open);
+	free(bmp_list);
 	free(file_list);
-	closedir(dp);
+	if (dp != NULL)
+	{
+		closedir(dp);
+	}
+
+	printv("Peak memory used by image buffers and scratch: %lu KB\n", (unsigned long)(arena_peak_usage() / 1024));
 
 	return EXIT_SUCCESS;
 
@@ -604,11 +1789,15 @@ int main(int argc, char *argv[])
 
 free_bmp_list:
 	bmp_free_list(bmp_list, to_open);
+	free(bmp_list);
 
 free_file_list:
 	free(file_list);
 free_dp:
-	closedir(dp);
+	if (dp != NULL)
+	{
+		closedir(dp);
+	}
 
 	return EXIT_FAILURE;
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "memo.h"
+#include "arena.h"
+#include "checksum.h"
+#include "utils.h"
+#include <string.h>
+
+struct memo {
+	size_t key_len;
+	size_t value_len;
+	size_t entry_size; // valid flag, key and value
+	size_t mask;
+	bmp_byte_t *entries;
+	size_t lookups;
+	size_t hits;
+};
+
+bmp_byte_t *memo_entry(struct memo *memo, const bmp_byte_t *key);
+
+struct memo *memo_create(size_t key_len, size_t value_len, size_t entries)
+{
+	struct memo *memo = malloc(sizeof(struct memo));
+	if (memo == NULL)
+	{
+		return NULL;
+	}
+
+	memo->key_len = key_len;
+	memo->value_len = value_len;
+	memo->entry_size = 1 + key_len + value_len;
+	memo->mask = entries - 1;
+	memo->lookups = 0;
+	memo->hits = 0;
+
+	// Zero-filled, so every entry starts out invalid
+	memo->entries = arena_alloc_buffer(entries * memo->entry_size);
+	if (memo->entries == NULL)
+	{
+		free(memo);
+		return NULL;
+	}
+
+	return memo;
+}
+
+void memo_destroy(struct memo *memo)
+{
+	if (memo == NULL)
+	{
+		return;
+	}
+
+	arena_free_buffer(memo->entries);
+	free(memo);
+}
+
+const bmp_byte_t *memo_lookup(struct memo *memo, const bmp_byte_t *key)
+{
+	bmp_byte_t *entry = memo_entry(memo, key);
+	memo->lookups++;
+
+	if (!entry[0] || memcmp(&entry[1], key, memo->key_len) != 0)
+	{
+		return NULL;
+	}
+
+	memo->hits++;
+	return &entry[1 + memo->key_len];
+}
+
+bmp_byte_t *memo_insert(struct memo *memo, const bmp_byte_t *key)
+{
+	bmp_byte_t *entry = memo_entry(memo, key);
+	entry[0] = 1;
+	memcpy(&entry[1], key, memo->key_len);
+
+	return &entry[1 + memo->key_len];
+}
+
+void memo_report(struct memo *memo, const char *name)
+{
+	if (memo == NULL || memo->lookups == 0)
+	{
+		return;
+	}
+
+	printv("%s cache: %lu hits in %lu blocks (%.1f%%)\n", name, (unsigned long)memo->hits,
+		(unsigned long)memo->lookups, 100.0 * memo->hits / memo->lookups);
+}
+
+bmp_byte_t *memo_entry(struct memo *memo, const bmp_byte_t *key)
+{
+	size_t slot = checksum_crc32c(CHECKSUM_INIT, key, memo->key_len) & memo->mask;
+	return &memo->entries[slot * memo->entry_size];
+}
@@ -0,0 +1,26 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "bmp.h"
+
+#define MEMO_ENTRIES 4096 // must be a power of 2
+
+/*
+ * Direct-mapped cache of block results, keyed on key_len bytes (the k bytes of a block, or the
+ * k shadow bytes extracted for it). A new entry simply replaces the one in its slot.
+ */
+struct memo;
+struct memo *memo_create(size_t key_len, size_t value_len, size_t entries);
+void memo_destroy(struct memo *memo);
+
+// Returns the stored value, or NULL on a miss
+const bmp_byte_t *memo_lookup(struct memo *memo, const bmp_byte_t *key);
+
+// Stores key and returns the space where its value must be written
+bmp_byte_t *memo_insert(struct memo *memo, const bmp_byte_t *key);
+
+// Prints the hit rate when in verbose mode
+void memo_report(struct memo *memo, const char *name);
+
+#endif
+/* MEMO_H */
@@ -0,0 +1,416 @@
+#include "multi.h"
+#include "distribute.h"
+#include "recover.h"
+#include "robust.h"
+#include "checksum.h"
+#include "compress.h"
+#include "image.h"
+#include "arena.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define MULTI_TOC_MAGIC 0x544D5243 // "CRMT"
+#define MULTI_NIBBLE 0x0F
+
+#pragma pack(push, 1)
+
+// Table of contents at the start of the payload, followed by count entries
+struct multi_toc {
+	bmp_dword_t magic; // MULTI_TOC_MAGIC
+	bmp_word_t count;
+};
+
+struct multi_entry {
+	char name[MULTI_NAME_LEN]; // file name of the secret, without its directory
+	bmp_dword_t width;
+	bmp_dword_t height;
+	bmp_word_t bits_per_pixel;
+	bmp_word_t format; // IMAGE_FORMAT_*
+	uint64_t offset; // of the pixels in the payload
+	uint64_t size;
+};
+
+#pragma pack(pop)
+
+size_t multi_toc_size(size_t count);
+void multi_encode(const void *in, size_t len, bmp_byte_t *out);
+int multi_decode(const bmp_byte_t *in, size_t len, void *out);
+int multi_add_entry(struct multi_entry *entries, size_t index, struct bmp_handle *secret, const char *filename,
+	uint64_t offset);
+struct multi_entry *multi_read_toc(const bmp_byte_t *payload, size_t size, size_t *count);
+int multi_write_secret(const char *path, struct bmp_handle *shadow, struct multi_entry *entry,
+	const bmp_byte_t *payload);
+
+int multi_distribute(const char *list, bmp_dword_t width, bmp_dword_t height, struct bmp_handle **shadows,
+	size_t n, size_t k, int permute, int depth)
+{
+	struct bmp_handle *secrets[MULTI_MAX_SECRETS];
+	struct multi_entry entries[MULTI_MAX_SECRETS];
+	size_t count = 0, i;
+	int status = -1;
+
+	char *names = strdup(list);
+	if (names == NULL)
+	{
+		return -1;
+	}
+
+	char separator[] = { MULTI_SEPARATOR, 0 };
+	char *saveptr;
+	char *filename = strtok_r(names, separator, &saveptr);
+	uint64_t offset = 0;
+
+	while (filename != NULL)
+	{
+		if (count == MULTI_MAX_SECRETS)
+		{
+			printe("Error: at most %d secrets can be shared together.\n", MULTI_MAX_SECRETS);
+			goto free_secrets;
+		}
+
+		// Each secret is named after its file, so stdin can not be one of them
+		if (strcmp(filename, BMP_STDIO_NAME) == 0)
+		{
+			printe("Error: secrets shared together must be read from files.\n");
+			goto free_secrets;
+		}
+
+		secrets[count] = bmp_open_image(filename, width, height);
+		if (secrets[count] == NULL)
+		{
+			printe("Error: unable to open target image \"%s\" to distribute.\n", filename);
+			goto free_secrets;
+		}
+
+		count++;
+		if (multi_add_entry(entries, count - 1, secrets[count - 1], filename, offset) != 0)
+		{
+			goto free_secrets;
+		}
+
+		offset += entries[count - 1].size;
+		filename = strtok_r(NULL, separator, &saveptr);
+	}
+
+	if (count == 0)
+	{
+		printe("Error: no secret images were given.\n");
+		goto free_secrets;
+	}
+
+	// The offsets are only known once every secret has been opened
+	size_t toc_size = multi_toc_size(count);
+	for (i = 0; i < count; i++)
+	{
+		entries[i].offset += toc_size;
+	}
+
+	size_t size = toc_size + offset;
+	bmp_byte_t *payload = arena_alloc_buffer(size * sizeof(bmp_byte_t));
+	if (payload == NULL)
+	{
+		goto free_secrets;
+	}
+
+	struct multi_toc toc = { MULTI_TOC_MAGIC, count };
+	multi_encode(&toc, sizeof(toc), payload);
+	multi_encode(entries, count * sizeof(struct multi_entry), &payload[2 * sizeof(toc)]);
+
+	// Every secret is truncated as it is copied, and released right away
+	for (i = 0; i < count; i++)
+	{
+		memcpy(&payload[entries[i].offset], bmp_get_pixels(secrets[i]), entries[i].size);
+		distribute_truncate_image(&payload[entries[i].offset], entries[i].size);
+
+		bmp_free(secrets[i]);
+		secrets[i] = NULL;
+	}
+
+	struct bmp_shadow_info info;
+	memset(&info, 0, sizeof(info));
+	info.flags = BMP_SHADOW_CHECKSUM;
+	info.checksum = checksum_crc32c(CHECKSUM_INIT, payload, size);
+	info.lsb_depth = depth;
+	info.k = k;
+	info.codec = CODEC_MULTI;
+	bmp_set_shadow_payload_size(&info, size);
+	info.secret_format = IMAGE_FORMAT_BMP;
+
+	printv("Info: %lu secrets shared in a payload of %lu bytes.\n", (unsigned long)count, (unsigned long)size);
+
+	status = distribute_packed(payload, size, shadows, n, k, permute, depth, &info);
+	arena_free_buffer(payload);
+
+free_secrets:
+	for (i = 0; i < count; i++)
+	{
+		bmp_free(secrets[i]);
+	}
+
+	free(names);
+	return status;
+}
+
+int multi_add_entry(struct multi_entry *entries, size_t index, struct bmp_handle *secret, const char *filename,
+	uint64_t offset)
+{
+	struct multi_entry *entry = &entries[index];
+	struct bmp_header *header = bmp_get_header(secret);
+	const char *slash = strrchr(filename, '/');
+	const char *name = slash != NULL ? slash + 1 : filename;
+
+	if (strlen(name) == 0 || strlen(name) >= MULTI_NAME_LEN)
+	{
+		printe("Error: the names of the secrets must have between 1 and %d characters.\n", MULTI_NAME_LEN - 1);
+		return -1;
+	}
+
+	size_t i;
+	for (i = 0; i < index; i++)
+	{
+		if (strcmp(entries[i].name, name) == 0)
+		{
+			printe("Error: two secrets are called \"%s\".\n", name);
+			return -1;
+		}
+	}
+
+	memset(entry, 0, sizeof(struct multi_entry));
+	strcpy(entry->name, name);
+	entry->width = header->width;
+	entry->height = header->height;
+	entry->bits_per_pixel = header->bits_per_pixel;
+	entry->format = bmp_get_format(secret);
+	entry->offset = offset;
+	entry->size = bmp_data_size(secret);
+
+	return 0;
+}
+
+int multi_has_secrets(struct bmp_handle *shadow)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	return info != NULL && info->codec == CODEC_MULTI;
+}
+
+int multi_recover(struct bmp_handle **shadows, size_t m, size_t k, int robust, int permute, const char *dest,
+	const char *name)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[0]);
+	size_t size = bmp_shadow_payload_size(info);
+	int status = -1;
+
+	if (name == NULL && strcmp(dest, BMP_STDIO_NAME) == 0)
+	{
+		printe("Error: only one secret (--extract) can be written to stdout.\n");
+		return -1;
+	}
+
+	bmp_byte_t *payload = size != 0 ? arena_alloc_buffer(size * sizeof(bmp_byte_t)) : NULL;
+	if (payload == NULL)
+	{
+		return -1;
+	}
+
+	// The whole payload is recovered in one sweep, whatever is extracted from it
+	if (robust)
+	{
+		status = robust_recover_payload(payload, size, shadows, m, k);
+	}
+	else
+	{
+		status = recover_payload(payload, size, shadows, k, NULL);
+	}
+
+	if (status != 0 || utils_unshuffle(payload, size, bmp_get_header(shadows[0])->seed, permute) != 0)
+	{
+		status = -1;
+		goto free_payload;
+	}
+
+	status = -1;
+
+	if (checksum_crc32c(CHECKSUM_INIT, payload, size) != info->checksum)
+	{
+		printe("Error: integrity check failed, the recovered payload is not the distributed secrets.\n");
+		goto free_payload;
+	}
+
+	size_t count, i;
+	struct multi_entry *entries = multi_read_toc(payload, size, &count);
+	if (entries == NULL)
+	{
+		printe("Error: the table of contents of the secrets is invalid.\n");
+		goto free_payload;
+	}
+
+	if (name != NULL)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (strcmp(entries[i].name, name) == 0)
+			{
+				break;
+			}
+		}
+
+		if (i == count)
+		{
+			printe("Error: there is no secret called \"%s\" in the shadows. They hold:\n", name);
+			for (i = 0; i < count; i++)
+			{
+				printe("-> %s\n", entries[i].name);
+			}
+		}
+		else
+		{
+			status = multi_write_secret(dest, shadows[0], &entries[i], payload);
+		}
+	}
+	else if (mkdir(dest, 0777) != 0 && errno != EEXIST)
+	{
+		printe("Error: unable to create directory \"%s\".\n", dest);
+	}
+	else
+	{
+		char path[FILENAME_MAX];
+		status = 0;
+
+		for (i = 0; i < count && status == 0; i++)
+		{
+			if (snprintf(path, sizeof(path), "%s/%s", dest, entries[i].name) >= sizeof(path))
+			{
+				status = -1;
+				break;
+			}
+
+			status = multi_write_secret(path, shadows[0], &entries[i], payload);
+		}
+	}
+
+	free(entries);
+
+free_payload:
+	arena_free_buffer(payload);
+	return status;
+}
+
+int multi_write_secret(const char *path, struct bmp_handle *shadow, struct multi_entry *entry,
+	const bmp_byte_t *payload)
+{
+	if (image_format_for(path) != entry->format)
+	{
+		printe("Error: \"%s\" was distributed as a %s image, it must be recovered to the same format.\n",
+			entry->name, image_format_name(entry->format));
+		return -1;
+	}
+
+	struct bmp_handle *secret = bmp_create_image(path, shadow, entry->width, entry->height, entry->bits_per_pixel);
+	if (secret == NULL)
+	{
+		printe("Error: unable to create secret image \"%s\".\n", path);
+		return -1;
+	}
+
+	int status = bmp_write_range(secret, 0, (bmp_byte_t*)&payload[entry->offset], entry->size);
+	if (status == 0)
+	{
+		status = bmp_flush_output(secret);
+	}
+
+	if (status == 0)
+	{
+		printv("Recovered secret \"%s\" [%ux%u] to %s.\n", entry->name, entry->width, entry->height, path);
+	}
+
+	bmp_free(secret);
+	return status;
+}
+
+struct multi_entry *multi_read_toc(const bmp_byte_t *payload, size_t size, size_t *count)
+{
+	struct multi_toc toc;
+	if (size < multi_toc_size(0) || multi_decode(payload, sizeof(toc), &toc) != 0 || toc.magic != MULTI_TOC_MAGIC ||
+		toc.count == 0 || toc.count > MULTI_MAX_SECRETS || size < multi_toc_size(toc.count))
+	{
+		return NULL;
+	}
+
+	struct multi_entry *entries = malloc(toc.count * sizeof(struct multi_entry));
+	if (entries == NULL)
+	{
+		return NULL;
+	}
+
+	if (multi_decode(&payload[2 * sizeof(toc)], toc.count * sizeof(struct multi_entry), entries) != 0)
+	{
+		goto free_entries;
+	}
+
+	size_t i;
+	for (i = 0; i < toc.count; i++)
+	{
+		struct multi_entry *entry = &entries[i];
+		entry->name[MULTI_NAME_LEN - 1] = 0;
+
+		// Names are written into a directory, so they must not lead out of it
+		if (entry->name[0] == 0 || strchr(entry->name, '/') != NULL || strcmp(entry->name, ".") == 0 ||
+			strcmp(entry->name, "..") == 0)
+		{
+			goto free_entries;
+		}
+
+		if (entry->offset > size || entry->size > size - entry->offset || entry->size !=
+			image_size_for_format(entry->format, entry->width, entry->height, entry->bits_per_pixel))
+		{
+			goto free_entries;
+		}
+	}
+
+	*count = toc.count;
+	return entries;
+
+	// Error handling
+free_entries:
+	free(entries);
+	return NULL;
+}
+
+size_t multi_toc_size(size_t count)
+{
+	return 2 * (sizeof(struct multi_toc) + count * sizeof(struct multi_entry));
+}
+
+// Each byte of the table is stored as two values below 16, which GF(251) can hold
+void multi_encode(const void *in, size_t len, bmp_byte_t *out)
+{
+	const bmp_byte_t *bytes = in;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		out[2 * i] = bytes[i] >> 4;
+		out[2 * i + 1] = bytes[i] & MULTI_NIBBLE;
+	}
+}
+
+int multi_decode(const bmp_byte_t *in, size_t len, void *out)
+{
+	bmp_byte_t *bytes = out;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (in[2 * i] > MULTI_NIBBLE || in[2 * i + 1] > MULTI_NIBBLE)
+		{
+			return -1;
+		}
+
+		bytes[i] = (in[2 * i] << 4) | in[2 * i + 1];
+	}
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef MULTI_H
+#define MULTI_H
+
+#include "bmp.h"
+
+#define MULTI_SEPARATOR ',' // between the secrets given to -secret
+#define MULTI_MAX_SECRETS 64
+#define MULTI_NAME_LEN 64 // including the terminating 0
+
+/*
+ * Several secrets shared in one payload: a table of contents with the name, dimensions and
+ * position of each secret, followed by their truncated pixels. The table is shared too, so the
+ * names are as secret as the images. The shadows are marked with CODEC_MULTI.
+ */
+
+// Shares the secrets in list (separated by MULTI_SEPARATOR) into one set of n covers
+int multi_distribute(const char *list, bmp_dword_t width, bmp_dword_t height, struct bmp_handle **shadows,
+	size_t n, size_t k, int permute, int depth);
+
+// Whether the shadows hold several secrets
+int multi_has_secrets(struct bmp_handle *shadow);
+
+/*
+ * Recovers the payload from m shadows (decoding errors if robust is set) and writes the secret
+ * called name to dest, or every secret into the directory dest if name is NULL.
+ */
+int multi_recover(struct bmp_handle **shadows, size_t m, size_t k, int robust, int permute, const char *dest,
+	const char *name);
+
+#endif
+/* MULTI_H */
@@ -0,0 +1,183 @@
+#include "ntt.h"
+#include <string.h>
+#include <pthread.h>
+
+static const int ntt_radices[] = { 2, 5, 5, 5 };
+
+static bmp_byte_t ntt_powers[NTT_SIZE]; // g^e
+static bmp_byte_t ntt_logs[NTT_SIZE + 1]; // e such that g^e = x, for x != 0
+static pthread_once_t ntt_once = PTHREAD_ONCE_INIT;
+static size_t ntt_crossover = NTT_DEFAULT_CROSSOVER;
+
+void ntt_init_tables();
+void ntt_transform(const uint32_t *in, size_t first, size_t stride, size_t n, int level, size_t k, uint32_t *out);
+
+int ntt_evaluate_blocks(const bmp_byte_t *payload, size_t blocks, size_t k, bmp_shadow_index_t first_index,
+	size_t count, bmp_byte_t *out, size_t stride)
+{
+	// Rows of NTT_BATCH lanes: the coefficients of the blocks, and their values at every g^e
+	uint32_t coefs[NTT_SIZE * NTT_BATCH];
+	uint32_t values[NTT_SIZE * NTT_BATCH];
+	size_t b, i, j, lanes;
+
+	// Only x = 1 .. 250 have a logarithm
+	if (first_index == 0 || first_index + count - 1 > NTT_SIZE)
+	{
+		return -1;
+	}
+
+	pthread_once(&ntt_once, ntt_init_tables);
+
+	for (b = 0; b < blocks; b += lanes)
+	{
+		lanes = blocks - b < NTT_BATCH ? blocks - b : NTT_BATCH;
+
+		for (i = 0; i < k; i++)
+		{
+			uint32_t *row = &coefs[i * NTT_BATCH];
+			for (j = 0; j < lanes; j++)
+			{
+				row[j] = payload[(b + j) * k + i];
+			}
+
+			// The lanes of a short last batch are left at 0
+			for (; j < NTT_BATCH; j++)
+			{
+				row[j] = 0;
+			}
+		}
+
+		ntt_transform(coefs, 0, 1, NTT_SIZE, 0, k, values);
+
+		for (j = 0; j < count; j++)
+		{
+			const uint32_t *row = &values[ntt_logs[first_index + j] * NTT_BATCH];
+			bmp_byte_t *dest = &out[j * stride + b];
+
+			for (i = 0; i < lanes; i++)
+			{
+				dest[i] = row[i];
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Decimation in time over rows: the n rows of in taken every stride rows, from row first, are
+ * transformed into out with the radices from level on. Rows from k on are 0, so sub-transforms
+ * that only take those are skipped. Every product is at most 250 * 250, so a row is only
+ * reduced once all the terms of an output are added.
+ */
+void ntt_transform(const uint32_t *in, size_t first, size_t stride, size_t n, int level, size_t k, uint32_t *out)
+{
+	if (n == 1)
+	{
+		memcpy(out, &in[first * NTT_BATCH], NTT_BATCH * sizeof(uint32_t));
+		return;
+	}
+
+	size_t r = ntt_radices[level];
+	size_t m = n / r;
+	size_t step = NTT_SIZE / n; // the root of order n is g^step
+	size_t t, q, j, l;
+
+	// Sub-transform t starts at row first + t * stride, so only the first ones have coefficients
+	size_t used = (k - first + stride - 1) / stride;
+	used = used < r ? used : r;
+
+	for (t = 0; t < used; t++)
+	{
+		ntt_transform(in, first + t * stride, stride * r, m, level + 1, k, &out[t * m * NTT_BATCH]);
+	}
+
+	// With a single one every output is the same as its own
+	if (used == 1)
+	{
+		for (t = 1; t < r; t++)
+		{
+			memcpy(&out[t * m * NTT_BATCH], out, m * NTT_BATCH * sizeof(uint32_t));
+		}
+
+		return;
+	}
+
+	uint32_t twiddled[5][NTT_BATCH];
+	for (j = 0; j < m; j++)
+	{
+		// Output j + m * q only needs output j of every sub-transform
+		for (t = 0; t < used; t++)
+		{
+			const uint32_t *row = &out[(t * m + j) * NTT_BATCH];
+			uint32_t twiddle = ntt_powers[(t * j * step) % NTT_SIZE];
+			for (l = 0; l < NTT_BATCH; l++)
+			{
+				twiddled[t][l] = (row[l] * twiddle) % 251;
+			}
+		}
+
+		for (q = 0; q < r; q++)
+		{
+			uint32_t sum[NTT_BATCH];
+			memset(sum, 0, sizeof(sum));
+
+			for (t = 0; t < used; t++)
+			{
+				uint32_t root = ntt_powers[(t * q * m * step) % NTT_SIZE];
+				for (l = 0; l < NTT_BATCH; l++)
+				{
+					sum[l] += twiddled[t][l] * root;
+				}
+			}
+
+			uint32_t *row = &out[(j + m * q) * NTT_BATCH];
+			for (l = 0; l < NTT_BATCH; l++)
+			{
+				row[l] = sum[l] % 251;
+			}
+		}
+	}
+}
+
+// The first element whose order is 250, that is, neither g^50 nor g^125 is 1
+void ntt_init_tables()
+{
+	uint32_t g, e, power = 1;
+	for (g = 2; g < 251; g++)
+	{
+		uint32_t g50 = 1, g125 = 1;
+		for (e = 0; e < 125; e++)
+		{
+			g125 = (g125 * g) % 251;
+			g50 = e < 50 ? g125 : g50;
+		}
+
+		if (g50 != 1 && g125 != 1)
+		{
+			break;
+		}
+	}
+
+	for (e = 0; e < NTT_SIZE; e++)
+	{
+		ntt_powers[e] = power;
+		ntt_logs[power] = e;
+		power = (power * g) % 251;
+	}
+}
+
+int ntt_preferred(size_t k, size_t count)
+{
+	return k * count >= ntt_crossover;
+}
+
+void ntt_set_crossover(size_t crossover)
+{
+	ntt_crossover = crossover;
+}
+
+size_t ntt_get_crossover()
+{
+	return ntt_crossover;
+}
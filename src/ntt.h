@@ -0,0 +1,31 @@
+#ifndef NTT_H
+#define NTT_H
+
+#include "bmp.h"
+
+/*
+ * Engine for large k and n. The nonzero elements of GF(251) are the powers of a generator g,
+ * so a block evaluated at every g^e (e < 250) is a discrete Fourier transform of length
+ * 250 = 2 * 5 * 5 * 5, computed with a mixed radix FFT in about 250 * (2 + 5 + 5 + 5) products
+ * instead of k per shadow. It pays off once k * n is above the crossover (see tune.h).
+ */
+
+#define NTT_SIZE 250 // order of the multiplicative group of GF(251)
+#define NTT_BATCH 16 // blocks transformed together, one per lane
+#define NTT_DEFAULT_CROSSOVER 4096 // k * n, used unless set by the tuning profile
+
+/*
+ * out[j * stride + b] is the value of block b at x = first_index + j, for count shadows at once.
+ * Same results as the evaluate kernel once per shadow. Returns -1, writing nothing, if an x is
+ * not in 1 .. NTT_SIZE.
+ */
+int ntt_evaluate_blocks(const bmp_byte_t *payload, size_t blocks, size_t k, bmp_shadow_index_t first_index,
+	size_t count, bmp_byte_t *out, size_t stride);
+
+// Whether count shadows of k-byte blocks are faster to evaluate with ntt_evaluate_blocks()
+int ntt_preferred(size_t k, size_t count);
+void ntt_set_crossover(size_t crossover);
+size_t ntt_get_crossover();
+
+#endif
+/* NTT_H */
@@ -0,0 +1,93 @@
+#include "participant.h"
+#include "distribute.h"
+#include "recover.h"
+#include "utils.h"
+#include "lsb.h"
+#include "compress.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int participant_add_from_secret(struct bmp_handle *secret_bmp, struct bmp_handle **covers, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int permute, bmp_word_t seed, int depth, int codec)
+{
+	bmp_byte_t *pixels = bmp_get_pixels(secret_bmp);
+	size_t real_byte_count = bmp_data_size(secret_bmp);
+
+	struct bmp_shadow_info info;
+	distribute_init_info(&info, secret_bmp, distribute_truncate_image(pixels, real_byte_count), k, depth);
+
+	// The codec is deterministic, so the payload is the same one the existing shadows hold
+	bmp_byte_t *payload = pixels;
+	size_t size = real_byte_count;
+	int status = -1;
+
+	if (codec != CODEC_NONE)
+	{
+		payload = distribute_compress(pixels, real_byte_count, codec, &size, &info);
+		if (payload == NULL)
+		{
+			return -1;
+		}
+	}
+
+	// The random padding of the last block is only stored in the existing shadows
+	if (size % k != 0)
+	{
+		printe("Error: secret size is not a multiple of K, the existing shadows are required (--from).\n");
+		goto free_payload;
+	}
+
+	if (distribute_check_capacity(covers, count, size, k, depth) != 0 ||
+		utils_shuffle(payload, size, seed, permute) != 0 ||
+		distribute_payload(payload, size, NULL, covers, count, first_index, k, depth) != 0)
+	{
+		goto free_payload;
+	}
+
+	status = distribute_write_shadows(covers, count, first_index, seed, &info);
+
+	// Error handling
+free_payload:
+	if (payload != pixels)
+	{
+		arena_free_buffer(payload);
+	}
+
+	return status;
+}
+
+int participant_add_from_shadows(struct bmp_handle **shadows, size_t k, size_t payload_size,
+	struct bmp_handle **covers, size_t count, bmp_shadow_index_t first_index)
+{
+	bmp_byte_t *payload = arena_alloc_buffer(payload_size * sizeof(bmp_byte_t));
+	bmp_byte_t *extra_coefs = arena_alloc_buffer(k * sizeof(bmp_byte_t));
+	int status = -1;
+
+	if (payload == NULL || extra_coefs == NULL)
+	{
+		goto free_buffers;
+	}
+
+	// The payload is used as recovered, so no permutation needs to be undone
+	if (recover_payload(payload, payload_size, shadows, k, extra_coefs) != 0)
+	{
+		goto free_buffers;
+	}
+
+	if (distribute_payload(payload, payload_size, extra_coefs, covers, count, first_index, k,
+		lsb_depth_of(shadows[0], k)) != 0)
+	{
+		goto free_buffers;
+	}
+
+	status = distribute_write_shadows(covers, count, first_index, bmp_get_header(shadows[0])->seed,
+		bmp_get_shadow_info(shadows[0]));
+
+	// Error handling
+free_buffers:
+	arena_free_buffer(extra_coefs);
+	arena_free_buffer(payload);
+
+	return status;
+}
@@ -0,0 +1,16 @@
+#ifndef PARTICIPANT_H
+#define PARTICIPANT_H
+
+#include "bmp.h"
+
+/*
+ * Both functions evaluate the original polynomials at x = first_index .. first_index + count - 1
+ * only, and write the resulting shadows to the given covers. Existing shadows are not touched.
+ */
+int participant_add_from_secret(struct bmp_handle *secret_bmp, struct bmp_handle **covers, size_t count,
+	bmp_shadow_index_t first_index, size_t k, int permute, bmp_word_t seed, int depth, int codec);
+int participant_add_from_shadows(struct bmp_handle **shadows, size_t k, size_t payload_size,
+	struct bmp_handle **covers, size_t count, bmp_shadow_index_t first_index);
+
+#endif
+/* PARTICIPANT_H */
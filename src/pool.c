@@ -0,0 +1,70 @@
+#include "pool.h"
+#include <pthread.h>
+
+struct pool_job {
+	pool_task_t task;
+	void *arg;
+	size_t count;
+	size_t next; // next index to run, shared by the threads
+	int failed;
+};
+
+static size_t max_threads = POOL_MAX_THREADS;
+static size_t last_threads = 0;
+
+void *pool_thread(void *arg);
+
+int pool_run(size_t count, pool_task_t task, void *arg)
+{
+	struct pool_job job = { task, arg, count, 0, 0 };
+
+	size_t threads = count < max_threads ? count : max_threads;
+	pthread_t ids[POOL_MAX_THREADS];
+	size_t i, started = 0;
+
+	for (i = 1; i < threads; i++)
+	{
+		if (pthread_create(&ids[started], NULL, pool_thread, &job) != 0)
+		{
+			break;
+		}
+
+		started++;
+	}
+
+	pool_thread(&job);
+
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(ids[i], NULL);
+	}
+
+	last_threads = started + 1;
+	return job.failed ? -1 : 0;
+}
+
+void pool_set_threads(size_t threads)
+{
+	max_threads = threads < 1 ? 1 : (threads > POOL_MAX_THREADS ? POOL_MAX_THREADS : threads);
+}
+
+size_t pool_last_threads()
+{
+	return last_threads;
+}
+
+void *pool_thread(void *arg)
+{
+	struct pool_job *job = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+	{
+		if (job->task(job->arg, i) != 0)
+		{
+			__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+
+#define POOL_MAX_THREADS 16
+
+// Work item of pool_run(), returns 0 on success
+typedef int (*pool_task_t)(void *arg, size_t index);
+
+/*
+ * Runs task(arg, i) for every i in [0, count) on up to POOL_MAX_THREADS threads (the calling
+ * thread included), each one taking the next index as soon as it is done with the previous one.
+ * Meant for I/O bound work on a handful of files. Returns -1 if any of the tasks failed.
+ */
+int pool_run(size_t count, pool_task_t task, void *arg);
+
+// Limits the threads of the next runs, up to POOL_MAX_THREADS (see tune.h)
+void pool_set_threads(size_t threads);
+
+// Threads used by the last pool_run()
+size_t pool_last_threads();
+
+#endif
+/* POOL_H */
@@ -0,0 +1,250 @@
+#include "preflight.h"
+#include "cripto.h"
+#include "cripto_rand.h"
+#include "utils.h"
+#include "robust.h"
+#include "lsb.h"
+#include "arena.h"
+#include "distribute.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int preflight_check_headers(struct bmp_handle **shadows, size_t m, size_t k, size_t size);
+int preflight_check_samples(struct bmp_handle **shadows, size_t m, size_t k, size_t size);
+int preflight_read_share(struct bmp_handle *shadow, size_t block, int depth, bmp_byte_t *share);
+
+int preflight_check(struct bmp_handle **shadows, size_t m, size_t k, size_t size)
+{
+	if (m < k)
+	{
+		printe("Error: only %lu shadows were found, K = %lu are needed.\n", (unsigned long)m, (unsigned long)k);
+		return -1;
+	}
+
+	if (preflight_check_headers(shadows, m, k, size) != 0)
+	{
+		return -1;
+	}
+
+	return preflight_check_samples(shadows, m, k, size);
+}
+
+// Every problem found is reported, not only the first one
+int preflight_check_headers(struct bmp_handle **shadows, size_t m, size_t k, size_t size)
+{
+	struct bmp_header *first = bmp_get_header(shadows[0]);
+	struct bmp_shadow_info *first_info = bmp_get_shadow_info(shadows[0]);
+	int used[MAX_SHADOW_INDEX + 1];
+	int errors = 0;
+	size_t i;
+
+	memset(used, 0, sizeof(used));
+
+	for (i = 0; i < m; i++)
+	{
+		struct bmp_header *header = bmp_get_header(shadows[i]);
+		struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[i]);
+		const char *name = bmp_get_filename(shadows[i]);
+
+		if (header->seed != first->seed)
+		{
+			printe("Error: %s has seed %u, but %s has seed %u (different shares).\n", name, header->seed,
+				bmp_get_filename(shadows[0]), first->seed);
+			errors++;
+		}
+
+		if (header->shadow_index == 0 || header->shadow_index > MAX_SHADOW_INDEX)
+		{
+			printe("Error: %s has an invalid shadow index (%u).\n", name, header->shadow_index);
+			errors++;
+		}
+		else if (used[header->shadow_index]++)
+		{
+			printe("Error: shadow index %u is repeated in %s.\n", header->shadow_index, name);
+			errors++;
+		}
+
+		if ((info == NULL) != (first_info == NULL) || (info != NULL && (info->checksum != first_info->checksum ||
+			info->codec != first_info->codec || bmp_shadow_payload_size(info) != bmp_shadow_payload_size(first_info) ||
+			info->lsb_depth != first_info->lsb_depth || info->secret_width != first_info->secret_width ||
+			info->secret_height != first_info->secret_height || info->k != first_info->k)))
+		{
+			printe("Error: the shadow information of %s does not match the one of %s (different shares).\n", name,
+				bmp_get_filename(shadows[0]));
+			errors++;
+		}
+		else if (info != NULL && info->k != 0 && info->k != k)
+		{
+			printe("Error: %s was shared with K = %u, not %lu.\n", name, info->k, (unsigned long)k);
+			errors++;
+		}
+
+		size_t required = shadow_size_for(size, k, lsb_depth_of(shadows[i], k));
+		if (bmp_data_size(shadows[i]) < required)
+		{
+			printe("Error: %s has %lu bytes of pixel data, %lu are needed (wrong K, -w or -h?).\n", name,
+				(unsigned long)bmp_data_size(shadows[i]), (unsigned long)required);
+			errors++;
+		}
+	}
+
+	return errors == 0 ? 0 : -1;
+}
+
+/*
+ * Each sampled block is decoded from all the shadows as --robust does (Berlekamp-Welch), so the
+ * shadows that disagree with it are told apart, whichever they are, as long as there are at
+ * most (m - k) / 2 of them. A wrong K or a shadow from another share makes most samples disagree.
+ */
+int preflight_check_samples(struct bmp_handle **shadows, size_t m, size_t k, size_t size)
+{
+	size_t blocks = size / k;
+	if (blocks == 0)
+	{
+		printf("Headers are consistent. The payload is too small to test the shares.\n");
+		return 0;
+	}
+
+	struct arena *arena = arena_create();
+	struct robust_decoder *dec = robust_decoder_init(shadows, m, k);
+	if (arena == NULL || dec == NULL)
+	{
+		goto free_arena;
+	}
+
+	bmp_byte_t *shares = arena_alloc(arena, m * sizeof(bmp_byte_t));
+	bmp_byte_t *coefs = arena_alloc(arena, k * sizeof(bmp_byte_t));
+	size_t *mismatches = arena_alloc(arena, m * sizeof(size_t));
+	if (shares == NULL || coefs == NULL || mismatches == NULL)
+	{
+		goto free_arena;
+	}
+
+	int depth = lsb_depth_of(shadows[0], k);
+	size_t samples = blocks < PREFLIGHT_SAMPLES ? blocks : PREFLIGHT_SAMPLES;
+	size_t failed = 0, undecoded = 0, low_degree = 0;
+	size_t j, s;
+
+	randomize(time(NULL));
+	for (s = 0; s < samples; s++)
+	{
+		// The last block is always tested, the end of the shares shows a wrong size first
+		size_t block = s == 0 ? blocks - 1 : (size_t)randint(blocks - 1);
+
+		for (j = 0; j < m; j++)
+		{
+			if (preflight_read_share(shadows[j], block, depth, &shares[j]) != 0)
+			{
+				goto free_arena;
+			}
+		}
+
+		if (robust_decode_shares(dec, shares, coefs, k) != 0)
+		{
+			undecoded++;
+			failed++;
+			continue;
+		}
+
+		low_degree += coefs[k - 1] == 0;
+
+		int agree = 1;
+		for (j = 0; j < m; j++)
+		{
+			if (distribute_evaluate_pol(coefs, k, bmp_get_header(shadows[j])->shadow_index) != shares[j])
+			{
+				mismatches[j]++;
+				agree = 0;
+			}
+		}
+
+		failed += !agree;
+	}
+
+	printv("Tested %lu blocks of %lu shadows (LSB depth %d).\n", (unsigned long)samples, (unsigned long)m, depth);
+
+	/*
+	 * Shares of a smaller K agree anyway, but then the last coefficient is always 0. So is the
+	 * last byte of every block of a dark secret, so this is only a hint for shadows that do not
+	 * record their K (which preflight_check_headers() compares otherwise).
+	 */
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[0]);
+	if ((info == NULL || info->k == 0) && failed == 0 && low_degree == samples &&
+		samples >= PREFLIGHT_MIN_DEGREE_SAMPLES)
+	{
+		printe("Warning: every sampled block has degree lower than K - 1, the secret may have been shared with a "
+			"smaller K.\n");
+	}
+
+	if (m == k)
+	{
+		printf("Preflight passed: headers are consistent, but K + 1 = %lu shadows are needed to test the shares.\n",
+			(unsigned long)k + 1);
+		robust_decoder_free(dec);
+		arena_destroy(arena);
+		return 0;
+	}
+
+	if (failed == 0)
+	{
+		printf("Preflight passed: headers are consistent and %lu sampled blocks agree across %lu shadows.\n",
+			(unsigned long)samples, (unsigned long)m);
+		robust_decoder_free(dec);
+		arena_destroy(arena);
+		return 0;
+	}
+
+	printe("Error: %lu of %lu sampled blocks do not agree across the shadows (wrong K, or mixed shares).\n",
+		(unsigned long)failed, (unsigned long)samples);
+
+	for (j = 0; j < m; j++)
+	{
+		if (mismatches[j] != 0)
+		{
+			printe("-> %s (shadow index %u) disagrees in %lu blocks.\n", bmp_get_filename(shadows[j]),
+				bmp_get_header(shadows[j])->shadow_index, (unsigned long)mismatches[j]);
+		}
+	}
+
+	if (undecoded != 0)
+	{
+		printe("-> %lu blocks have more than %lu wrong shadows, %s.\n", (unsigned long)undecoded,
+			(unsigned long)(m - k) / 2, m - k < 2 ? "K + 2 shadows are needed to tell which one is wrong" :
+			"so the wrong ones can not be told apart");
+	}
+
+	// Error handling
+free_arena:
+	if (dec != NULL)
+	{
+		robust_decoder_free(dec);
+	}
+
+	arena_destroy(arena);
+	return -1;
+}
+
+int preflight_read_share(struct bmp_handle *shadow, size_t block, int depth, bmp_byte_t *share)
+{
+	size_t offset = lsb_cover_offset(block, depth);
+	size_t len = lsb_cover_bytes(block + 1, depth) - offset;
+
+	bmp_byte_t buffer[8];
+	const bmp_byte_t *bytes = bmp_get_pixels(shadow);
+	if (bytes != NULL)
+	{
+		bytes = &bytes[offset];
+	}
+	else if (bmp_read_range(shadow, offset, buffer, len) == 0)
+	{
+		bytes = buffer;
+	}
+	else
+	{
+		return -1;
+	}
+
+	lsb_extract(bytes, 1, share, block, depth);
+	return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include "bmp.h"
+
+#define PREFLIGHT_SAMPLES 64 // blocks decoded to test the shares
+#define PREFLIGHT_MIN_DEGREE_SAMPLES 8 // needed to suspect a smaller K, which leaves the last coefficient at 0
+
+/*
+ * Checks, without recovering anything, that m >= k shadows can recover a payload of size bytes:
+ * the headers must agree (seed, unique indexes, shadow information, the K it records) and every
+ * cover must be large enough. Then a random sample of blocks is decoded from all of them (see
+ * robust.h), which tells the shadows that disagree if m > k + 1. Only a few cover bytes are read,
+ * so it is fast even for huge shadows.
+ */
+int preflight_check(struct bmp_handle **shadows, size_t m, size_t k, size_t size);
+
+#endif
+/* PREFLIGHT_H */
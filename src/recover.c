@@ -3,16 +3,28 @@
 #include "utils.h"
 #include "gauss.h"
 #include "cripto.h"
+#include "checksum.h"
+#include "lsb.h"
+#include "compress.h"
+#include "arena.h"
+#include "kernels.h"
+#include "memo.h"
+#include "checkpoint.h"
 
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
 
-bmp_byte_t recover_byte(bmp_byte_t *bytes, size_t k);
+#define WRITE_CHUNK_SIZE 65536
+
 void recover_generate_equations(bmp_op_t ** matrix, size_t k, struct bmp_handle **shadows);
-bmp_byte_t recover_byte(bmp_byte_t *bytes, size_t k);
-bmp_byte_t recover_lsb_width1(bmp_byte_t *bytes, size_t pos);
-bmp_byte_t recover_lsb_width2(bmp_byte_t *bytes, size_t pos);
+void recover_solve_memo(struct memo *memo, const bmp_byte_t *shadow_bytes, size_t blocks, size_t k,
+	const bmp_byte_t *inverse, kernel_solve_t solve, bmp_byte_t *out);
+const bmp_byte_t *recover_cover_bytes(struct bmp_handle *shadow, size_t offset, size_t len, bmp_byte_t *buffer);
+int recover_payload_checkpointed(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t k, int permute,
+	const char *name, struct checkpoint **ckpt);
+int recover_payload_chunks(bmp_byte_t *payload, size_t size, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t k, bmp_byte_t *extra_coefs, struct checkpoint *ckpt);
 
 int recover(struct bmp_handle *bmp, struct bmp_handle **shadows, size_t k, int permute)
 {
@@ -21,163 +33,358 @@ int recover(struct bmp_handle *bmp, struct bmp_handle **shadows, size_t k, int p
 		return -1;
 	}
 
-	bmp_byte_t *coefs = malloc(k * sizeof(bmp_byte_t));
-	if (coefs == NULL)
+	size_t size;
+	bmp_byte_t *payload = recover_alloc_payload(bmp, shadows[0], &size);
+	if (payload == NULL)
 	{
+		bmp_free(bmp);
 		return -1;
 	}
 
-	bmp_byte_t *new_bmp_pixels = bmp_get_pixels(bmp);
+	struct checkpoint *ckpt;
+	if (recover_payload_checkpointed(payload, size, shadows, k, permute, bmp_get_filename(bmp), &ckpt) != 0)
+	{
+		if (payload != bmp_get_pixels(bmp))
+		{
+			arena_free_buffer(payload);
+		}
 
-	bmp_op_t **equations = recover_alloc_matrix(k);
-	recover_generate_equations(equations, k, shadows);
-	struct bmp_header *header = bmp_get_header(bmp);
-	int jump;
-	bmp_byte_t (*recover_lsb_fn)(bmp_byte_t*, size_t);
+		goto end_ckpt;
+	}
 
-	if (k >= 8)
+	if (recover_unpack(bmp, payload, size, shadows[0], permute) != 0)
 	{
-		jump = 8;
-		recover_lsb_fn = recover_lsb_width1;
+		goto end_ckpt;
 	}
-	else
+
+	int status = recover_write_checked(bmp, shadows[0]);
+	if (status)
 	{
-		jump = 4;
-		recover_lsb_fn = recover_lsb_width2;
+		goto end_ckpt;
 	}
 
-	int padding = padding_for_width(header->width);
-	size_t real_byte_count = (header->width + padding) * header->height;
+	checkpoint_end(ckpt, 0);
+	return 0;
 
-	int remainder = real_byte_count % k;
-	int i;
-	size_t bytes_written = 0;
+	// Error handling
+end_ckpt:
+	checkpoint_end(ckpt, 1);
+	bmp_free(bmp);
+	return -1;
+}
+
+/*
+ * Same as recover_payload(), keeping the recovered bytes in "<name>.ckpt" as it goes. *ckpt is
+ * left open (or NULL) until the secret is written, see checkpoint_end().
+ */
+int recover_payload_checkpointed(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t k, int permute,
+	const char *name, struct checkpoint **ckpt)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadows[0]);
+	bmp_word_t seed = bmp_get_header(shadows[0])->seed;
 
-	for (i = 0; i < (real_byte_count - remainder) / k; i++)
+	struct checkpoint_state state = { CHECKPOINT_RECOVER, k, size, lsb_depth_of(shadows[0], k), permute,
+		info != NULL ? info->checksum : 0, seed, 0, 0 };
+	if (checkpoint_begin(&state, &name, &payload, 1, ckpt) != 0)
 	{
-		int j;
-		for (j = 0; j < k; j++)
+		return -1;
+	}
+
+	if (state.seed != seed)
+	{
+		printe("Error: the checkpoint of %s belongs to other shadows.\n", name);
+		return -1;
+	}
+
+	return recover_payload_chunks(&payload[state.next_block * k], size, state.next_block, size / k, shadows, k, NULL,
+		*ckpt);
+}
+
+size_t recover_payload_size(size_t real_byte_count, struct bmp_handle *shadow)
+{
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	if (info == NULL || info->codec == CODEC_NONE)
+	{
+		return real_byte_count;
+	}
+
+	return bmp_shadow_payload_size(info);
+}
+
+bmp_byte_t *recover_alloc_payload(struct bmp_handle *bmp, struct bmp_handle *shadow, size_t *size)
+{
+	size_t real_byte_count = bmp_data_size(bmp);
+	*size = recover_payload_size(real_byte_count, shadow);
+
+	if (bmp_get_shadow_info(shadow) == NULL || bmp_get_shadow_info(shadow)->codec == CODEC_NONE)
+	{
+		return bmp_get_pixels(bmp);
+	}
+
+	if (*size == 0)
+	{
+		return NULL;
+	}
+
+	return arena_alloc_buffer(*size * sizeof(bmp_byte_t));
+}
+
+int recover_unpack(struct bmp_handle *bmp, bmp_byte_t *payload, size_t size, struct bmp_handle *shadow, int permute)
+{
+	bmp_byte_t *pixels = bmp_get_pixels(bmp);
+	int status = utils_unshuffle(payload, size, (bmp_get_header(shadow))->seed, permute);
+
+	if (payload == pixels)
+	{
+		return status;
+	}
+
+	if (status == 0)
+	{
+		int codec = bmp_get_shadow_info(shadow)->codec;
+		if (codec != CODEC_RLE)
 		{
-			bmp_byte_t *pixels = bmp_get_pixels(shadows[j]);
-			equations[j][k] = (*recover_lsb_fn)(&pixels[i * jump], LSB_POS_1);
+			printe("Error: shadows use an unknown compression method (%d).\n", codec);
+			status = -1;
 		}
-
-		if (recover_gauss(equations, coefs, k) != 0)
+		else if (decompress_rle(payload, size, pixels, bmp_data_size(bmp)) != 0)
 		{
-			bmp_free(bmp);
-			free(equations);
-			free(coefs);
-			return -1;
+			printe("Error: the recovered payload could not be decompressed.\n");
+			status = -1;
 		}
+	}
+
+	arena_free_buffer(payload);
+	return status;
+}
+
+int recover_payload(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t k, bmp_byte_t *extra_coefs)
+{
+	return recover_payload_range(payload, size, 0, size / k, shadows, k, extra_coefs);
+}
+
+int recover_payload_range(bmp_byte_t *payload, size_t size, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t k, bmp_byte_t *extra_coefs)
+{
+	return recover_payload_chunks(payload, size, first, last, shadows, k, extra_coefs, NULL);
+}
 
-		memcpy(&new_bmp_pixels[(i * k)], coefs, k);
-		bytes_written += k;
+// Same as recover_payload_range(), saving the payload (which starts at block 0 of ckpt) when due
+int recover_payload_chunks(bmp_byte_t *payload, size_t size, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t k, bmp_byte_t *extra_coefs, struct checkpoint *ckpt)
+{
+	struct arena *arena = arena_create();
+	if (arena == NULL)
+	{
+		return -1;
 	}
 
-	if (remainder)
+	// Everything the solver needs is allocated once for the whole payload
+	bmp_byte_t *coefs = arena_alloc(arena, k * sizeof(bmp_byte_t));
+	bmp_byte_t *values = arena_alloc(arena, k * sizeof(bmp_byte_t));
+	bmp_byte_t *inverse = arena_alloc(arena, k * k * sizeof(bmp_byte_t));
+	bmp_op_t **equations = arena_alloc_matrix(arena, k, k + 1);
+	bmp_op_t **scratch = arena_alloc_matrix(arena, k, 2 * k);
+
+	// Shadow bytes of a whole chunk of blocks, one row per shadow
+	bmp_byte_t *shadow_bytes = arena_alloc(arena, k * payload_chunk_blocks * sizeof(bmp_byte_t));
+
+	// Cover bytes of a chunk, for shadows whose pixels are not loaded
+	bmp_byte_t *cover = arena_alloc(arena, (lsb_cover_bytes(payload_chunk_blocks, LSB_MIN_DEPTH) + 8) * sizeof(bmp_byte_t));
+	if (coefs == NULL || values == NULL || inverse == NULL || equations == NULL || scratch == NULL ||
+		shadow_bytes == NULL || cover == NULL)
 	{
-		printv("Info: real_byte_count (mod K) = %d\n", remainder);
+		goto free_arena;
+	}
+
+	// The shadows are the same for every block, so the system is inverted only once
+	recover_generate_equations(equations, k, shadows);
+	if (gauss_invert(equations, k, scratch, inverse) != 0)
+	{
+		printe("Error: the shadows must have different indexes.\n");
+		goto free_arena;
+	}
+
+	kernel_solve_t solve = kernel_solve_for(k);
+
+	// Keyed on the k shadow bytes of a block
+	struct memo *memo = NULL;
+	if (memo_mode && (memo = memo_create(k, k, MEMO_ENTRIES)) == NULL)
+	{
+		goto free_arena;
+	}
+
+	int depth = lsb_depth_of(shadows[0], k);
+
+	size_t remainder = size % k;
+	size_t blocks = size / k;
+	size_t j, chunk, end;
+	size_t bytes_written = 0;
 
-		size_t lsb_pos;
-		if (k >= 8)
+	for (chunk = first; chunk < last; chunk = end)
+	{
+		end = chunk + payload_chunk_blocks < last ? chunk + payload_chunk_blocks : last;
+
+		size_t offset = lsb_cover_offset(chunk, depth);
+		size_t len = lsb_cover_bytes(end, depth) - offset;
+
+		for (j = 0; j < k; j++)
+		{
+			const bmp_byte_t *bytes = recover_cover_bytes(shadows[j], offset, len, cover);
+			if (bytes == NULL)
+			{
+				goto free_memo;
+			}
+
+			lsb_extract(bytes, end - chunk, &shadow_bytes[j * payload_chunk_blocks], chunk, depth);
+		}
+
+		if (memo != NULL)
 		{
-			lsb_pos = LSB_POS_2;
+			recover_solve_memo(memo, shadow_bytes, end - chunk, k, inverse, solve, &payload[(chunk - first) * k]);
 		}
 		else
 		{
-			lsb_pos = LSB_POS_3;
+			solve(shadow_bytes, payload_chunk_blocks, end - chunk, k, inverse, &payload[(chunk - first) * k]);
 		}
 
-		int j;
-		for (j = 0; j < k; j++)
+		bytes_written += (end - chunk) * k;
+
+		if (end < last && checkpoint_due(ckpt) && checkpoint_save(ckpt, end, end * k, 0) != 0)
 		{
-			bmp_byte_t *pixels = bmp_get_pixels(shadows[j]);
-			equations[j][k] = recover_lsb_width1(pixels, lsb_pos);
+			goto free_memo;
 		}
+	}
+
+	if (remainder && last == blocks)
+	{
+		printv("Info: real_byte_count (mod K) = %lu\n", (unsigned long)remainder);
 
-		if (recover_gauss(equations, coefs, k) != 0)
+		for (j = 0; j < k; j++)
 		{
-			bmp_free(bmp);
-			free(equations);
-			free(coefs);
-			return -1;
+			const bmp_byte_t *bytes = recover_cover_bytes(shadows[j], 0, 8, cover);
+			if (bytes == NULL)
+			{
+				goto free_memo;
+			}
+
+			values[j] = recover_lsb_width1((bmp_byte_t *)bytes, depth);
 		}
 
-		memcpy(&new_bmp_pixels[(i * k)], coefs, remainder);
-		bytes_written += remainder;
-	}
+		solve(values, 1, 1, k, inverse, coefs);
 
-	printv("Bytes written to recovered image: %u\n", bytes_written);
+		memcpy(&payload[(blocks - first) * k], coefs, remainder);
+		bytes_written += remainder;
 
-	if (permute)
-	{
-		utils_permute_inverse(new_bmp_pixels, real_byte_count, (bmp_get_header(shadows[0]))->seed);
-	}
-	int status = bmp_write_pixels(bmp);
-	if (status)
-	{
-		bmp_free(bmp);
-		free(equations);
-		free(coefs);
-		return -1;
+		if (extra_coefs != NULL)
+		{
+			memcpy(extra_coefs, coefs, k);
+		}
 	}
 
-	free(equations);
-	free(coefs);
+	printv("Bytes written to recovered image: %lu\n", (unsigned long)bytes_written);
+	memo_report(memo, "Recovery");
+
+	memo_destroy(memo);
+	arena_destroy(arena);
 	return 0;
+
+	// Error handling
+free_memo:
+	memo_destroy(memo);
+free_arena:
+	arena_destroy(arena);
+	return -1;
 }
 
-bmp_byte_t recover_lsb_width1(bmp_byte_t *bytes, size_t pos)
+const bmp_byte_t *recover_cover_bytes(struct bmp_handle *shadow, size_t offset, size_t len, bmp_byte_t *buffer)
 {
-	int i;
-	bmp_byte_t byte = 0;
-	for (i = 0; i < 8; i++)
+	bmp_byte_t *pixels = bmp_get_pixels(shadow);
+	if (pixels != NULL)
 	{
-		bmp_byte_t bit = bytes[i] & BIT(pos);
-		bit = bit >> pos;
-		byte |= (bit << (8 - 1 - i));
+		return &pixels[offset];
 	}
 
-	return byte;
+	if (bmp_read_range(shadow, offset, buffer, len) != 0)
+	{
+		return NULL;
+	}
+
+	return buffer;
 }
 
-bmp_byte_t recover_lsb_width2(bmp_byte_t *bytes, size_t pos)
+void recover_solve_memo(struct memo *memo, const bmp_byte_t *shadow_bytes, size_t blocks, size_t k,
+	const bmp_byte_t *inverse, kernel_solve_t solve, bmp_byte_t *out)
 {
-	int i;
-	bmp_byte_t byte = 0;
-	for (i = 0; i < 4; i++)
+	bmp_byte_t values[MAX_SHADOW_INDEX];
+	size_t b, j;
+
+	for (b = 0; b < blocks; b++)
 	{
-		bmp_byte_t bits = bytes[i] & (0x03 << pos);
-		bits = bits >> pos;
-		byte |= (bits << (8 - 2 - (i * 2)));
-	}
+		for (j = 0; j < k; j++)
+		{
+			values[j] = shadow_bytes[j * payload_chunk_blocks + b];
+		}
 
-	return byte;
+		const bmp_byte_t *coefs = memo_lookup(memo, values);
+		if (coefs == NULL)
+		{
+			bmp_byte_t *entry = memo_insert(memo, values);
+			solve(values, 1, 1, k, inverse, entry);
+			coefs = entry;
+		}
+
+		memcpy(&out[b * k], coefs, k);
+	}
 }
 
-bmp_op_t **recover_alloc_matrix(size_t k)
+int recover_write_checked(struct bmp_handle *bmp, struct bmp_handle *shadow)
 {
-	bmp_op_t **rows = malloc(k * sizeof(bmp_op_t*));
+	bmp_byte_t *pixels = bmp_get_pixels(bmp);
+	size_t real_byte_count = bmp_data_size(bmp);
 
-	if (rows == NULL)
+	bmp_dword_t crc = CHECKSUM_INIT;
+	size_t chunk, len;
+
+	for (chunk = 0; chunk < real_byte_count; chunk += len)
 	{
-		return NULL;
+		len = real_byte_count - chunk < WRITE_CHUNK_SIZE ? real_byte_count - chunk : WRITE_CHUNK_SIZE;
+		crc = checksum_crc32c(crc, &pixels[chunk], len);
+		if (bmp_write_range(bmp, chunk, &pixels[chunk], len) != 0)
+		{
+			return -1;
+		}
 	}
 
-	bmp_op_t *col_data = malloc(k * (k + 1) * sizeof(bmp_op_t));
+	struct bmp_shadow_info *info = bmp_get_shadow_info(shadow);
+	if (info == NULL || !(info->flags & BMP_SHADOW_CHECKSUM))
+	{
+		printv("Info: shadows have no checksum, the recovered image was not verified.\n");
+		return 0;
+	}
 
-	if (col_data == NULL)
+	if (info->checksum != crc)
 	{
-		return NULL;
+		printe("Error: integrity check failed, the recovered image is not the distributed secret.\n");
+		return -1;
 	}
 
+	printv("Integrity check passed (CRC32C %08x).\n", crc);
+	return 0;
+}
+
+bmp_byte_t recover_lsb_width1(bmp_byte_t *bytes, size_t pos)
+{
 	int i;
-	for (i = 0; i < k; i++)
+	bmp_byte_t byte = 0;
+	for (i = 0; i < 8; i++)
 	{
-		rows[i] = &col_data[i * (k + 1)];
+		bmp_byte_t bit = bytes[i] & BIT(pos);
+		bit = bit >> pos;
+		byte |= (bit << (8 - 1 - i));
 	}
 
-	return rows;
+	return byte;
 }
 
 void recover_generate_equations(bmp_op_t ** matrix, size_t k, struct bmp_handle **shadows)
@@ -187,9 +394,10 @@ void recover_generate_equations(bmp_op_t ** matrix, size_t k, struct bmp_handle
 	for (i = 0; i < k; i++)
 	{
 		header = bmp_get_header(shadows[i]);
-		for (j = 0; j < k; j++)
+		matrix[i][0] = 1;
+		for (j = 1; j < k; j++)
 		{
-			matrix[i][j] = ((bmp_op_t) pow(header->shadow_index, j)) % 251;
+			matrix[i][j] = (matrix[i][j - 1] * (header->shadow_index % 251)) % 251;
 		}
 	}
 }
@@ -4,7 +4,41 @@
 #include "bmp.h"
 
 int recover(struct bmp_handle *bmp, struct bmp_handle **shadows, size_t k, int permute);
-bmp_op_t **recover_alloc_matrix(size_t k);
+
+// Size of the payload shared in the shadows, which is smaller than the secret if it was compressed
+size_t recover_payload_size(size_t real_byte_count, struct bmp_handle *shadow);
+
+/*
+ * Returns the buffer the payload should be recovered into: the pixels of bmp, or a new
+ * buffer if the shadows hold a compressed secret. recover_unpack() releases it.
+ */
+bmp_byte_t *recover_alloc_payload(struct bmp_handle *bmp, struct bmp_handle *shadow, size_t *size);
+
+// Undoes the permutation of the payload and decompresses it into the pixels of bmp if needed
+int recover_unpack(struct bmp_handle *bmp, bmp_byte_t *payload, size_t size, struct bmp_handle *shadow, int permute);
+
+/*
+ * Recovers the (still permuted) payload of size bytes from k shadows. If extra_coefs is
+ * not NULL, all k coefficients of the padded last block are stored in it.
+ */
+int recover_payload(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t k, bmp_byte_t *extra_coefs);
+
+/*
+ * Same as recover_payload(), but only for blocks [first, last), which are stored from payload[0].
+ * The remainder of the payload is recovered too if last is the final block. The cover bytes are
+ * read from the file for shadows whose pixels are not loaded.
+ */
+int recover_payload_range(bmp_byte_t *payload, size_t size, size_t first, size_t last, struct bmp_handle **shadows,
+	size_t k, bmp_byte_t *extra_coefs);
+
+/*
+ * Writes the recovered pixels while computing their checksum, and compares it with the one
+ * stored in the shadow (if any).
+ */
+int recover_write_checked(struct bmp_handle *bmp, struct bmp_handle *shadow);
+
+// Counterpart of distribute_lsb_width1()
+bmp_byte_t recover_lsb_width1(bmp_byte_t *bytes, size_t pos);
 
 #endif
-/* RECOVER_H */
\ No newline at end of file
+/* RECOVER_H */
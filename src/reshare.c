@@ -0,0 +1,125 @@
+#include "reshare.h"
+#include "recover.h"
+#include "distribute.h"
+#include "cripto_rand.h"
+#include "utils.h"
+#include "arena.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+size_t reshare_lcm(size_t a, size_t b);
+
+int reshare(struct bmp_handle **shadows, size_t k, size_t size, struct bmp_handle **covers, size_t n, size_t new_k,
+	int depth)
+{
+	size_t i;
+	struct bmp_header *first = bmp_get_header(shadows[0]);
+	for (i = 1; i < k; i++)
+	{
+		if (bmp_get_header(shadows[i])->seed != first->seed)
+		{
+			printe("Error: %s has another seed, the shadows do not belong together.\n",
+				bmp_get_filename(shadows[i]));
+			return -1;
+		}
+	}
+
+	struct bmp_shadow_info *old_info = bmp_get_shadow_info(shadows[0]);
+	if (old_info != NULL && old_info->k != 0 && old_info->k != k)
+	{
+		printe("Error: the old shadows were shared with K = %u, not %lu.\n", old_info->k, (unsigned long)k);
+		return -1;
+	}
+
+	if (distribute_check_capacity(covers, n, size, new_k, depth) != 0)
+	{
+		return -1;
+	}
+
+	// Windows start on a multiple of both block sizes, so they hold whole old and new blocks
+	size_t step = reshare_lcm(k, new_k);
+	size_t window = RESHARE_WINDOW_BYTES > step ? RESHARE_WINDOW_BYTES / step * step : step;
+	if (window > size)
+	{
+		window = (size + step - 1) / step * step;
+	}
+
+	bmp_byte_t *payload = arena_alloc_buffer(window * sizeof(bmp_byte_t));
+	bmp_byte_t *extra_coefs = arena_alloc_buffer(new_k * sizeof(bmp_byte_t));
+	int status = -1;
+
+	if (payload == NULL || extra_coefs == NULL)
+	{
+		goto free_buffers;
+	}
+
+	size_t start, end;
+	for (start = 0; start < size; start = end)
+	{
+		end = start + window < size ? start + window : size;
+
+		// The last window also takes the remainder of the old payload
+		size_t last = end < size ? end / k : size / k;
+		if (recover_payload_range(payload, size, start / k, last, shadows, k, NULL) != 0)
+		{
+			goto free_buffers;
+		}
+
+		last = end < size ? end / new_k : size / new_k;
+		if (distribute_payload_range(payload, start / new_k, last, covers, n, 1, new_k, depth) != 0)
+		{
+			goto free_buffers;
+		}
+
+		size_t remainder = size % new_k;
+		if (end == size && remainder)
+		{
+			// Padded at random, as when the secret was distributed
+			memcpy(extra_coefs, &payload[last * new_k - start], remainder);
+			randomize(time(NULL));
+			for (i = remainder; i < new_k; i++)
+			{
+				extra_coefs[i] = (bmp_byte_t)randint(250);
+			}
+
+			distribute_remainder(extra_coefs, covers, n, 1, new_k, depth);
+		}
+	}
+
+	printv("Reshared %lu bytes from K = %lu to (K = %lu, N = %lu) shadows, %lu at a time.\n", (unsigned long)size,
+		(unsigned long)k, (unsigned long)new_k, (unsigned long)n, (unsigned long)window);
+
+	// Everything but K and the LSB depth describes the same secret
+	struct bmp_shadow_info info;
+	if (old_info != NULL)
+	{
+		info = *old_info;
+		info.lsb_depth = depth;
+		info.k = new_k;
+		info.part = 0;
+		info.parts = 0;
+	}
+
+	status = distribute_write_shadows(covers, n, 1, first->seed, old_info != NULL ? &info : NULL);
+
+	// Error handling
+free_buffers:
+	arena_free_buffer(extra_coefs);
+	arena_free_buffer(payload);
+
+	return status;
+}
+
+size_t reshare_lcm(size_t a, size_t b)
+{
+	size_t x = a, y = b;
+	while (y != 0)
+	{
+		size_t t = x % y;
+		x = y;
+		y = t;
+	}
+
+	return a / x * b;
+}
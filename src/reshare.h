@@ -0,0 +1,19 @@
+#ifndef RESHARE_H
+#define RESHARE_H
+
+#include "bmp.h"
+
+#define RESHARE_WINDOW_BYTES 4194304 // payload held in memory at a time, in whole blocks of both K
+
+/*
+ * Moves the payload of size bytes held by k shadows to n new shadows with threshold new_k, at
+ * LSB depth depth, written to covers. Each window of the payload is recovered and shared again
+ * right away, still permuted: the new shadows keep the seed and the shadow information of the
+ * old ones, so the secret itself is never put together. The old shadows only need their
+ * headers loaded.
+ */
+int reshare(struct bmp_handle **shadows, size_t k, size_t size, struct bmp_handle **covers, size_t n, size_t new_k,
+	int depth);
+
+#endif
+/* RESHARE_H */
@@ -0,0 +1,332 @@
+#include "robust.h"
+#include "recover.h"
+#include "gauss.h"
+#include "utils.h"
+#include "lsb.h"
+#include "cripto.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct robust_decoder {
+	size_t m; // amount of shadows
+	size_t k;
+	size_t e; // max amount of errors that can be corrected
+	bmp_op_t **powers; // powers[i][j] = x_i ^ j
+	bmp_op_t **system;
+	bmp_op_t *solution;
+	bmp_op_t *values;
+	bmp_op_t *coefs;
+	size_t *disagreements; // per shadow
+	size_t corrected_blocks;
+	size_t failed_blocks;
+	size_t *pivots; // scratch for gauss_solve()
+	struct arena *arena; // owns the decoder and all of its buffers
+};
+
+int robust_decode_block(struct robust_decoder *dec, bmp_byte_t *block, size_t len);
+
+int robust_recover(struct bmp_handle *bmp, struct bmp_handle **shadows, size_t m, size_t k, int permute)
+{
+	size_t size;
+	bmp_byte_t *payload = recover_alloc_payload(bmp, shadows[0], &size);
+	if (payload == NULL)
+	{
+		bmp_free(bmp);
+		return -1;
+	}
+
+	if (robust_recover_payload(payload, size, shadows, m, k) != 0)
+	{
+		if (payload != bmp_get_pixels(bmp))
+		{
+			arena_free_buffer(payload);
+		}
+
+		bmp_free(bmp);
+		return -1;
+	}
+
+	if (recover_unpack(bmp, payload, size, shadows[0], permute) != 0 || recover_write_checked(bmp, shadows[0]) != 0)
+	{
+		bmp_free(bmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+int robust_recover_payload(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t m, size_t k)
+{
+	struct robust_decoder *dec = robust_decoder_init(shadows, m, k);
+	if (dec == NULL)
+	{
+		return -1;
+	}
+
+	int depth = lsb_depth_of(shadows[0], k);
+
+	size_t remainder = size % k;
+	size_t blocks = size / k;
+	size_t i, j, chunk, end;
+
+	bmp_byte_t *shadow_bytes = arena_alloc(dec->arena, m * payload_chunk_blocks * sizeof(bmp_byte_t));
+	if (shadow_bytes == NULL)
+	{
+		robust_decoder_free(dec);
+		return -1;
+	}
+
+	for (chunk = 0; chunk < blocks; chunk = end)
+	{
+		end = chunk + payload_chunk_blocks < blocks ? chunk + payload_chunk_blocks : blocks;
+
+		for (j = 0; j < m; j++)
+		{
+			lsb_extract(&bmp_get_pixels(shadows[j])[lsb_cover_offset(chunk, depth)], end - chunk,
+				&shadow_bytes[j * payload_chunk_blocks], chunk, depth);
+		}
+
+		for (i = chunk; i < end; i++)
+		{
+			for (j = 0; j < m; j++)
+			{
+				dec->values[j] = shadow_bytes[j * payload_chunk_blocks + (i - chunk)];
+			}
+
+			robust_decode_block(dec, &payload[i * k], k);
+		}
+	}
+
+	if (remainder)
+	{
+		for (j = 0; j < m; j++)
+		{
+			dec->values[j] = recover_lsb_width1(bmp_get_pixels(shadows[j]), depth);
+		}
+
+		robust_decode_block(dec, &payload[blocks * k], remainder);
+	}
+
+	printv("Blocks with corrected errors: %lu\n", (unsigned long)dec->corrected_blocks);
+
+	for (j = 0; j < m; j++)
+	{
+		if (dec->disagreements[j])
+		{
+			printe("Warning: shadow index %u disagrees in %lu blocks.\n",
+				bmp_get_header(shadows[j])->shadow_index, (unsigned long)dec->disagreements[j]);
+		}
+	}
+
+	int status = 0;
+	if (dec->failed_blocks)
+	{
+		printe("Error: %lu blocks have more than %lu wrong shadows and could not be corrected.\n",
+			(unsigned long)dec->failed_blocks, (unsigned long)dec->e);
+		status = -1;
+	}
+
+	robust_decoder_free(dec);
+	return status;
+}
+
+bmp_op_t robust_evaluate(bmp_op_t *coefs, size_t len, bmp_op_t *powers)
+{
+	bmp_op_t aux = 0;
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		aux = (aux + coefs[i] * powers[i]) % 251;
+	}
+
+	return aux;
+}
+
+size_t robust_count_disagreements(struct robust_decoder *dec, int record)
+{
+	size_t i, count = 0;
+	for (i = 0; i < dec->m; i++)
+	{
+		if (robust_evaluate(dec->coefs, dec->k, dec->powers[i]) != dec->values[i] % 251)
+		{
+			count++;
+			if (record)
+			{
+				dec->disagreements[i]++;
+			}
+		}
+	}
+
+	return count;
+}
+
+int robust_interpolate_first(struct robust_decoder *dec)
+{
+	size_t i, j, k = dec->k;
+	for (i = 0; i < k; i++)
+	{
+		for (j = 0; j < k; j++)
+		{
+			dec->system[i][j] = dec->powers[i][j];
+		}
+		dec->system[i][k] = dec->values[i] % 251;
+	}
+
+	if (gauss_solve(dec->system, k, k, dec->coefs, dec->pivots) != 0)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+int robust_berlekamp_welch(struct robust_decoder *dec)
+{
+	size_t i, j, k = dec->k, e = dec->e;
+	size_t q_len = k + e;
+
+	// Q(x_i) - y_i * (E(x_i) - x_i^e) = y_i * x_i^e, with E monic of degree e
+	for (i = 0; i < dec->m; i++)
+	{
+		bmp_op_t y = dec->values[i] % 251;
+		for (j = 0; j < q_len; j++)
+		{
+			dec->system[i][j] = dec->powers[i][j];
+		}
+		for (j = 0; j < e; j++)
+		{
+			dec->system[i][q_len + j] = restrain_mod(-y * dec->powers[i][j]);
+		}
+		dec->system[i][q_len + e] = (y * dec->powers[i][e]) % 251;
+	}
+
+	if (gauss_solve(dec->system, dec->m, q_len + e, dec->solution, dec->pivots) != 0)
+	{
+		return -1;
+	}
+
+	// P = Q / E, the division must be exact
+	bmp_op_t *q = dec->solution;
+	bmp_op_t *err = &dec->solution[q_len];
+	size_t d, t;
+
+	for (d = q_len; d-- > e;)
+	{
+		bmp_op_t c = q[d];
+		dec->coefs[d - e] = c;
+		for (t = 0; t < e; t++)
+		{
+			q[d - e + t] = restrain_mod(q[d - e + t] - c * err[t]);
+		}
+		q[d] = 0;
+	}
+
+	for (d = 0; d < e; d++)
+	{
+		if (q[d] != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int robust_decode_block(struct robust_decoder *dec, bmp_byte_t *block, size_t len)
+{
+	size_t i;
+	int decoded = robust_interpolate_first(dec) == 0 && robust_count_disagreements(dec, 0) == 0;
+
+	if (!decoded && dec->e > 0)
+	{
+		decoded = robust_berlekamp_welch(dec) == 0 && robust_count_disagreements(dec, 0) <= dec->e;
+		if (decoded)
+		{
+			dec->corrected_blocks++;
+		}
+	}
+
+	if (!decoded)
+	{
+		// Keep the interpolation of the first k shadows
+		robust_interpolate_first(dec);
+		dec->failed_blocks++;
+	}
+
+	robust_count_disagreements(dec, 1);
+
+	for (i = 0; i < len; i++)
+	{
+		block[i] = (bmp_byte_t)dec->coefs[i];
+	}
+
+	return decoded ? 0 : -1;
+}
+
+int robust_decode_shares(struct robust_decoder *dec, const bmp_byte_t *shares, bmp_byte_t *block, size_t len)
+{
+	size_t j;
+	for (j = 0; j < dec->m; j++)
+	{
+		dec->values[j] = shares[j];
+	}
+
+	return robust_decode_block(dec, block, len);
+}
+
+struct robust_decoder *robust_decoder_init(struct bmp_handle **shadows, size_t m, size_t k)
+{
+	struct arena *arena = arena_create();
+	if (arena == NULL)
+	{
+		return NULL;
+	}
+
+	struct robust_decoder *dec = arena_alloc(arena, sizeof(struct robust_decoder));
+	if (dec == NULL)
+	{
+		arena_destroy(arena);
+		return NULL;
+	}
+
+	dec->arena = arena;
+	dec->m = m;
+	dec->k = k;
+	dec->e = (m - k) / 2;
+
+	size_t cols = k + 2 * dec->e;
+	dec->powers = arena_alloc_matrix(arena, m, k + dec->e + 1);
+	dec->system = arena_alloc_matrix(arena, m, cols + 1);
+	dec->solution = arena_alloc(arena, (cols + 1) * sizeof(bmp_op_t));
+	dec->values = arena_alloc(arena, m * sizeof(bmp_op_t));
+	dec->coefs = arena_alloc(arena, k * sizeof(bmp_op_t));
+	dec->disagreements = arena_alloc(arena, m * sizeof(size_t));
+	dec->pivots = arena_alloc(arena, m * sizeof(size_t));
+
+	if (dec->powers == NULL || dec->system == NULL || dec->solution == NULL || dec->values == NULL ||
+		dec->coefs == NULL || dec->disagreements == NULL || dec->pivots == NULL)
+	{
+		robust_decoder_free(dec);
+		return NULL;
+	}
+
+	size_t i, j;
+	for (i = 0; i < m; i++)
+	{
+		bmp_op_t x = bmp_get_header(shadows[i])->shadow_index % 251;
+		dec->powers[i][0] = 1;
+		for (j = 1; j <= k + dec->e; j++)
+		{
+			dec->powers[i][j] = (dec->powers[i][j - 1] * x) % 251;
+		}
+	}
+
+	return dec;
+}
+
+void robust_decoder_free(struct robust_decoder *dec)
+{
+	arena_destroy(dec->arena);
+}
@@ -0,0 +1,25 @@
+#ifndef ROBUST_H
+#define ROBUST_H
+
+#include "bmp.h"
+
+/*
+ * Recovers the secret from m >= k shadows, decoding every block as a Reed-Solomon code word
+ * (Berlekamp-Welch) so up to (m - k) / 2 wrong shadows are tolerated. Shadows that disagree
+ * with the decoded polynomials are reported. Like recover(), bmp is freed on failure.
+ */
+int robust_recover(struct bmp_handle *bmp, struct bmp_handle **shadows, size_t m, size_t k, int permute);
+int robust_recover_payload(bmp_byte_t *payload, size_t size, struct bmp_handle **shadows, size_t m, size_t k);
+
+/*
+ * Decoder of single blocks for the m shadows given (only their indexes are used). Decodes the
+ * shares of one block into its len coefficients, returning -1 if more than (m - k) / 2 of them
+ * are wrong.
+ */
+struct robust_decoder;
+struct robust_decoder *robust_decoder_init(struct bmp_handle **shadows, size_t m, size_t k);
+int robust_decode_shares(struct robust_decoder *dec, const bmp_byte_t *shares, bmp_byte_t *block, size_t len);
+void robust_decoder_free(struct robust_decoder *dec);
+
+#endif
+/* ROBUST_H */
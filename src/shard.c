@@ -0,0 +1,490 @@
+#include "shard.h"
+#include "distribute.h"
+#include "recover.h"
+#include "utils.h"
+#include "lsb.h"
+#include "arena.h"
+#include "kernels.h"
+#include "cripto.h"
+#include "cripto_rand.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SHARD_SEGMENT_MAGIC 0x47535243 // "CRSG"
+
+#pragma pack(push, 1)
+
+// Header of a segment file, followed by length bytes
+struct shard_segment {
+	bmp_dword_t magic; // SHARD_SEGMENT_MAGIC
+	bmp_word_t shard;
+	bmp_word_t shards;
+	bmp_word_t shadow_index; // 0 for segments of a recovered payload
+	bmp_word_t seed;
+	bmp_word_t has_extra; // extra is the share of the last (padded) block
+	bmp_word_t extra;
+	uint64_t offset; // in the pixel data of the shadow, or in the payload
+	uint64_t length;
+	struct bmp_shadow_info info;
+};
+
+#pragma pack(pop)
+
+int shard_segment_path(char *path, size_t size, const char *dir, const char *name, int shard);
+int shard_write_segment(const char *path, struct shard_segment *segment, bmp_byte_t *data);
+bmp_byte_t *shard_read_segment(const char *path, struct shard_segment *segment);
+int shard_merge_cover(struct bmp_handle *cover, const char *base);
+void shard_remove_segments(const char *base, int shards);
+
+void shard_block_range(size_t blocks, int shard, int shards, size_t *start, size_t *end)
+{
+	size_t units = (blocks + SHARD_ALIGN_BLOCKS - 1) / SHARD_ALIGN_BLOCKS;
+
+	*start = units * shard / shards * SHARD_ALIGN_BLOCKS;
+	*end = units * (shard + 1) / shards * SHARD_ALIGN_BLOCKS;
+
+	if (*start > blocks)
+	{
+		*start = blocks;
+	}
+
+	if (*end > blocks)
+	{
+		*end = blocks;
+	}
+}
+
+int shard_distribute(struct bmp_handle *secret_bmp, struct bmp_handle **covers, const char *dir, char **names,
+	size_t n, size_t k, int permute, int depth, bmp_word_t seed, int shard, int shards)
+{
+	bmp_byte_t *pixels = bmp_get_pixels(secret_bmp);
+	size_t size = bmp_data_size(secret_bmp);
+
+	struct shard_segment segment;
+	memset(&segment, 0, sizeof(segment));
+	distribute_init_info(&segment.info, secret_bmp, distribute_truncate_image(pixels, size), k, depth);
+
+	if (distribute_check_capacity(covers, n, size, k, depth) != 0)
+	{
+		return -1;
+	}
+
+	size_t blocks = size / k, remainder = size % k;
+	size_t start, end;
+	shard_block_range(blocks, shard, shards, &start, &end);
+
+	int last = shard == shards - 1;
+	size_t count = (end - start) * k + (last ? remainder : 0);
+	size_t offset = lsb_cover_offset(start, depth);
+	size_t len = lsb_cover_bytes(end, depth) - offset;
+
+	printv("Shard %d of %d: blocks %lu to %lu\n", shard, shards, (unsigned long)start, (unsigned long)end);
+
+	int status = -1;
+	size_t i, j, chunk, chunk_end;
+
+	// Payload of the range (and the padded last block), then the shares of a chunk and the cover bytes
+	bmp_byte_t *payload = arena_alloc_buffer(((end - start + 1) * k + payload_chunk_blocks + k) *
+		sizeof(bmp_byte_t));
+	bmp_byte_t *cover = arena_alloc_buffer((len + 1) * sizeof(bmp_byte_t));
+	if (payload == NULL || cover == NULL)
+	{
+		goto free_buffers;
+	}
+
+	bmp_byte_t *shadow_bytes = &payload[(end - start + 1) * k];
+	bmp_byte_t *powers = &shadow_bytes[payload_chunk_blocks];
+
+	// Only the bytes of this shard are permuted, which is why the permutation must work per index
+	for (i = 0; i < count; i++)
+	{
+		size_t index = start * k + i;
+		payload[i] = pixels[permute == PERMUTE_INDEX ? utils_permute_index(index, size, seed) : index];
+	}
+
+	bmp_byte_t *extra_coefs = &payload[(end - start) * k];
+	if (last && remainder)
+	{
+		randomize(time(NULL));
+		for (i = remainder; i < k; i++)
+		{
+			extra_coefs[i] = (bmp_byte_t)randint(250);
+		}
+	}
+
+	kernel_evaluate_t evaluate = kernel_evaluate_for(k);
+
+	segment.shard = shard;
+	segment.shards = shards;
+	segment.seed = seed;
+	segment.has_extra = last && remainder;
+	segment.offset = offset;
+	segment.length = len;
+
+	for (j = 0; j < n; j++)
+	{
+		bmp_shadow_index_t x = j + 1;
+		char path[FILENAME_MAX];
+
+		if (len > 0 && bmp_read_range(covers[j], offset, cover, len) != 0)
+		{
+			goto free_buffers;
+		}
+
+		kernel_powers(x, k, powers);
+		for (chunk = start; chunk < end; chunk = chunk_end)
+		{
+			chunk_end = chunk + payload_chunk_blocks < end ? chunk + payload_chunk_blocks : end;
+			evaluate(&payload[(chunk - start) * k], chunk_end - chunk, k, powers, shadow_bytes);
+			lsb_embed(shadow_bytes, chunk_end - chunk, &cover[lsb_cover_offset(chunk, depth) - offset], chunk, depth);
+		}
+
+		segment.shadow_index = x;
+		segment.extra = segment.has_extra ? distribute_evaluate_pol(extra_coefs, k, x) : 0;
+
+		if (shard_segment_path(path, sizeof(path), dir, names[j], shard) != 0 ||
+			shard_write_segment(path, &segment, cover) != 0)
+		{
+			printe("Error: could not write the segment of %s.\n", names[j]);
+			goto free_buffers;
+		}
+	}
+
+	printv("Bytes written to each segment: %lu\n", (unsigned long)len);
+	status = 0;
+
+	// Error handling
+free_buffers:
+	arena_free_buffer(cover);
+	arena_free_buffer(payload);
+
+	return status;
+}
+
+int shard_recover(struct bmp_handle **shadows, size_t k, size_t size, const char *secret_filename, int shard,
+	int shards)
+{
+	size_t blocks = size / k, remainder = size % k;
+	size_t start, end;
+	shard_block_range(blocks, shard, shards, &start, &end);
+
+	int last = shard == shards - 1;
+
+	struct shard_segment segment;
+	memset(&segment, 0, sizeof(segment));
+	segment.shard = shard;
+	segment.shards = shards;
+	segment.seed = bmp_get_header(shadows[0])->seed;
+	segment.offset = start * k;
+	segment.length = (end - start) * k + (last ? remainder : 0);
+
+	if (bmp_get_shadow_info(shadows[0]) != NULL)
+	{
+		segment.info = *bmp_get_shadow_info(shadows[0]);
+	}
+
+	printv("Shard %d of %d: blocks %lu to %lu\n", shard, shards, (unsigned long)start, (unsigned long)end);
+
+	bmp_byte_t *payload = arena_alloc_buffer((segment.length + 1) * sizeof(bmp_byte_t));
+	if (payload == NULL)
+	{
+		return -1;
+	}
+
+	// An empty shard that is not the last one must not recover the remainder
+	if ((end > start || last) && recover_payload_range(payload, size, start, end, shadows, k, NULL) != 0)
+	{
+		arena_free_buffer(payload);
+		return -1;
+	}
+
+	char path[FILENAME_MAX];
+	int status = 0;
+
+	if (shard_segment_path(path, sizeof(path), NULL, secret_filename, shard) != 0 ||
+		shard_write_segment(path, &segment, payload) != 0)
+	{
+		printe("Error: could not write the segment of %s.\n", secret_filename);
+		status = -1;
+	}
+
+	arena_free_buffer(payload);
+	return status;
+}
+
+int shard_merge_shadows(struct bmp_handle **covers, const char *dir, char **names, size_t count)
+{
+	size_t i, merged = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		char base[FILENAME_MAX];
+		if (snprintf(base, sizeof(base), "%s/%s", dir, names[i]) >= sizeof(base))
+		{
+			return -1;
+		}
+
+		int status = shard_merge_cover(covers[i], base);
+		if (status < 0)
+		{
+			printe("Error: the segments of %s could not be merged.\n", names[i]);
+			return -1;
+		}
+
+		merged += status;
+	}
+
+	if (merged == 0)
+	{
+		printe("Error: no segments were found in %s.\n", dir);
+		return -1;
+	}
+
+	printv("Shadows merged: %lu\n", (unsigned long)merged);
+	return 0;
+}
+
+int shard_merge_secret(struct bmp_handle *secret_bmp, struct bmp_handle *shadow, const char *secret_filename,
+	int permute)
+{
+	size_t size;
+	bmp_byte_t *payload = recover_alloc_payload(secret_bmp, shadow, &size);
+	if (payload == NULL)
+	{
+		return -1;
+	}
+
+	struct shard_segment segment;
+	size_t filled = 0;
+	int i, shards = 1;
+
+	// Segments must cover the payload in order, without gaps
+	for (i = 0; i < shards; i++)
+	{
+		char path[FILENAME_MAX];
+		bmp_byte_t *data = NULL;
+
+		if (shard_segment_path(path, sizeof(path), NULL, secret_filename, i) != 0 ||
+			(data = shard_read_segment(path, &segment)) == NULL)
+		{
+			printe("Error: segment %d of %s is missing or invalid.\n", i, secret_filename);
+			goto free_payload;
+		}
+
+		if (i == 0)
+		{
+			shards = segment.shards;
+		}
+
+		if (segment.shard != i || segment.shards != shards || segment.shadow_index != 0 ||
+			segment.seed != bmp_get_header(shadow)->seed || segment.offset != filled ||
+			segment.length > size - filled)
+		{
+			printe("Error: segment %d of %s does not belong to these shadows.\n", i, secret_filename);
+			arena_free_buffer(data);
+			goto free_payload;
+		}
+
+		memcpy(&payload[filled], data, segment.length);
+		filled += segment.length;
+		arena_free_buffer(data);
+	}
+
+	if (filled != size)
+	{
+		printe("Error: the segments of %s hold %lu of %lu bytes.\n", secret_filename, (unsigned long)filled,
+			(unsigned long)size);
+		goto free_payload;
+	}
+
+	if (recover_unpack(secret_bmp, payload, size, shadow, permute) != 0 ||
+		recover_write_checked(secret_bmp, shadow) != 0)
+	{
+		return -1;
+	}
+
+	shard_remove_segments(secret_filename, shards);
+	return 0;
+
+	// Error handling
+free_payload:
+	if (payload != bmp_get_pixels(secret_bmp))
+	{
+		arena_free_buffer(payload);
+	}
+
+	return -1;
+}
+
+// Returns 1 if the segments of the cover were merged, 0 if it has none and -1 on error
+int shard_merge_cover(struct bmp_handle *cover, const char *base)
+{
+	struct shard_segment first, segment;
+	char path[FILENAME_MAX];
+	bmp_byte_t *data;
+
+	if (shard_segment_path(path, sizeof(path), NULL, base, 0) != 0)
+	{
+		return -1;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	fclose(file);
+
+	int i, shards = 1, has_extra = 0;
+	bmp_word_t extra = 0;
+	size_t filled = 0;
+
+	for (i = 0; i < shards; i++)
+	{
+		if (shard_segment_path(path, sizeof(path), NULL, base, i) != 0 ||
+			(data = shard_read_segment(path, &segment)) == NULL)
+		{
+			printe("Error: segment %d of %s is missing or invalid.\n", i, base);
+			return -1;
+		}
+
+		if (i == 0)
+		{
+			first = segment;
+			shards = segment.shards;
+		}
+
+		if (segment.shard != i || segment.shards != shards || segment.shadow_index != first.shadow_index ||
+			segment.seed != first.seed || segment.offset != filled ||
+			segment.offset + segment.length > bmp_data_size(cover))
+		{
+			printe("Error: segment %d of %s does not belong to the same distribution.\n", i, base);
+			arena_free_buffer(data);
+			return -1;
+		}
+
+		int status = segment.length > 0 ? bmp_write_range(cover, segment.offset, data, segment.length) : 0;
+		arena_free_buffer(data);
+		if (status != 0)
+		{
+			return -1;
+		}
+
+		if (segment.has_extra)
+		{
+			has_extra = 1;
+			extra = segment.extra;
+		}
+
+		filled += segment.length;
+	}
+
+	if (has_extra)
+	{
+		bmp_byte_t bytes[8];
+		if (bmp_read_range(cover, 0, bytes, sizeof(bytes)) != 0)
+		{
+			return -1;
+		}
+
+		distribute_lsb_width1((bmp_byte_t)extra, bytes, first.info.lsb_depth);
+
+		if (bmp_write_range(cover, 0, bytes, sizeof(bytes)) != 0)
+		{
+			return -1;
+		}
+	}
+
+	struct bmp_header *header = bmp_get_header(cover);
+	header->seed = first.seed;
+	header->shadow_index = first.shadow_index;
+	bmp_set_shadow_info(cover, &first.info);
+
+	if (bmp_write_header(cover) != 0 || bmp_write_shadow_info(cover) != 0)
+	{
+		return -1;
+	}
+
+	shard_remove_segments(base, shards);
+	return 1;
+}
+
+int shard_segment_path(char *path, size_t size, const char *dir, const char *name, int shard)
+{
+	int len = dir != NULL ? snprintf(path, size, "%s/%s%s%d", dir, name, SHARD_SUFFIX, shard) :
+		snprintf(path, size, "%s%s%d", name, SHARD_SUFFIX, shard);
+
+	return len < 0 || len >= size ? -1 : 0;
+}
+
+int shard_write_segment(const char *path, struct shard_segment *segment, bmp_byte_t *data)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	segment->magic = SHARD_SEGMENT_MAGIC;
+	segment->info.magic = BMP_SHADOW_INFO_MAGIC;
+	segment->info.size = sizeof(struct bmp_shadow_info);
+
+	int status = 0;
+	if (fwrite(segment, sizeof(struct shard_segment), 1, file) != 1 ||
+		fwrite(data, sizeof(bmp_byte_t), segment->length, file) != segment->length)
+	{
+		status = -1;
+	}
+
+	if (fclose(file) != 0)
+	{
+		status = -1;
+	}
+
+	return status;
+}
+
+bmp_byte_t *shard_read_segment(const char *path, struct shard_segment *segment)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	bmp_byte_t *data = NULL;
+
+	if (fread(segment, sizeof(struct shard_segment), 1, file) != 1 || segment->magic != SHARD_SEGMENT_MAGIC ||
+		segment->shards == 0 || segment->shards > SHARD_MAX || segment->length > SIZE_MAX - 1)
+	{
+		goto close_file;
+	}
+
+	data = arena_alloc_buffer((segment->length + 1) * sizeof(bmp_byte_t));
+	if (data != NULL && fread(data, sizeof(bmp_byte_t), segment->length, file) != segment->length)
+	{
+		arena_free_buffer(data);
+		data = NULL;
+	}
+
+	// Error handling
+close_file:
+	fclose(file);
+	return data;
+}
+
+void shard_remove_segments(const char *base, int shards)
+{
+	char path[FILENAME_MAX];
+	int i;
+
+	for (i = 0; i < shards; i++)
+	{
+		if (shard_segment_path(path, sizeof(path), NULL, base, i) == 0)
+		{
+			remove(path);
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "bmp.h"
+
+#define SHARD_SUFFIX ".seg" // segment i of an image is stored in "<image>.seg<i>"
+#define SHARD_ALIGN_BLOCKS 24 // shard boundaries fall on whole cover bytes for every LSB depth
+#define SHARD_MAX 1024
+
+/*
+ * Sharding splits the blocks of the payload in m contiguous ranges, so that m processes (or
+ * machines) can share or recover one range each. Every process writes its part to segment
+ * files, which the merge step assembles into the final images.
+ */
+
+// Blocks [start, end) of shard i of m. The last shard also takes the remainder of the payload.
+void shard_block_range(size_t blocks, int shard, int shards, size_t *start, size_t *end);
+
+/*
+ * Shares the blocks of shard i of m into one segment per cover: "<dir>/<names[j]>.seg<i>".
+ * The covers only need their headers loaded. permute must be computable per index.
+ */
+int shard_distribute(struct bmp_handle *secret_bmp, struct bmp_handle **covers, const char *dir, char **names,
+	size_t n, size_t k, int permute, int depth, bmp_word_t seed, int shard, int shards);
+
+// Recovers the payload bytes of shard i of m from k shadows into "<secret_filename>.seg<i>"
+int shard_recover(struct bmp_handle **shadows, size_t k, size_t size, const char *secret_filename, int shard,
+	int shards);
+
+// Writes the segments of every cover in dir that has them, and removes the segments
+int shard_merge_shadows(struct bmp_handle **covers, const char *dir, char **names, size_t count);
+
+// Assembles the payload segments of secret_filename, undoes the permutation and writes the secret
+int shard_merge_secret(struct bmp_handle *secret_bmp, struct bmp_handle *shadow, const char *secret_filename,
+	int permute);
+
+#endif
+/* SHARD_H */
@@ -0,0 +1,270 @@
+#include "span.h"
+#include "loader.h"
+#include "pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+int span_list_parts(const char *path, char ***files, size_t *count);
+int span_order_parts(struct bmp_handle **parts, size_t count, const char *path);
+int span_compare_names(const void *a, const void *b);
+int span_compare_parts(const void *a, const void *b);
+int span_load(void *arg, size_t index);
+
+struct bmp_handle **span_open(const char *dir, char **names, size_t count, int load_pixels, int shadows)
+{
+	struct bmp_handle **spans = calloc(count, sizeof(struct bmp_handle*));
+	char **paths = calloc(count, sizeof(char*));
+	char ***files = calloc(count, sizeof(char**));
+	size_t *part_counts = calloc(count, sizeof(size_t));
+	char **all_files = NULL;
+	struct bmp_handle **parts = NULL;
+	size_t i, j, total = 0, first = 0;
+
+	if (spans == NULL || paths == NULL || files == NULL || part_counts == NULL)
+	{
+		goto free_lists;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		paths[i] = malloc(strlen(dir) + strlen(names[i]) + 2);
+		if (paths[i] == NULL)
+		{
+			goto free_lists;
+		}
+
+		sprintf(paths[i], "%s/%s", dir, names[i]);
+		if (span_list_parts(paths[i], &files[i], &part_counts[i]) != 0)
+		{
+			goto free_lists;
+		}
+
+		total += part_counts[i];
+	}
+
+	all_files = malloc(total * sizeof(char*));
+	if (all_files == NULL)
+	{
+		goto free_lists;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		memcpy(&all_files[first], files[i], part_counts[i] * sizeof(char*));
+		first += part_counts[i];
+	}
+
+	// The parts of every participant are opened at once, as if they were separate covers
+	parts = loader_open_images(all_files, total, 0);
+	if (parts == NULL)
+	{
+		goto free_lists;
+	}
+
+	for (i = 0, first = 0; i < count; i++)
+	{
+		struct bmp_handle **own = malloc(part_counts[i] * sizeof(struct bmp_handle*));
+		if (own == NULL)
+		{
+			goto free_spans;
+		}
+
+		memcpy(own, &parts[first], part_counts[i] * sizeof(struct bmp_handle*));
+		first += part_counts[i];
+
+		if (shadows && span_order_parts(own, part_counts[i], paths[i]) != 0)
+		{
+			bmp_free_list(own, part_counts[i]);
+			free(own);
+			goto free_spans;
+		}
+
+		// The span owns its parts from here on, even if it can not be opened
+		spans[i] = bmp_open_span(own, part_counts[i], paths[i]);
+		if (spans[i] == NULL)
+		{
+			printe("Error: the covers in %s can not hold a shadow together.\n", paths[i]);
+			goto free_spans;
+		}
+	}
+
+	if (load_pixels && pool_run(count, span_load, spans) != 0)
+	{
+		printe("Error: the pixels of the covers could not be read.\n");
+		goto free_spans;
+	}
+
+	printv("Shadows spanning %lu covers: %lu\n", (unsigned long)total, (unsigned long)count);
+
+	free(parts);
+	free(all_files);
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < part_counts[i]; j++)
+		{
+			free(files[i][j]);
+		}
+
+		free(files[i]);
+		free(paths[i]);
+	}
+
+	free(part_counts);
+	free(files);
+	free(paths);
+
+	return spans;
+
+	// Error handling
+free_spans:
+	bmp_free_list(spans, count);
+	bmp_free_list(&parts[first], total - first);
+	free(parts);
+free_lists:
+	free(all_files);
+	for (i = 0; files != NULL && i < count; i++)
+	{
+		for (j = 0; files[i] != NULL && j < part_counts[i]; j++)
+		{
+			free(files[i][j]);
+		}
+
+		free(files[i]);
+	}
+
+	for (i = 0; paths != NULL && i < count; i++)
+	{
+		free(paths[i]);
+	}
+
+	free(part_counts);
+	free(files);
+	free(paths);
+	free(spans);
+
+	return NULL;
+}
+
+// The .bmp files of a participant directory, sorted by name
+int span_list_parts(const char *path, char ***files, size_t *count)
+{
+	DIR *dp = opendir(path);
+	if (dp == NULL)
+	{
+		printe("Error: unable to open participant directory %s.\n", path);
+		return -1;
+	}
+
+	size_t capacity = 8;
+	struct dirent *ep;
+
+	*count = 0;
+	*files = malloc(capacity * sizeof(char*));
+	if (*files == NULL)
+	{
+		goto close_dir;
+	}
+
+	while ((ep = readdir(dp)))
+	{
+		size_t len = strlen(ep->d_name);
+		if (len < 5 || ep->d_type != DT_REG || strcmp(&ep->d_name[len - 4], ".bmp") != 0)
+		{
+			continue;
+		}
+
+		if (*count == capacity)
+		{
+			capacity *= 2;
+			char **larger = realloc(*files, capacity * sizeof(char*));
+			if (larger == NULL)
+			{
+				goto close_dir;
+			}
+
+			*files = larger;
+		}
+
+		char *file = malloc(strlen(path) + len + 2);
+		if (file == NULL)
+		{
+			goto close_dir;
+		}
+
+		sprintf(file, "%s/%s", path, ep->d_name);
+		(*files)[(*count)++] = file;
+	}
+
+	closedir(dp);
+
+	if (*count == 0 || *count > SPAN_MAX_PARTS)
+	{
+		printe("Error: %s must hold between 1 and %d .bmp files.\n", path, SPAN_MAX_PARTS);
+		return -1;
+	}
+
+	qsort(*files, *count, sizeof(char*), span_compare_names);
+	return 0;
+
+	// Error handling
+close_dir:
+	closedir(dp);
+
+	return -1;
+}
+
+/*
+ * Puts the parts of a shadow in the order stored in them, and checks that they are all of it and
+ * that they belong together.
+ */
+int span_order_parts(struct bmp_handle **parts, size_t count, const char *path)
+{
+	size_t i;
+	for (i = 0; i < count; i++)
+	{
+		struct bmp_shadow_info *info = bmp_get_shadow_info(parts[i]);
+		if (info == NULL || info->parts != count)
+		{
+			printe("Error: the shadow in %s spans %u covers, but %lu were found.\n", path,
+				info != NULL ? info->parts : 0, (unsigned long)count);
+			return -1;
+		}
+	}
+
+	qsort(parts, count, sizeof(struct bmp_handle*), span_compare_parts);
+
+	struct bmp_header *first = bmp_get_header(parts[0]);
+	for (i = 0; i < count; i++)
+	{
+		struct bmp_header *header = bmp_get_header(parts[i]);
+		if (bmp_get_shadow_info(parts[i])->part != i || header->seed != first->seed ||
+			header->shadow_index != first->shadow_index)
+		{
+			printe("Error: %s is not part %lu of the shadow in %s.\n", bmp_get_filename(parts[i]),
+				(unsigned long)i, path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int span_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+int span_compare_parts(const void *a, const void *b)
+{
+	bmp_word_t part_a = bmp_get_shadow_info(*(struct bmp_handle**)a)->part;
+	bmp_word_t part_b = bmp_get_shadow_info(*(struct bmp_handle**)b)->part;
+	return (part_a > part_b) - (part_a < part_b);
+}
+
+int span_load(void *arg, size_t index)
+{
+	struct bmp_handle **spans = arg;
+	return bmp_load_pixels(spans[index]);
+}
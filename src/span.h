@@ -0,0 +1,23 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include "bmp.h"
+
+#define SPAN_MAX_PARTS 65535 // the position of a part is a word of the shadow information
+
+/*
+ * The shadow of a participant may span an ordered list of covers, kept in a directory of its own:
+ * their pixel data, one after the other, is shared or recovered as if it were a single cover (see
+ * bmp_open_span()), so no cover has to be as large as the whole shadow. Every part stores its
+ * position in the shadow, and recovering it concatenates the parts in that order.
+ */
+
+/*
+ * Opens the shadow of each participant directory "<dir>/<names[i]>": its .bmp files in name order,
+ * or, if shadows is set, in the order stored in them, which must make up a whole shadow. The parts
+ * are opened, and their pixels loaded if load_pixels is set, concurrently (see pool.h).
+ */
+struct bmp_handle **span_open(const char *dir, char **names, size_t count, int load_pixels, int shadows);
+
+#endif
+/* SPAN_H */
@@ -0,0 +1,279 @@
+#include "tar.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TAR_SIZE_DIGITS 11
+#define TAR_BASE256 0x80
+#define TAR_FILE_MODE 0644
+
+#pragma pack(push, 1)
+
+struct tar_header {
+	char name[TAR_NAME_LEN];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char checksum[8];
+	char type;
+	char linkname[100];
+	char magic[6]; // "ustar"
+	char version[2]; // "00"
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+};
+
+#pragma pack(pop)
+
+unsigned int tar_checksum(const struct tar_header *header);
+int tar_write_all(int fd, const void *buffer, size_t len);
+int tar_read_all(int fd, void *buffer, size_t len);
+int tar_skip(int fd, size_t len);
+size_t tar_padding_for(size_t size);
+
+int tar_write_header(int fd, const char *name, size_t size)
+{
+	struct tar_header header;
+	memset(&header, 0, sizeof(header));
+
+	if (strlen(name) >= TAR_NAME_LEN)
+	{
+		return -1;
+	}
+
+	strcpy(header.name, name);
+	snprintf(header.mode, sizeof(header.mode), "%07o", TAR_FILE_MODE);
+	snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+	snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+	snprintf(header.mtime, sizeof(header.mtime), "%011lo", (unsigned long)time(NULL));
+
+	if ((uint64_t)size >> (3 * TAR_SIZE_DIGITS) == 0)
+	{
+		snprintf(header.size, sizeof(header.size), "%011lo", (unsigned long)size);
+	}
+	else
+	{
+		// Big-endian binary, flagged by the high bit of the first byte
+		uint64_t value = size;
+		int i;
+		for (i = sizeof(header.size) - 1; i > 0; i--, value >>= 8)
+		{
+			header.size[i] = (char)(value & 0xFF);
+		}
+
+		header.size[0] = (char)TAR_BASE256;
+	}
+
+	header.type = '0';
+	memcpy(header.magic, "ustar", 6);
+	memcpy(header.version, "00", 2);
+	snprintf(header.checksum, sizeof(header.checksum), "%06o", tar_checksum(&header));
+	header.checksum[7] = ' ';
+
+	return tar_write_all(fd, &header, sizeof(header));
+}
+
+int tar_write_padding(int fd, size_t size)
+{
+	static const char zeros[TAR_BLOCK_SIZE];
+	return tar_write_all(fd, zeros, tar_padding_for(size));
+}
+
+int tar_write_end(int fd)
+{
+	static const char zeros[2 * TAR_BLOCK_SIZE];
+	return tar_write_all(fd, zeros, sizeof(zeros));
+}
+
+int tar_read_file(int fd, char *name, size_t name_len, bmp_byte_t **data, size_t *size)
+{
+	struct tar_header header;
+
+	while (1)
+	{
+		if (tar_read_all(fd, &header, sizeof(header)) != 0)
+		{
+			return -1;
+		}
+
+		// The archive ends with zero blocks
+		if (header.name[0] == 0 && tar_checksum(&header) == 8 * ' ')
+		{
+			return 1;
+		}
+
+		if (strtoul(header.checksum, NULL, 8) != tar_checksum(&header))
+		{
+			return -1;
+		}
+
+		uint64_t value = 0;
+		if ((unsigned char)header.size[0] & TAR_BASE256)
+		{
+			int i;
+			for (i = 1; i < sizeof(header.size); i++)
+			{
+				value = (value << 8) | (unsigned char)header.size[i];
+			}
+		}
+		else
+		{
+			char digits[sizeof(header.size) + 1];
+			memcpy(digits, header.size, sizeof(header.size));
+			digits[sizeof(header.size)] = 0;
+			value = strtoull(digits, NULL, 8);
+		}
+
+		if (value > SIZE_MAX - TAR_BLOCK_SIZE)
+		{
+			return -1;
+		}
+
+		*size = value;
+
+		if (header.type != '0' && header.type != 0)
+		{
+			if (tar_skip(fd, *size + tar_padding_for(*size)) != 0)
+			{
+				return -1;
+			}
+
+			continue;
+		}
+
+		int len;
+		if (header.prefix[0] != 0)
+		{
+			len = snprintf(name, name_len, "%.*s/%.*s", (int)sizeof(header.prefix), header.prefix,
+				(int)sizeof(header.name), header.name);
+		}
+		else
+		{
+			len = snprintf(name, name_len, "%.*s", (int)sizeof(header.name), header.name);
+		}
+
+		if (len < 0 || len >= name_len)
+		{
+			return -1;
+		}
+
+		*data = malloc(*size + 1);
+		if (*data == NULL)
+		{
+			return -1;
+		}
+
+		if (tar_read_all(fd, *data, *size) != 0 || tar_skip(fd, tar_padding_for(*size)) != 0)
+		{
+			free(*data);
+			*data = NULL;
+			return -1;
+		}
+
+		return 0;
+	}
+}
+
+// Sum of the header bytes, with the checksum field counted as spaces
+unsigned int tar_checksum(const struct tar_header *header)
+{
+	const unsigned char *bytes = (const unsigned char*)header;
+	unsigned int sum = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(struct tar_header); i++)
+	{
+		if (i >= offsetof(struct tar_header, checksum) && i < offsetof(struct tar_header, type))
+		{
+			sum += ' ';
+		}
+		else
+		{
+			sum += bytes[i];
+		}
+	}
+
+	return sum;
+}
+
+size_t tar_padding_for(size_t size)
+{
+	return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+int tar_write_all(int fd, const void *buffer, size_t len)
+{
+	const char *bytes = buffer;
+
+	while (len > 0)
+	{
+		ssize_t written = write(fd, bytes, len);
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (written <= 0)
+		{
+			return -1;
+		}
+
+		bytes += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+int tar_read_all(int fd, void *buffer, size_t len)
+{
+	char *bytes = buffer;
+
+	while (len > 0)
+	{
+		ssize_t count = read(fd, bytes, len);
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		// A truncated archive is an error
+		if (count <= 0)
+		{
+			return -1;
+		}
+
+		bytes += count;
+		len -= count;
+	}
+
+	return 0;
+}
+
+// Pipes can not seek, so skipped data is read
+int tar_skip(int fd, size_t len)
+{
+	char buffer[TAR_BLOCK_SIZE * 8];
+
+	while (len > 0)
+	{
+		size_t chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+		if (tar_read_all(fd, buffer, chunk) != 0)
+		{
+			return -1;
+		}
+
+		len -= chunk;
+	}
+
+	return 0;
+}
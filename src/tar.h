@@ -0,0 +1,24 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include "bmp.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_LEN 100 // names are stored without the directory, so the prefix field is not used
+
+/*
+ * Minimal POSIX ustar archives on file descriptors, written and read strictly in order so that
+ * they can go through pipes. Sizes too large for the octal field use the base-256 extension.
+ */
+int tar_write_header(int fd, const char *name, size_t size);
+int tar_write_padding(int fd, size_t size); // after size bytes of file data
+int tar_write_end(int fd);
+
+/*
+ * Reads the next regular file (other entries are skipped) into a malloc()'d buffer. The name
+ * includes the prefix of the entry. Returns 1 at the end of the archive and -1 on error.
+ */
+int tar_read_file(int fd, char *name, size_t name_len, bmp_byte_t **data, size_t *size);
+
+#endif
+/* TAR_H */
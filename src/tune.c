@@ -0,0 +1,448 @@
+#include "tune.h"
+#include "kernels.h"
+#include "ntt.h"
+#include "lsb.h"
+#include "pool.h"
+#include "writer.h"
+#include "arena.h"
+#include "cripto.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TUNE_PAYLOAD_SIZE (4 * 1024 * 1024) // synthetic payload of the kernel and chunk benchmarks
+#define TUNE_K 3 // k and depth of the chunk benchmark
+#define TUNE_DEPTH 2
+#define TUNE_SHADOWS 4
+#define TUNE_RUNS 3 // the best of these runs is kept
+#define TUNE_IO_FILES 8
+#define TUNE_IO_FILE_SIZE (2 * 1024 * 1024)
+#define TUNE_NTT_K 32 // k and n of the large k engine benchmark
+#define TUNE_NTT_SHADOWS 128
+#define TUNE_NTT_BLOCKS 4096
+#define TUNE_MIN_CHUNK 256
+#define TUNE_MAX_CHUNK 65536
+
+static const size_t tune_chunk_sizes[] = { 1024, 2048, 4096, 8192, 16384 };
+static const size_t tune_thread_counts[] = { 1, 2, 4, 8, 16 };
+
+struct tune_io_job {
+	const char *dir;
+	bmp_byte_t *data;
+};
+
+double tune_now();
+double tune_kernels(size_t k, int variant, bmp_byte_t *payload, bmp_byte_t *out);
+double tune_ntt(int batch, bmp_byte_t *payload, bmp_byte_t *out);
+double tune_chunk(size_t chunk_blocks, bmp_byte_t *payload, bmp_byte_t *covers, bmp_byte_t *shadow_bytes);
+double tune_io(const char *dir, size_t threads, bmp_byte_t *data);
+int tune_write_file(void *arg, size_t index);
+int tune_profile_path(char *path, size_t size, int create_dir);
+int tune_write_profile(struct tune_profile *profile, const char *path);
+void tune_apply(struct tune_profile *profile);
+
+int tune_run(const char *dir)
+{
+	struct tune_profile profile;
+	memset(&profile, 0, sizeof(profile));
+	profile.chunk_blocks = PAYLOAD_CHUNK_BLOCKS;
+	profile.io_threads = POOL_MAX_THREADS;
+	profile.ntt_crossover = NTT_DEFAULT_CROSSOVER;
+
+	size_t cover_size = lsb_cover_bytes(TUNE_PAYLOAD_SIZE / TUNE_K, TUNE_DEPTH);
+	bmp_byte_t *payload = arena_alloc_buffer(TUNE_PAYLOAD_SIZE * sizeof(bmp_byte_t));
+	bmp_byte_t *out = arena_alloc_buffer(TUNE_PAYLOAD_SIZE * sizeof(bmp_byte_t));
+	bmp_byte_t *covers = arena_alloc_buffer(TUNE_SHADOWS * cover_size * sizeof(bmp_byte_t));
+	bmp_byte_t *data = arena_alloc_buffer(TUNE_IO_FILE_SIZE * sizeof(bmp_byte_t));
+	int status = -1;
+	size_t i, k;
+
+	if (payload == NULL || out == NULL || covers == NULL || data == NULL)
+	{
+		goto free_buffers;
+	}
+
+	for (i = 0; i < TUNE_PAYLOAD_SIZE; i++)
+	{
+		payload[i] = rand() % 251;
+	}
+
+	for (i = 0; i < TUNE_IO_FILE_SIZE; i++)
+	{
+		data[i] = rand();
+	}
+
+	printf("Kernels (share and recover of %d MB):\n", TUNE_PAYLOAD_SIZE / (1024 * 1024));
+	for (k = MIN_K; k <= TUNE_MAX_K; k++)
+	{
+		if (!kernel_has_fixed(k))
+		{
+			continue;
+		}
+
+		double fixed = tune_kernels(k, KERNEL_FIXED, payload, out);
+		double generic = tune_kernels(k, KERNEL_GENERIC, payload, out);
+
+		profile.kernels[k] = generic < fixed ? KERNEL_GENERIC : KERNEL_FIXED;
+		kernel_select(k, profile.kernels[k]);
+		printf("-> k = %lu: fixed %.2f ms, generic %.2f ms\n", (unsigned long)k, fixed * 1000, generic * 1000);
+	}
+
+	// The engine takes about the same time for any k and n, while the kernels grow with k * n
+	double direct = tune_ntt(0, payload, out);
+	double batch = tune_ntt(1, payload, out);
+	profile.ntt_crossover = (size_t)(TUNE_NTT_K * TUNE_NTT_SHADOWS * batch / direct) + 1;
+	ntt_set_crossover(profile.ntt_crossover);
+	printf("Large k engine (k = %d, n = %d): kernels %.2f ms, engine %.2f ms, used from k * n = %lu\n", TUNE_NTT_K,
+		TUNE_NTT_SHADOWS, direct * 1000, batch * 1000, (unsigned long)profile.ntt_crossover);
+
+	printf("Chunk size (blocks):\n");
+	double best = 0;
+	for (i = 0; i < sizeof(tune_chunk_sizes) / sizeof(tune_chunk_sizes[0]); i++)
+	{
+		double time = tune_chunk(tune_chunk_sizes[i], payload, covers, out);
+		if (i == 0 || time < best)
+		{
+			best = time;
+			profile.chunk_blocks = tune_chunk_sizes[i];
+		}
+
+		printf("-> %lu: %.2f ms\n", (unsigned long)tune_chunk_sizes[i], time * 1000);
+	}
+
+	printf("I/O threads (%d files of %d MB in %s):\n", TUNE_IO_FILES, TUNE_IO_FILE_SIZE / (1024 * 1024), dir);
+	for (i = 0; i < sizeof(tune_thread_counts) / sizeof(tune_thread_counts[0]); i++)
+	{
+		double time = tune_io(dir, tune_thread_counts[i], data);
+		if (time < 0)
+		{
+			printe("Error: unable to write test files in %s.\n", dir);
+			goto free_buffers;
+		}
+
+		if (i == 0 || time < best)
+		{
+			best = time;
+			profile.io_threads = tune_thread_counts[i];
+		}
+
+		printf("-> %lu: %.2f ms\n", (unsigned long)tune_thread_counts[i], time * 1000);
+	}
+
+	char path[FILENAME_MAX];
+	if (tune_profile_path(path, sizeof(path), 1) != 0 || tune_write_profile(&profile, path) != 0)
+	{
+		printe("Error: unable to write the tuning profile.\n");
+		goto free_buffers;
+	}
+
+	printf("Profile written to %s: chunk of %lu blocks, %lu I/O threads.\n", path,
+		(unsigned long)profile.chunk_blocks, (unsigned long)profile.io_threads);
+	status = 0;
+
+	// Error handling
+free_buffers:
+	arena_free_buffer(data);
+	arena_free_buffer(covers);
+	arena_free_buffer(out);
+	arena_free_buffer(payload);
+
+	return status;
+}
+
+int tune_load_profile()
+{
+	char path[FILENAME_MAX];
+	if (tune_profile_path(path, sizeof(path), 0) != 0)
+	{
+		return 0;
+	}
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	struct tune_profile profile;
+	memset(&profile, 0, sizeof(profile));
+	profile.chunk_blocks = PAYLOAD_CHUNK_BLOCKS;
+	profile.io_threads = POOL_MAX_THREADS;
+	profile.ntt_crossover = NTT_DEFAULT_CROSSOVER;
+
+	char line[128], key[32], value[32];
+	unsigned long number, k;
+	int status = 0;
+
+	while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%31s %31s", key, value) != 2)
+		{
+			continue;
+		}
+
+		number = strtoul(value, NULL, 10);
+
+		if (strcmp(key, "chunk_blocks") == 0)
+		{
+			profile.chunk_blocks = number;
+			status = number < TUNE_MIN_CHUNK || number > TUNE_MAX_CHUNK ? -1 : 0;
+		}
+		else if (strcmp(key, "io_threads") == 0)
+		{
+			profile.io_threads = number;
+			status = number < 1 || number > POOL_MAX_THREADS ? -1 : 0;
+		}
+		else if (strcmp(key, "ntt_crossover") == 0)
+		{
+			profile.ntt_crossover = number;
+			status = number < 1 ? -1 : 0;
+		}
+		else if (sscanf(key, "kernel_%lu", &k) == 1 && k <= TUNE_MAX_K)
+		{
+			profile.kernels[k] = strcmp(value, "generic") == 0 ? KERNEL_GENERIC : KERNEL_FIXED;
+			status = strcmp(value, "generic") != 0 && strcmp(value, "fixed") != 0 ? -1 : 0;
+		}
+
+		// Anything else may come from a newer version
+	}
+
+	fclose(file);
+
+	if (status != 0)
+	{
+		printe("Error: invalid tuning profile %s (run --tune again).\n", path);
+		return -1;
+	}
+
+	tune_apply(&profile);
+	printv("Using tuning profile %s.\n", path);
+
+	return 0;
+}
+
+void tune_apply(struct tune_profile *profile)
+{
+	size_t k;
+	for (k = MIN_K; k <= TUNE_MAX_K; k++)
+	{
+		kernel_select(k, profile->kernels[k]);
+	}
+
+	payload_chunk_blocks = profile->chunk_blocks;
+	pool_set_threads(profile->io_threads);
+	ntt_set_crossover(profile->ntt_crossover);
+}
+
+double tune_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Best time to evaluate the whole payload for one shadow and to solve it back
+double tune_kernels(size_t k, int variant, bmp_byte_t *payload, bmp_byte_t *out)
+{
+	kernel_evaluate_t evaluate = kernel_evaluate_variant(k, variant);
+	kernel_solve_t solve = kernel_solve_variant(k, variant);
+	bmp_byte_t powers[TUNE_MAX_K];
+	size_t blocks = TUNE_PAYLOAD_SIZE / k;
+	double best = 0;
+	int run;
+
+	// Any matrix will do, only the time matters
+	kernel_powers(3, k, powers);
+
+	for (run = 0; run < TUNE_RUNS; run++)
+	{
+		double start = tune_now();
+		evaluate(payload, blocks, k, powers, out);
+		solve(payload, blocks, blocks, k, payload, out);
+		double time = tune_now() - start;
+
+		best = run == 0 || time < best ? time : best;
+	}
+
+	return best;
+}
+
+// Best time to evaluate TUNE_NTT_BLOCKS blocks for every shadow, with the kernels or at once
+double tune_ntt(int batch, bmp_byte_t *payload, bmp_byte_t *out)
+{
+	kernel_evaluate_t evaluate = kernel_evaluate_for(TUNE_NTT_K);
+	bmp_byte_t powers[TUNE_NTT_K];
+	double best = 0;
+	size_t j;
+	int run;
+
+	for (run = 0; run < TUNE_RUNS; run++)
+	{
+		double start = tune_now();
+		if (batch)
+		{
+			ntt_evaluate_blocks(payload, TUNE_NTT_BLOCKS, TUNE_NTT_K, 1, TUNE_NTT_SHADOWS, out, TUNE_NTT_BLOCKS);
+		}
+		else
+		{
+			for (j = 0; j < TUNE_NTT_SHADOWS; j++)
+			{
+				kernel_powers(j + 1, TUNE_NTT_K, powers);
+				evaluate(payload, TUNE_NTT_BLOCKS, TUNE_NTT_K, powers, &out[j * TUNE_NTT_BLOCKS]);
+			}
+		}
+		double time = tune_now() - start;
+
+		best = run == 0 || time < best ? time : best;
+	}
+
+	return best;
+}
+
+// Best time of the share loop (evaluate and embed) over the payload with chunks of chunk_blocks
+double tune_chunk(size_t chunk_blocks, bmp_byte_t *payload, bmp_byte_t *covers, bmp_byte_t *shadow_bytes)
+{
+	kernel_evaluate_t evaluate = kernel_evaluate_for(TUNE_K);
+	size_t blocks = TUNE_PAYLOAD_SIZE / TUNE_K;
+	size_t cover_size = lsb_cover_bytes(blocks, TUNE_DEPTH);
+	bmp_byte_t powers[TUNE_SHADOWS * TUNE_K];
+	size_t j, chunk, end;
+	double best = 0;
+	int run;
+
+	for (j = 0; j < TUNE_SHADOWS; j++)
+	{
+		kernel_powers(j + 1, TUNE_K, &powers[j * TUNE_K]);
+	}
+
+	for (run = 0; run < TUNE_RUNS; run++)
+	{
+		double start = tune_now();
+		for (chunk = 0; chunk < blocks; chunk = end)
+		{
+			end = chunk + chunk_blocks < blocks ? chunk + chunk_blocks : blocks;
+			for (j = 0; j < TUNE_SHADOWS; j++)
+			{
+				evaluate(&payload[chunk * TUNE_K], end - chunk, TUNE_K, &powers[j * TUNE_K], shadow_bytes);
+				lsb_embed(shadow_bytes, end - chunk, &covers[j * cover_size + lsb_cover_offset(chunk, TUNE_DEPTH)],
+					chunk, TUNE_DEPTH);
+			}
+		}
+		double time = tune_now() - start;
+
+		best = run == 0 || time < best ? time : best;
+	}
+
+	return best;
+}
+
+// Time to write TUNE_IO_FILES files (as the shadow writer does) with the given amount of threads
+double tune_io(const char *dir, size_t threads, bmp_byte_t *data)
+{
+	struct tune_io_job job = { dir, data };
+
+	pool_set_threads(threads);
+	double start = tune_now();
+	int status = pool_run(TUNE_IO_FILES, tune_write_file, &job);
+	double time = tune_now() - start;
+	pool_set_threads(POOL_MAX_THREADS);
+
+	return status == 0 ? time : -1;
+}
+
+int tune_write_file(void *arg, size_t index)
+{
+	struct tune_io_job *job = arg;
+	char path[FILENAME_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/.cripto-tune-XXXXXX", job->dir) >= sizeof(path))
+	{
+		return -1;
+	}
+
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	int status = posix_fallocate(fd, 0, TUNE_IO_FILE_SIZE);
+	status = status == EINVAL || status == EOPNOTSUPP ? 0 : status;
+
+	if (status == 0 && pwrite(fd, job->data, TUNE_IO_FILE_SIZE, 0) != TUNE_IO_FILE_SIZE)
+	{
+		status = -1;
+	}
+
+	if (status == 0 && fsync_mode != WRITER_SYNC_NONE && fsync(fd) != 0)
+	{
+		status = -1;
+	}
+
+	close(fd);
+	unlink(path);
+
+	return status == 0 ? 0 : -1;
+}
+
+int tune_profile_path(char *path, size_t size, int create_dir)
+{
+	const char *env = getenv(TUNE_PROFILE_ENV);
+	if (env != NULL && strlen(env) > 0)
+	{
+		return snprintf(path, size, "%s", env) >= size ? -1 : 0;
+	}
+
+	const char *home = getenv("HOME");
+	char host[256];
+
+	if (home == NULL || gethostname(host, sizeof(host)) != 0)
+	{
+		return -1;
+	}
+
+	host[sizeof(host) - 1] = 0;
+
+	if (snprintf(path, size, "%s/%s", home, TUNE_PROFILE_DIR) >= size)
+	{
+		return -1;
+	}
+
+	if (create_dir && mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		return -1;
+	}
+
+	return snprintf(path, size, "%s/%s/%s.profile", home, TUNE_PROFILE_DIR, host) >= size ? -1 : 0;
+}
+
+int tune_write_profile(struct tune_profile *profile, const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	fprintf(file, "# Written by cripto --tune\n");
+	fprintf(file, "chunk_blocks %lu\n", (unsigned long)profile->chunk_blocks);
+	fprintf(file, "io_threads %lu\n", (unsigned long)profile->io_threads);
+	fprintf(file, "ntt_crossover %lu\n", (unsigned long)profile->ntt_crossover);
+
+	size_t k;
+	for (k = MIN_K; k <= TUNE_MAX_K; k++)
+	{
+		if (kernel_has_fixed(k))
+		{
+			fprintf(file, "kernel_%lu %s\n", (unsigned long)k,
+				profile->kernels[k] == KERNEL_GENERIC ? "generic" : "fixed");
+		}
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
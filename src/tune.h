@@ -0,0 +1,33 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdlib.h>
+
+#define TUNE_PROFILE_ENV "CRIPTO_PROFILE" // overrides the path of the profile
+#define TUNE_PROFILE_DIR ".cripto" // in $HOME, with one "<host name>.profile" per host
+#define TUNE_MAX_K 8 // largest k with a fixed kernel
+
+/*
+ * Per host tuning profile: the kernel variant for each k, the k * n above which the large k
+ * engine is used (see ntt.h), the blocks processed per chunk and the threads used to read and
+ * write images. It is a text file of "key value" lines.
+ */
+struct tune_profile {
+	size_t chunk_blocks;
+	size_t io_threads;
+	size_t ntt_crossover;
+	int kernels[TUNE_MAX_K + 1]; // KERNEL_* for each k, only used if there is a fixed version for it
+};
+
+/*
+ * Runs short benchmarks of the kernels, the large k engine, the chunk size (on synthetic data)
+ * and the amount of I/O threads (writing temporary files in dir), then writes the profile of
+ * this host.
+ */
+int tune_run(const char *dir);
+
+// Applies the profile of this host, if there is one. Returns -1 only if it exists but is invalid.
+int tune_load_profile();
+
+#endif
+/* TUNE_H */
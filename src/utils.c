@@ -1,55 +1,216 @@
 #include "utils.h"
 #include "cripto_rand.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <math.h>
+#include <string.h>
 
-int *utils_generate_rand_numbers(size_t size, bmp_word_t seed);
-void utils_swap(bmp_byte_t *array, int i, int j);
+#define FEISTEL_ROUNDS 4
+
+void *utils_generate_rand_numbers(size_t size, bmp_word_t seed, size_t width);
+void utils_swap(bmp_byte_t *array, size_t i, size_t j);
+size_t utils_feistel(size_t value, int half_bits, bmp_word_t seed, int inverse);
 
 int utils_permute(bmp_byte_t *pixels, size_t size, bmp_word_t seed)
 {
-	int *rand_numbers = utils_generate_rand_numbers(size, seed);
+	// The swaps use the random numbers in the order they are generated, so no table is needed
+	randomize(seed);
+
+	size_t i;
+	for (i = size; i-- > 0;)
+	{
+		utils_swap(pixels, i, randint(size - 1));
+	}
+
+	return 0;
+}
+
+int utils_permute_inverse(bmp_byte_t *pixels, size_t size, bmp_word_t seed)
+{
+	size_t i;
+
+	// The table is as narrow as the image allows, it holds one entry per byte
+	if (size <= UINT32_MAX)
+	{
+		uint32_t *rand_numbers = utils_generate_rand_numbers(size, seed, sizeof(uint32_t));
+		if (rand_numbers == NULL)
+		{
+			return size == 0 ? 0 : -1;
+		}
+
+		for (i = 0; i < size; i++)
+		{
+			utils_swap(pixels, i, rand_numbers[size - 1 - i]);
+		}
+
+		arena_free_buffer(rand_numbers);
+		return 0;
+	}
+
+	uint64_t *rand_numbers = utils_generate_rand_numbers(size, seed, sizeof(uint64_t));
 	if (rand_numbers == NULL)
 	{
 		return -1;
 	}
 
-	int i;
-	for (i = size - 1; i >= 0; i--)
+	for (i = 0; i < size; i++)
 	{
 		utils_swap(pixels, i, rand_numbers[size - 1 - i]);
 	}
 
-	free(rand_numbers);
+	arena_free_buffer(rand_numbers);
 	return 0;
 }
 
-int utils_permute_inverse(bmp_byte_t *pixels, size_t size, bmp_word_t seed)
+int utils_shuffle(bmp_byte_t *pixels, size_t size, bmp_word_t seed, int mode)
 {
-	int *rand_numbers = utils_generate_rand_numbers(size, seed);
-	if (rand_numbers == NULL)
+	switch (mode)
+	{
+		case PERMUTE_SWAP:
+			return utils_permute(pixels, size, seed);
+		case PERMUTE_INDEX:
+			return utils_index_permute(pixels, size, seed);
+		default:
+			return 0;
+	}
+}
+
+int utils_unshuffle(bmp_byte_t *pixels, size_t size, bmp_word_t seed, int mode)
+{
+	switch (mode)
+	{
+		case PERMUTE_SWAP:
+			return utils_permute_inverse(pixels, size, seed);
+		case PERMUTE_INDEX:
+			return utils_index_permute_inverse(pixels, size, seed);
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Index permutation: pixels[i] is replaced by pixels[utils_permute_index(i)]. The bijection is
+ * a small Feistel network over the smallest even bit width that covers size, with cycle walking
+ * to stay inside [0, size).
+ */
+int utils_index_permute(bmp_byte_t *pixels, size_t size, bmp_word_t seed)
+{
+	bmp_byte_t *copy = arena_alloc_buffer(size * sizeof(bmp_byte_t));
+	if (copy == NULL)
 	{
 		return -1;
 	}
 
-	int i;
+	memcpy(copy, pixels, size);
+
+	size_t i;
 	for (i = 0; i < size; i++)
 	{
-		utils_swap(pixels, i, rand_numbers[size - 1 - i]);
+		pixels[i] = copy[utils_permute_index(i, size, seed)];
+	}
+
+	arena_free_buffer(copy);
+	return 0;
+}
+
+int utils_index_permute_inverse(bmp_byte_t *pixels, size_t size, bmp_word_t seed)
+{
+	bmp_byte_t *copy = arena_alloc_buffer(size * sizeof(bmp_byte_t));
+	if (copy == NULL)
+	{
+		return -1;
+	}
+
+	memcpy(copy, pixels, size);
+
+	size_t i;
+	for (i = 0; i < size; i++)
+	{
+		pixels[utils_permute_index(i, size, seed)] = copy[i];
 	}
-	free(rand_numbers);
+
+	arena_free_buffer(copy);
 	return 0;
 }
 
-int *utils_generate_rand_numbers(size_t size, bmp_word_t seed)
+int utils_half_bits(size_t size)
+{
+	int bits = 2;
+	while (bits < 64 && ((size_t)1 << bits) < size)
+	{
+		bits += 2;
+	}
+
+	return bits / 2;
+}
+
+size_t utils_permute_index(size_t index, size_t size, bmp_word_t seed)
+{
+	int half_bits = utils_half_bits(size);
+	do
+	{
+		index = utils_feistel(index, half_bits, seed, 0);
+	} while (index >= size);
+
+	return index;
+}
+
+size_t utils_permute_index_inverse(size_t index, size_t size, bmp_word_t seed)
+{
+	int half_bits = utils_half_bits(size);
+	do
+	{
+		index = utils_feistel(index, half_bits, seed, 1);
+	} while (index >= size);
+
+	return index;
+}
+
+uint64_t utils_round_function(uint64_t value, bmp_word_t seed, int round)
 {
-	if (size == 0)
+	// splitmix64 finalizer
+	uint64_t z = value ^ ((uint64_t)seed << 32) ^ ((uint64_t)(round + 1) << 48);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+size_t utils_feistel(size_t value, int half_bits, bmp_word_t seed, int inverse)
+{
+	uint64_t mask = ((uint64_t)1 << half_bits) - 1;
+	uint64_t left = ((uint64_t)value >> half_bits) & mask;
+	uint64_t right = (uint64_t)value & mask;
+	uint64_t aux;
+	int round;
+
+	for (round = 0; round < FEISTEL_ROUNDS; round++)
+	{
+		if (!inverse)
+		{
+			aux = left ^ (utils_round_function(right, seed, round) & mask);
+			left = right;
+			right = aux;
+		}
+		else
+		{
+			aux = right ^ (utils_round_function(left, seed, FEISTEL_ROUNDS - 1 - round) & mask);
+			right = left;
+			left = aux;
+		}
+	}
+
+	return (size_t)((left << half_bits) | right);
+}
+
+void *utils_generate_rand_numbers(size_t size, bmp_word_t seed, size_t width)
+{
+	if (size == 0 || size > SIZE_MAX / width)
 	{
 		return NULL;
 	}
 
-	int *rand_numbers = malloc(size * sizeof(int));
+	void *rand_numbers = arena_alloc_buffer(size * width);
 	if (rand_numbers == NULL)
 	{
 		return NULL;
@@ -57,16 +218,23 @@ int *utils_generate_rand_numbers(size_t size, bmp_word_t seed)
 
 	randomize(seed);
 
-	int i;
+	size_t i;
 	for (i = 0; i < size; i++)
 	{
-		rand_numbers[i] = randint(size -1);
+		if (width == sizeof(uint32_t))
+		{
+			((uint32_t*)rand_numbers)[i] = randint(size - 1);
+		}
+		else
+		{
+			((uint64_t*)rand_numbers)[i] = randint(size - 1);
+		}
 	}
 
 	return rand_numbers;
 }
 
-void utils_swap(bmp_byte_t *array, int i, int j)
+void utils_swap(bmp_byte_t *array, size_t i, size_t j)
 {
 	bmp_byte_t aux = array[i];
 	array[i] = array[j];
@@ -87,15 +255,34 @@ int printv(const char *fmt, ...)
 	return ret;
 }
 
-size_t shadow_size_for(bmp_dword_t image_size, int k)
+size_t shadow_size_for(size_t image_size, int k, int depth)
 {
-	int lsb_bytes = (k >= 8 ? 8 : 4);
 	size_t shadow_base_size = (image_size - (image_size % k)) / k;
-	return shadow_base_size * lsb_bytes;
+	return (shadow_base_size * 8 + depth - 1) / depth;
+}
+
+int padding_for_width(bmp_dword_t width, bmp_word_t bits_per_pixel)
+{
+	size_t row_bytes = ((size_t)width * bits_per_pixel + 7) / 8;
+	return (4 - (row_bytes % 4)) % 4;
+}
+
+size_t image_size_for(bmp_dword_t width, bmp_dword_t height, bmp_word_t bits_per_pixel)
+{
+	size_t row_bytes = ((size_t)width * bits_per_pixel + 7) / 8;
+	size_t rows = image_rows_for(height);
+	row_bytes += padding_for_width(width, bits_per_pixel);
+
+	if (rows != 0 && row_bytes > SIZE_MAX / rows)
+	{
+		return 0;
+	}
+
+	return row_bytes * rows;
 }
 
-int padding_for_width(bmp_dword_t width)
+size_t image_rows_for(bmp_dword_t height)
 {
-	double quarter_width = (double)width / 4;
-	return ((int)ceil(quarter_width) * 4) - width;
+	int32_t signed_height = (int32_t)height;
+	return signed_height < 0 ? (size_t)(-(int64_t)signed_height) : (size_t)height;
 }
\ No newline at end of file
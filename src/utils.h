@@ -5,6 +5,11 @@
 #include "bmp.h"
 
 extern int verbose_mode;
+extern int memo_mode; // cache block results (see memo.h)
+extern int fsync_mode; // WRITER_SYNC_* policy for the shadows (see writer.h)
+extern size_t payload_chunk_blocks; // PAYLOAD_CHUNK_BLOCKS unless set by the tuning profile
+extern int checkpoint_interval; // seconds between checkpoints, 0 if disabled (see checkpoint.h)
+extern int resume_mode; // continue from the checkpoints of an interrupted job
 
 #define printe(...) fprintf(stderr, __VA_ARGS__)
 
@@ -15,13 +20,29 @@ extern int verbose_mode;
 #define LSB_POS_2 1
 #define LSB_POS_3 2
 
+#define PERMUTE_NONE 0
+#define PERMUTE_SWAP 1 // sequence of swaps given by the assignment
+#define PERMUTE_INDEX 2 // keyed bijection, can be evaluated for a single index
+
 int utils_permute_inverse(bmp_byte_t *pixels, size_t size, bmp_word_t seed);
 int utils_permute(bmp_byte_t *pixels, size_t size, bmp_word_t seed);
+int utils_index_permute(bmp_byte_t *pixels, size_t size, bmp_word_t seed);
+int utils_index_permute_inverse(bmp_byte_t *pixels, size_t size, bmp_word_t seed);
+size_t utils_permute_index(size_t index, size_t size, bmp_word_t seed);
+size_t utils_permute_index_inverse(size_t index, size_t size, bmp_word_t seed);
+int utils_shuffle(bmp_byte_t *pixels, size_t size, bmp_word_t seed, int mode);
+int utils_unshuffle(bmp_byte_t *pixels, size_t size, bmp_word_t seed, int mode);
 int printv(const char *fmt, ...);
 
-int padding_for_width(bmp_dword_t width);
+// Rows are padded to a multiple of 4 bytes
+int padding_for_width(bmp_dword_t width, bmp_word_t bits_per_pixel);
+size_t image_size_for(bmp_dword_t width, bmp_dword_t height, bmp_word_t bits_per_pixel); // 0 if it overflows
+
+// Amount of rows of an image, a negative height (read as signed) means the rows are stored top-down
+size_t image_rows_for(bmp_dword_t height);
 
-size_t shadow_size_for(bmp_dword_t image_size, int k);
+// Cover bytes needed for an image, when depth LSBs are used in each cover byte
+size_t shadow_size_for(size_t image_size, int k, int depth);
 
 #endif
 /* UTILS_H */
\ No newline at end of file
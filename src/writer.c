@@ -0,0 +1,252 @@
+#include "writer.h"
+#include "utils.h"
+#include "pool.h"
+#include "tar.h"
+#include "bundle.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int writer_tar_fd = -1;
+static char *writer_tar_filename; // NULL for stdout
+static const char *writer_bundle_filename;
+
+/*
+ * Removes the temporary files that were not renamed yet after images[failed] could not replace its
+ * original, and tells which images were replaced before it.
+ */
+void writer_abort_commit(struct bmp_handle **images, size_t count, size_t failed)
+{
+	size_t i;
+	for (i = failed; i < count; i++)
+	{
+		bmp_discard_temp(images[i]);
+	}
+
+	printe("Error: could not replace %s.\n", bmp_get_filename(images[failed]));
+	if (failed == 0)
+	{
+		printe("Error: none of the images were modified.\n");
+		return;
+	}
+
+	printe("Error: only these images were replaced, the rest were not modified:\n");
+	for (i = 0; i < failed; i++)
+	{
+		printe("  %s\n", bmp_get_filename(images[i]));
+	}
+}
+
+int writer_write_temp(void *arg, size_t index);
+int writer_sync_dir(const char *filename);
+int writer_write_tar(struct bmp_handle **images, size_t count);
+void writer_abort_commit(struct bmp_handle **images, size_t count, size_t failed);
+
+int writer_write_images(struct bmp_handle **images, size_t count)
+{
+	size_t i;
+
+	if (writer_tar_fd >= 0)
+	{
+		return writer_write_tar(images, count);
+	}
+
+	if (writer_bundle_filename != NULL)
+	{
+		if (bundle_write(writer_bundle_filename, images, count) != 0)
+		{
+			return -1;
+		}
+
+		return fsync_mode == WRITER_SYNC_ALL ? writer_sync_dir(writer_bundle_filename) : 0;
+	}
+
+	// Writing is bound by I/O rather than by the CPU, so each image gets its own thread
+	if (pool_run(count, writer_write_temp, images) != 0)
+	{
+		for (i = 0; i < count; i++)
+		{
+			bmp_discard_temp(images[i]);
+		}
+
+		printe("Error: the shadows could not be written, the cover images were not modified.\n");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (bmp_commit_temp(images[i]) != 0)
+		{
+			writer_abort_commit(images, count, i);
+			return -1;
+		}
+	}
+
+	if (fsync_mode == WRITER_SYNC_ALL)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (writer_sync_dir(bmp_get_filename(images[i])) != 0)
+			{
+				return -1;
+			}
+		}
+	}
+
+	printv("Images written: %lu (%lu threads)\n", (unsigned long)count, (unsigned long)pool_last_threads());
+	return 0;
+}
+
+int writer_write_temp(void *arg, size_t index)
+{
+	struct bmp_handle **images = arg;
+	return bmp_write_temp(images[index], fsync_mode != WRITER_SYNC_NONE);
+}
+
+// One entry after the other, so that nothing has to be kept or seeked back to
+int writer_write_tar(struct bmp_handle **images, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		const char *filename = bmp_get_filename(images[i]);
+		const char *slash = strrchr(filename, '/');
+		const char *name = slash != NULL ? slash + 1 : filename;
+
+		size_t size = bmp_output_size(images[i]);
+		if (size == 0 || tar_write_header(writer_tar_fd, name, size) != 0 ||
+			bmp_write_stream(images[i], writer_tar_fd) != 0 || tar_write_padding(writer_tar_fd, size) != 0)
+		{
+			printe("Error: could not write %s to the archive.\n", name);
+			return -1;
+		}
+	}
+
+	printv("Images written to the archive: %lu\n", (unsigned long)count);
+	return 0;
+}
+
+int writer_open_tar(const char *filename)
+{
+	if (strcmp(filename, BMP_STDIO_NAME) == 0)
+	{
+		writer_tar_fd = STDOUT_FILENO;
+		return 0;
+	}
+
+	writer_tar_filename = strdup(filename);
+	if (writer_tar_filename == NULL)
+	{
+		return -1;
+	}
+
+	writer_tar_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (writer_tar_fd < 0)
+	{
+		free(writer_tar_filename);
+		writer_tar_filename = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int writer_close_tar(int failed)
+{
+	if (writer_tar_fd < 0)
+	{
+		return 0;
+	}
+
+	int status = failed ? -1 : tar_write_end(writer_tar_fd);
+
+	if (writer_tar_filename != NULL)
+	{
+		if (status == 0 && fsync_mode != WRITER_SYNC_NONE && fsync(writer_tar_fd) != 0)
+		{
+			status = -1;
+		}
+
+		if (close(writer_tar_fd) != 0)
+		{
+			status = -1;
+		}
+
+		if (status == 0 && fsync_mode == WRITER_SYNC_ALL)
+		{
+			status = writer_sync_dir(writer_tar_filename);
+		}
+
+		if (status != 0)
+		{
+			unlink(writer_tar_filename);
+		}
+
+		free(writer_tar_filename);
+		writer_tar_filename = NULL;
+	}
+
+	writer_tar_fd = -1;
+	return failed ? -1 : status;
+}
+
+void writer_set_bundle(const char *filename)
+{
+	writer_bundle_filename = filename;
+}
+
+// Flushes the directory entry of a renamed file
+int writer_sync_dir(const char *filename)
+{
+	char dir[FILENAME_MAX];
+	const char *slash = strrchr(filename, '/');
+	size_t len = slash != NULL ? (size_t)(slash - filename) : 0;
+
+	if (len >= sizeof(dir))
+	{
+		return -1;
+	}
+
+	if (slash == NULL)
+	{
+		strcpy(dir, ".");
+	}
+	else
+	{
+		memcpy(dir, filename, len);
+		dir[len] = 0;
+	}
+
+	int fd = open(len > 0 || slash == NULL ? dir : "/", O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	int status = fsync(fd);
+	close(fd);
+
+	return status;
+}
+
+int writer_sync_mode_for(const char *name)
+{
+	if (strcmp(name, "none") == 0)
+	{
+		return WRITER_SYNC_NONE;
+	}
+
+	if (strcmp(name, "file") == 0)
+	{
+		return WRITER_SYNC_FILE;
+	}
+
+	if (strcmp(name, "all") == 0)
+	{
+		return WRITER_SYNC_ALL;
+	}
+
+	return -1;
+}
@@ -0,0 +1,33 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "bmp.h"
+
+#define WRITER_SYNC_NONE 0 // the files are renamed into place without flushing them
+#define WRITER_SYNC_FILE 1 // each file is flushed to disk before it replaces the original
+#define WRITER_SYNC_ALL 2 // the directories are flushed too after the renames
+
+/*
+ * Writes all the images (headers, pixels and shadow information) in parallel to temporary files,
+ * and only when every one of them succeeded, renames them over the originals. If a write fails the
+ * original files are left as they were; if a rename fails the remaining temporary files are removed
+ * and the images already replaced are listed. fsync_mode selects the WRITER_SYNC_* policy.
+ */
+int writer_write_images(struct bmp_handle **images, size_t count);
+
+/*
+ * While an archive is open, writer_write_images() appends the shadows to it instead, named after
+ * their covers, which are not modified. "-" writes it to stdout. writer_close_tar() ends the
+ * archive, or removes it if the shadows could not be written.
+ */
+int writer_open_tar(const char *filename);
+int writer_close_tar(int failed);
+
+// While set, writer_write_images() writes the shadows as a bundle instead (see bundle.h)
+void writer_set_bundle(const char *filename);
+
+// WRITER_SYNC_* for a name given on the command line, -1 if unknown
+int writer_sync_mode_for(const char *name);
+
+#endif
+/* WRITER_H */